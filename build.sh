@@ -1,4 +1,13 @@
 clang++-17 -std=c++23 \
     $(find . -name '*.cpp') \
-    `llvm-config-18 --cxxflags --ldflags --system-libs --libs core mc support target` \
+    `llvm-config-18 --cxxflags --ldflags --system-libs --libs core mc support target linker bitreader bitwriter passes lto all-targets` \
     -o bin/prex
+
+# libprex.a: everything except the command line entry point, use it with
+# src/Library/Prex.hpp and link against the same LLVM libraries
+mkdir -p bin/obj
+for f in $(find ./src -name '*.cpp' ! -path ./src/main.cpp); do
+    clang++-17 -std=c++23 -c "$f" `llvm-config-18 --cxxflags` \
+        -o "bin/obj/$(echo "${f#./src/}" | tr / _).o" || exit 1
+done
+ar rcs bin/libprex.a bin/obj/*.o
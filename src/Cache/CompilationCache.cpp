@@ -0,0 +1,211 @@
+#include "CompilationCache.hpp"
+#include "../Parser/Ast/DefunNode.hpp"
+#include "../Parser/Ast/StructNode.hpp"
+#include "../Version.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA256.h>
+#include <llvm/Support/raw_ostream.h>
+#include <vector>
+
+CacheKey::CacheKey(const std::string &kind) {
+  add(kind);
+  add(PREX_VERSION);
+  add(LLVM_VERSION_STRING);
+}
+
+void CacheKey::add(const std::string &data) {
+  // length prefix keeps ("ab", "c") and ("a", "bc") apart
+  material += std::to_string(data.size()) + ":" + data;
+}
+
+void CacheKey::addSignatures(RootNode *root, const std::string &source) {
+  if (!root)
+    return;
+  for (auto node : root->nodes) {
+    if (auto def = dynamic_cast<DefunNode *>(node)) {
+      // pub changes the linkage and the calling convention callers use
+      std::string visibility = def->isPublic ? "pub " : "";
+      if (!def->typeParams.empty()) {
+        add(visibility + source.substr(def->sourceBegin,
+                                       def->sourceEnd - def->sourceBegin));
+        continue;
+      }
+      std::string signature = visibility + def->name + "(";
+      for (auto &arg : def->args)
+        signature += arg.type + ",";
+      add(signature + ")>" + def->ret_type);
+    } else if (auto structNode = dynamic_cast<StructNode *>(node)) {
+      // the layout of what the signatures pass around
+      std::string layout = "struct " + structNode->name + "{";
+      for (auto &field : structNode->fields)
+        layout += field.type + " " + field.name + ";";
+      layout += "}";
+      for (auto &attribute : structNode->attributes) {
+        layout += "#" + attribute.name;
+        for (auto &arg : attribute.args)
+          layout += "," + arg;
+      }
+      add(layout);
+    }
+  }
+}
+
+std::string CacheKey::str() const {
+  auto digest = llvm::SHA256::hash(llvm::arrayRefFromStringRef(material));
+  return llvm::toHex(digest, true);
+}
+
+CompilationCache::CompilationCache(const std::string &directory,
+                                   uint64_t maxBytes)
+    : directory(directory), maxBytes(maxBytes) {
+  llvm::sys::fs::create_directories(directory);
+}
+
+std::string CompilationCache::defaultDirectory() {
+  if (const char *dir = std::getenv("PREX_CACHE_DIR"))
+    return dir;
+  if (const char *xdg = std::getenv("XDG_CACHE_HOME"))
+    return std::string(xdg) + "/prex";
+  if (const char *home = std::getenv("HOME"))
+    return std::string(home) + "/.cache/prex";
+  return ".prex-cache";
+}
+
+std::string CompilationCache::entryPath(const std::string &key) {
+  return directory + "/prex-" + key;
+}
+
+bool CompilationCache::lookup(const std::string &key, std::string &data) {
+  std::string path = entryPath(key);
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer) {
+    misses++;
+    return false;
+  }
+  data = (*buffer)->getBuffer().str();
+  // the modification time doubles as the last use for eviction
+  int fd;
+  if (!llvm::sys::fs::openFileForWrite(path, fd, llvm::sys::fs::CD_OpenExisting,
+                                       llvm::sys::fs::OF_Append)) {
+    llvm::sys::fs::setLastAccessAndModificationTime(
+        fd, llvm::sys::TimePoint<>(std::chrono::system_clock::now()));
+    llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+  }
+  hits++;
+  return true;
+}
+
+void CompilationCache::store(const std::string &key, const std::string &data) {
+  // write to a temporary file and rename it, so readers never see a
+  // partially written entry
+  int fd;
+  llvm::SmallString<128> tmp;
+  if (llvm::sys::fs::createUniqueFile(directory + "/tmp-%%%%%%%%", fd, tmp))
+    return;
+  {
+    llvm::raw_fd_ostream out(fd, true);
+    out << data;
+    if (out.has_error()) {
+      out.clear_error();
+      llvm::sys::fs::remove(tmp);
+      return;
+    }
+  }
+  if (llvm::sys::fs::rename(tmp, entryPath(key)))
+    llvm::sys::fs::remove(tmp);
+}
+
+void CompilationCache::prune() {
+  struct Entry {
+    std::string path;
+    uint64_t size;
+    llvm::sys::TimePoint<> used;
+  };
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  std::error_code EC;
+  for (llvm::sys::fs::directory_iterator it(directory, EC), end;
+       it != end && !EC; it.increment(EC)) {
+    if (!llvm::sys::path::filename(it->path()).starts_with("prex-"))
+      continue;
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(it->path(), status))
+      continue;
+    entries.push_back(
+        {it->path(), status.getSize(), status.getLastModificationTime()});
+    total += status.getSize();
+  }
+  if (total <= maxBytes)
+    return;
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.used < b.used; });
+  for (auto &entry : entries) {
+    if (total <= maxBytes)
+      break;
+    if (!llvm::sys::fs::remove(entry.path))
+      total -= entry.size;
+  }
+}
+
+void CompilationCache::readTotals(uint64_t &totalHits, uint64_t &totalMisses) {
+  totalHits = totalMisses = 0;
+  auto buffer = llvm::MemoryBuffer::getFile(directory + "/stats");
+  if (!buffer)
+    return;
+  unsigned long long h = 0, m = 0;
+  if (sscanf((*buffer)->getBuffer().str().c_str(), "%llu %llu", &h, &m) == 2) {
+    totalHits = h;
+    totalMisses = m;
+  }
+}
+
+void CompilationCache::finish() {
+  prune();
+  if (!hits && !misses)
+    return;
+  uint64_t totalHits, totalMisses;
+  readTotals(totalHits, totalMisses);
+  int fd;
+  llvm::SmallString<128> tmp;
+  if (llvm::sys::fs::createUniqueFile(directory + "/tmp-%%%%%%%%", fd, tmp))
+    return;
+  {
+    llvm::raw_fd_ostream out(fd, true);
+    out << totalHits + hits << " " << totalMisses + misses << "\n";
+  }
+  if (llvm::sys::fs::rename(tmp, directory + "/stats"))
+    llvm::sys::fs::remove(tmp);
+}
+
+void CompilationCache::printStats() {
+  uint64_t entries = 0, size = 0;
+  std::error_code EC;
+  for (llvm::sys::fs::directory_iterator it(directory, EC), end;
+       it != end && !EC; it.increment(EC)) {
+    if (!llvm::sys::path::filename(it->path()).starts_with("prex-"))
+      continue;
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(it->path(), status))
+      continue;
+    entries++;
+    size += status.getSize();
+  }
+  uint64_t totalHits, totalMisses;
+  readTotals(totalHits, totalMisses);
+  printf("cache directory:  %s\n", directory.c_str());
+  printf("entries:          %llu\n", (unsigned long long)entries);
+  printf("size:             %.1f MB of %.1f MB\n", size / 1048576.0,
+         maxBytes / 1048576.0);
+  printf("this run:         %llu hits, %llu misses\n",
+         (unsigned long long)hits.load(), (unsigned long long)misses.load());
+  printf("all runs:         %llu hits, %llu misses\n",
+         (unsigned long long)totalHits, (unsigned long long)totalMisses);
+}
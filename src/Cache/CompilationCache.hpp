@@ -0,0 +1,54 @@
+#pragma once
+#include "../Parser/Ast/RootNode.hpp"
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Builds a content-addressed cache key. Every piece that can change the
+// generated code has to be added: the unit's source, the signatures it is
+// compiled against and the compiler configuration.
+class CacheKey {
+public:
+  explicit CacheKey(const std::string &kind);
+  void add(const std::string &data);
+  // Adds the signature of every function of `root` and the layout of its
+  // structs; a change in a function body elsewhere does not invalidate units
+  // that only call it. Generic functions are compiled into their callers,
+  // their whole definition is taken from `source`, the text of `root`.
+  void addSignatures(RootNode *root, const std::string &source);
+  std::string str() const;
+
+private:
+  std::string material;
+};
+
+// On-disk store of compiled modules (object code or bitcode), shared by
+// every prex invocation using the same directory. Entries are written
+// atomically, so concurrent compilers can use one cache.
+class CompilationCache {
+public:
+  CompilationCache(const std::string &directory, uint64_t maxBytes);
+
+  // $PREX_CACHE_DIR, $XDG_CACHE_HOME/prex or ~/.cache/prex
+  static std::string defaultDirectory();
+
+  bool lookup(const std::string &key, std::string &data);
+  void store(const std::string &key, const std::string &data);
+  // Evicts least recently used entries until the cache fits in maxBytes and
+  // records this run's hits and misses.
+  void finish();
+  void printStats();
+
+  // Everything besides the sources that changes codegen: target, flags.
+  std::string configuration;
+
+private:
+  std::string directory;
+  uint64_t maxBytes;
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+
+  std::string entryPath(const std::string &key);
+  void prune();
+  void readTotals(uint64_t &totalHits, uint64_t &totalMisses);
+};
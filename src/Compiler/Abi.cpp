@@ -0,0 +1,182 @@
+#include "Abi.hpp"
+#include <algorithm>
+
+using namespace llvm;
+
+namespace {
+using IsPadding = std::function<bool(StructType *, unsigned)>;
+
+enum class Class { None, Integer, Sse };
+
+// The two eightbytes of a struct of up to 16 bytes.
+struct Eightbytes {
+  Class classes[2] = {Class::None, Class::None};
+  uint64_t end[2] = {0, 0}; // past the last byte of data in each
+  bool hasDouble[2] = {false, false};
+  Type *vector = nullptr; // a 16 byte vector, passed in one register
+};
+
+Class merge(Class a, Class b) {
+  if (a == b || b == Class::None)
+    return a;
+  if (a == Class::None)
+    return b;
+  return Class::Integer;
+}
+
+// Adds `type` at `offset` to the eightbytes it overlaps; false when the
+// value has to go in memory.
+bool classify(Type *type, uint64_t offset, const DataLayout &layout,
+              const IsPadding &isPadding, Eightbytes &bytes) {
+  // a field of a packed struct off its natural alignment
+  if (offset % layout.getABITypeAlign(type).value())
+    return false;
+  if (auto structType = dyn_cast<StructType>(type)) {
+    const StructLayout *fields = layout.getStructLayout(structType);
+    for (unsigned i = 0; i < structType->getNumElements(); ++i)
+      if (!isPadding(structType, i) &&
+          !classify(structType->getElementType(i),
+                    offset + fields->getElementOffset(i), layout, isPadding,
+                    bytes))
+        return false;
+    return true;
+  }
+  if (auto array = dyn_cast<ArrayType>(type)) {
+    Type *element = array->getElementType();
+    uint64_t size = layout.getTypeAllocSize(element);
+    for (uint64_t i = 0; i < array->getNumElements(); ++i)
+      if (!classify(element, offset + i * size, layout, isPadding, bytes))
+        return false;
+    return true;
+  }
+  uint64_t size = layout.getTypeStoreSize(type);
+  Class kind = type->isFloatingPointTy() || type->isVectorTy()
+                   ? Class::Sse
+                   : Class::Integer;
+  if (type->isVectorTy() && size == 16)
+    bytes.vector = type;
+  for (uint64_t at = offset; at < offset + size; at = (at / 8 + 1) * 8) {
+    unsigned eightbyte = at / 8;
+    bytes.classes[eightbyte] = merge(bytes.classes[eightbyte], kind);
+    uint64_t end = std::min<uint64_t>(offset + size, 8 * (eightbyte + 1));
+    bytes.end[eightbyte] = std::max(bytes.end[eightbyte], end);
+    bytes.hasDouble[eightbyte] |= type->isDoubleTy();
+  }
+  return true;
+}
+
+AbiPassing classifyStruct(StructType *type, const DataLayout &layout,
+                          const IsPadding &isPadding) {
+  AbiPassing passing;
+  passing.type = type;
+  Eightbytes bytes;
+  if (layout.getTypeAllocSize(type) > 16 ||
+      !classify(type, 0, layout, isPadding, bytes)) {
+    passing.kind = AbiPassing::Memory;
+    return passing;
+  }
+  passing.kind = AbiPassing::Registers;
+  if (bytes.vector) {
+    passing.parts = {bytes.vector};
+    return passing;
+  }
+  LLVMContext &context = type->getContext();
+  unsigned count = bytes.classes[1] == Class::None ? 1 : 2;
+  for (unsigned i = 0; i < count; ++i) {
+    // only the last part may be narrower than its eightbyte
+    uint64_t size = i + 1 < count ? 8 : bytes.end[i] - 8 * i;
+    if (bytes.classes[i] != Class::Sse)
+      passing.parts.push_back(IntegerType::get(context, 8 * size));
+    else if (bytes.hasDouble[i])
+      passing.parts.push_back(Type::getDoubleTy(context));
+    else if (size <= 4)
+      passing.parts.push_back(Type::getFloatTy(context));
+    else
+      passing.parts.push_back(
+          FixedVectorType::get(Type::getFloatTy(context), 2));
+  }
+  return passing;
+}
+
+// The registers LLVM takes for a value it passes as is; a literal struct,
+// such as a slice, is split into its elements.
+void countRegisters(Type *type, const DataLayout &layout, unsigned &integers,
+                    unsigned &sses) {
+  if (auto structType = dyn_cast<StructType>(type)) {
+    for (Type *element : structType->elements())
+      countRegisters(element, layout, integers, sses);
+  } else if (type->isFloatingPointTy() ||
+             (type->isVectorTy() && layout.getTypeStoreSize(type) <= 16)) {
+    ++sses;
+  } else if (type->isIntegerTy() || type->isPointerTy()) {
+    integers += (layout.getTypeStoreSize(type) + 7) / 8;
+  }
+}
+} // namespace
+
+bool FunctionAbi::lowered() const {
+  if (ret.kind != AbiPassing::Direct)
+    return true;
+  for (auto &arg : args)
+    if (arg.kind != AbiPassing::Direct)
+      return true;
+  return false;
+}
+
+StructType *partsLayout(const AbiPassing &passing) {
+  return StructType::get(passing.type->getContext(), passing.parts);
+}
+
+FunctionAbi lowerSignature(Type *ret, const std::vector<Type *> &args,
+                           const DataLayout &layout, bool sysv,
+                           const IsPadding &isPadding) {
+  auto passingOf = [&](Type *type) {
+    auto structType = dyn_cast<StructType>(type);
+    if (sysv && structType && !structType->isLiteral())
+      return classifyStruct(structType, layout, isPadding);
+    AbiPassing direct;
+    direct.type = type;
+    return direct;
+  };
+  FunctionAbi abi;
+  abi.ret = passingOf(ret);
+  std::vector<Type *> params;
+  unsigned integersLeft = 6, ssesLeft = 8;
+  if (abi.ret.kind == AbiPassing::Memory) {
+    params.push_back(ret->getPointerTo());
+    --integersLeft;
+  }
+  for (Type *type : args) {
+    AbiPassing passing = passingOf(type);
+    unsigned integers = 0, sses = 0;
+    if (passing.kind == AbiPassing::Registers)
+      for (Type *part : passing.parts)
+        ++(part->isIntegerTy() ? integers : sses);
+    else if (passing.kind == AbiPassing::Direct)
+      countRegisters(type, layout, integers, sses);
+    // a struct goes in registers as a whole or not at all
+    if (passing.kind == AbiPassing::Registers &&
+        (integers > integersLeft || sses > ssesLeft))
+      passing.kind = AbiPassing::Memory;
+    if (passing.kind == AbiPassing::Memory) {
+      params.push_back(type->getPointerTo());
+    } else {
+      integersLeft -= std::min(integers, integersLeft);
+      ssesLeft -= std::min(sses, ssesLeft);
+      if (passing.kind == AbiPassing::Registers)
+        params.insert(params.end(), passing.parts.begin(),
+                      passing.parts.end());
+      else
+        params.push_back(type);
+    }
+    abi.args.push_back(passing);
+  }
+  Type *result = ret;
+  if (abi.ret.kind == AbiPassing::Memory)
+    result = Type::getVoidTy(ret->getContext());
+  else if (abi.ret.kind == AbiPassing::Registers)
+    result = abi.ret.parts.size() == 1 ? abi.ret.parts[0]
+                                       : partsLayout(abi.ret);
+  abi.type = FunctionType::get(result, params, false);
+  return abi;
+}
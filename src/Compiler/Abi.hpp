@@ -0,0 +1,43 @@
+#pragma once
+#include <functional>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <vector>
+
+// How a value crosses a call under the x86-64 System V ABI, the C calling
+// convention of every x86-64 target but Windows. Only structs need
+// lowering, LLVM passes everything else the way C does:
+// - one of up to 16 bytes goes in registers, one integer or floating point
+//   part per eightbyte, as long as enough registers are left;
+// - anything larger, or with a packed field off its natural alignment, goes
+//   in memory: a byval pointer for an argument, an sret one for a result.
+struct AbiPassing {
+  enum Kind { Direct, Registers, Memory };
+  Kind kind = Direct;
+  llvm::Type *type = nullptr;      // the value as the function sees it
+  std::vector<llvm::Type *> parts; // Registers: one per eightbyte
+};
+
+struct FunctionAbi {
+  AbiPassing ret;
+  std::vector<AbiPassing> args;
+  // With a result in Memory its pointer is the first parameter and the
+  // function returns void; an argument in Registers takes one parameter
+  // per part.
+  llvm::FunctionType *type = nullptr;
+  bool lowered() const;
+};
+
+// The lowered signature of a function returning `ret` and taking `args`.
+// With `sysv` false everything is passed Direct and left to the target.
+// `isPadding` tells the fields added for alignment apart, they don't take
+// registers.
+FunctionAbi
+lowerSignature(llvm::Type *ret, const std::vector<llvm::Type *> &args,
+               const llvm::DataLayout &layout, bool sysv,
+               const std::function<bool(llvm::StructType *, unsigned)>
+                   &isPadding);
+
+// What the parts of a struct passed in Registers look like in memory, at
+// offsets 0 and 8: a literal struct of them.
+llvm::StructType *partsLayout(const AbiPassing &passing);
@@ -0,0 +1,270 @@
+#include "Backend.hpp"
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/LTO/LTO.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/Caching.h>
+#include <llvm/Support/PGOOptions.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/TargetParser/Host.h>
+#include <llvm/Transforms/IPO/ThinLTOBitcodeWriter.h>
+#include <algorithm>
+#include <mutex>
+#include <optional>
+#include <set>
+
+void initializeTargets() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    llvm::InitializeAllTargetInfos();
+    llvm::InitializeAllTargets();
+    llvm::InitializeAllTargetMCs();
+    llvm::InitializeAllAsmParsers();
+    llvm::InitializeAllAsmPrinters();
+  });
+}
+
+TargetConfig resolveTarget(const TargetConfig &config) {
+  TargetConfig resolved = config;
+  if (resolved.triple.empty())
+    resolved.triple = llvm::sys::getDefaultTargetTriple();
+  if (resolved.cpu == "native") {
+    resolved.cpu = llvm::sys::getHostCPUName().str();
+    llvm::StringMap<bool> hostFeatures;
+    std::string features;
+    if (llvm::sys::getHostCPUFeatures(hostFeatures))
+      for (auto &feature : hostFeatures)
+        features += std::string(feature.second ? "+" : "-") +
+                    feature.first().str() + ",";
+    // explicit --mattr entries come last and win
+    resolved.features = features + resolved.features;
+    if (!resolved.features.empty() && resolved.features.back() == ',')
+      resolved.features.pop_back();
+  }
+  if (resolved.cpu.empty())
+    resolved.cpu = "generic";
+  return resolved;
+}
+
+static llvm::CodeGenOptLevel codegenOptLevel(int optLevel) {
+  switch (optLevel) {
+  case 0:
+    return llvm::CodeGenOptLevel::None;
+  case 1:
+    return llvm::CodeGenOptLevel::Less;
+  case 2:
+    return llvm::CodeGenOptLevel::Default;
+  default:
+    return llvm::CodeGenOptLevel::Aggressive;
+  }
+}
+
+std::unique_ptr<llvm::TargetMachine>
+createTargetMachine(const TargetConfig &config, std::string &error) {
+  initializeTargets();
+  TargetConfig resolved = resolveTarget(config);
+  const llvm::Target *target =
+      llvm::TargetRegistry::lookupTarget(resolved.triple, error);
+  if (!target)
+    return nullptr;
+  llvm::TargetOptions options;
+  return std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+      resolved.triple, resolved.cpu, resolved.features, options,
+      llvm::Reloc::PIC_, {}, codegenOptLevel(resolved.optLevel)));
+}
+
+static llvm::OptimizationLevel optimizationLevel(int optLevel) {
+  switch (optLevel) {
+  case 0:
+    return llvm::OptimizationLevel::O0;
+  case 1:
+    return llvm::OptimizationLevel::O1;
+  case 2:
+    return llvm::OptimizationLevel::O2;
+  default:
+    return llvm::OptimizationLevel::O3;
+  }
+}
+
+namespace {
+struct OrderFunctionsByHotnessPass
+    : llvm::PassInfoMixin<OrderFunctionsByHotnessPass> {
+  llvm::PreservedAnalyses run(llvm::Module &module,
+                              llvm::ModuleAnalysisManager &) {
+    orderFunctionsByHotness(module);
+    return llvm::PreservedAnalyses::all();
+  }
+};
+} // namespace
+
+static std::optional<llvm::PGOOptions>
+pgoOptions(const ProfileConfig &profile) {
+  std::optional<llvm::PGOOptions> options;
+  if (profile.generate)
+    options = llvm::PGOOptions(profile.generateFile, "", "",
+                               /*MemoryProfile=*/"",
+                               llvm::vfs::getRealFileSystem(),
+                               llvm::PGOOptions::IRInstr);
+  else if (!profile.use.empty())
+    options = llvm::PGOOptions(profile.use, "", "", /*MemoryProfile=*/"",
+                               llvm::vfs::getRealFileSystem(),
+                               llvm::PGOOptions::IRUse);
+  return options;
+}
+
+// Runs the default -O<level> pipeline, or its ThinLTO pre-link half followed
+// by the summary bitcode writer when `thinLtoOut` is set.
+static void runPipeline(llvm::Module &module, llvm::TargetMachine &machine,
+                        int optLevel, const ProfileConfig &profile,
+                        llvm::raw_ostream *thinLtoOut) {
+  llvm::LoopAnalysisManager LAM;
+  llvm::FunctionAnalysisManager FAM;
+  llvm::CGSCCAnalysisManager CGAM;
+  llvm::ModuleAnalysisManager MAM;
+  llvm::PassBuilder builder(&machine, llvm::PipelineTuningOptions(),
+                            pgoOptions(profile));
+  builder.registerModuleAnalyses(MAM);
+  builder.registerCGSCCAnalyses(CGAM);
+  builder.registerFunctionAnalyses(FAM);
+  builder.registerLoopAnalyses(LAM);
+  builder.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  llvm::OptimizationLevel level = optimizationLevel(optLevel);
+  llvm::ModulePassManager passes;
+  if (optLevel == 0)
+    passes = builder.buildO0DefaultPipeline(level, thinLtoOut != nullptr);
+  else if (thinLtoOut)
+    passes = builder.buildThinLTOPreLinkDefaultPipeline(level);
+  else
+    passes = builder.buildPerModuleDefaultPipeline(level);
+  if (!profile.use.empty())
+    passes.addPass(OrderFunctionsByHotnessPass());
+  if (thinLtoOut)
+    passes.addPass(llvm::ThinLTOBitcodeWriterPass(*thinLtoOut, nullptr));
+  passes.run(module, MAM);
+}
+
+void optimizeModule(llvm::Module &module, llvm::TargetMachine &machine,
+                    int optLevel, const ProfileConfig &profile) {
+  // instrumentation is added at -O0 too, profiles are only used when
+  // optimizing
+  if (optLevel == 0 && !profile.generate)
+    return;
+  runPipeline(module, machine, optLevel, profile, nullptr);
+}
+
+void orderFunctionsByHotness(llvm::Module &module) {
+  std::vector<std::pair<uint64_t, llvm::Function *>> hot;
+  for (auto &function : module) {
+    auto count = function.getEntryCount();
+    if (!function.isDeclaration() && count && count->getCount() > 0)
+      hot.push_back({count->getCount(), &function});
+  }
+  std::stable_sort(hot.begin(), hot.end(), [](auto &a, auto &b) {
+    return a.first > b.first;
+  });
+  // insert in reverse at the front, keeping the rest in source order
+  for (auto it = hot.rbegin(); it != hot.rend(); ++it) {
+    it->second->removeFromParent();
+    module.getFunctionList().push_front(it->second);
+  }
+}
+
+void emitThinLtoBitcode(llvm::Module &module, llvm::TargetMachine &machine,
+                        int optLevel, const ProfileConfig &profile,
+                        llvm::raw_ostream &out) {
+  module.setTargetTriple(machine.getTargetTriple().str());
+  module.setDataLayout(machine.createDataLayout());
+  runPipeline(module, machine, optLevel, profile, &out);
+}
+
+bool isBitcode(const std::string &data) {
+  return llvm::isBitcode(
+      reinterpret_cast<const unsigned char *>(data.data()),
+      reinterpret_cast<const unsigned char *>(data.data() + data.size()));
+}
+
+bool thinLink(const std::vector<LtoInput> &inputs, const TargetConfig &config,
+              const ProfileConfig &profile, unsigned jobs,
+              bool hasNativeObjects, std::vector<std::string> &objects,
+              std::string &error) {
+  initializeTargets();
+  TargetConfig resolved = resolveTarget(config);
+  llvm::lto::Config conf;
+  conf.CPU = resolved.cpu;
+  llvm::StringRef features(resolved.features);
+  while (!features.empty()) {
+    auto split = features.split(',');
+    if (!split.first.empty())
+      conf.MAttrs.push_back(split.first.str());
+    features = split.second;
+  }
+  conf.RelocModel = llvm::Reloc::PIC_;
+  conf.OptLevel = resolved.optLevel;
+  conf.CGOptLevel = codegenOptLevel(resolved.optLevel);
+  conf.DefaultTriple = resolved.triple;
+  // the entry counts came in with the bitcode, cold blocks go to .text.split
+  conf.Options.EnableMachineFunctionSplitter = !profile.use.empty();
+  llvm::lto::LTO lto(std::move(conf),
+                     llvm::lto::createInProcessThinBackend(
+                         llvm::heavyweight_hardware_concurrency(jobs)));
+
+  std::set<std::string> defined;
+  for (auto &input : inputs) {
+    llvm::MemoryBufferRef buffer(input.bitcode, input.name);
+    auto file = llvm::lto::InputFile::create(buffer);
+    if (!file) {
+      error = input.name + ": " + llvm::toString(file.takeError());
+      return false;
+    }
+    std::vector<llvm::lto::SymbolResolution> resolutions;
+    for (auto &symbol : (*file)->symbols()) {
+      llvm::lto::SymbolResolution resolution;
+      if (!symbol.isUndefined()) {
+        // the first definition wins, like in a regular link
+        resolution.Prevailing = defined.insert(symbol.getName().str()).second;
+        resolution.FinalDefinitionInLinkageUnit = true;
+        resolution.VisibleToRegularObj =
+            hasNativeObjects || symbol.getName() == "main";
+      }
+      resolutions.push_back(resolution);
+    }
+    if (llvm::Error err = lto.add(std::move(*file), resolutions)) {
+      error = input.name + ": " + llvm::toString(std::move(err));
+      return false;
+    }
+  }
+
+  std::vector<llvm::SmallVector<char, 0>> buffers(lto.getMaxTasks());
+  auto addStream = [&](unsigned task, const llvm::Twine &)
+      -> llvm::Expected<std::unique_ptr<llvm::CachedFileStream>> {
+    return std::make_unique<llvm::CachedFileStream>(
+        std::make_unique<llvm::raw_svector_ostream>(buffers[task]));
+  };
+  if (llvm::Error err = lto.run(addStream)) {
+    error = llvm::toString(std::move(err));
+    return false;
+  }
+  for (auto &buffer : buffers)
+    if (!buffer.empty())
+      objects.emplace_back(buffer.begin(), buffer.end());
+  return true;
+}
+
+bool emitObject(llvm::Module &module, llvm::TargetMachine &machine,
+                llvm::raw_pwrite_stream &out, std::string &error) {
+  module.setTargetTriple(machine.getTargetTriple().str());
+  module.setDataLayout(machine.createDataLayout());
+  llvm::legacy::PassManager passes;
+  if (machine.addPassesToEmitFile(passes, out, nullptr,
+                                  llvm::CodeGenFileType::ObjectFile)) {
+    error = "target can't emit object files";
+    return false;
+  }
+  passes.run(module);
+  return true;
+}
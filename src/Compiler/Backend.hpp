@@ -0,0 +1,75 @@
+#pragma once
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// What code is generated for. An empty triple means the host and an empty
+// cpu a generic one; cpu "native" is the host CPU with all of its features.
+struct TargetConfig {
+  std::string triple;
+  std::string cpu;
+  std::string features; // e.g. "+avx2,-fma"
+  int optLevel = 0;     // -O0 .. -O3
+};
+
+// Profile guided optimization. `generate` instruments the code so the
+// program writes a .profraw file when it exits; merge those with
+// `llvm-profdata merge` and hand the result back through `use`.
+struct ProfileConfig {
+  bool generate = false;
+  std::string generateFile; // empty: default_%m.profraw in the working dir
+  std::string use;          // .profdata
+};
+
+// Registers the LLVM targets; safe to call from any thread, runs once.
+void initializeTargets();
+
+// Replaces "native" and empty fields with the concrete host values.
+TargetConfig resolveTarget(const TargetConfig &config);
+
+// Target machine for `config`, or nullptr with `error` set.
+std::unique_ptr<llvm::TargetMachine>
+createTargetMachine(const TargetConfig &config, std::string &error);
+
+// Runs the standard -O<level> pipeline tuned for `machine`, instrumenting
+// or applying `profile`.
+void optimizeModule(llvm::Module &module, llvm::TargetMachine &machine,
+                    int optLevel, const ProfileConfig &profile);
+
+// Moves the functions with a profile entry count to the front of the module,
+// hottest first, so the hot code of a program ends up packed together.
+void orderFunctionsByHotness(llvm::Module &module);
+
+// Runs the ThinLTO pre-link pipeline for -O<level> and writes `module` as
+// bitcode carrying a module summary index, the input of a ThinLTO link.
+void emitThinLtoBitcode(llvm::Module &module, llvm::TargetMachine &machine,
+                        int optLevel, const ProfileConfig &profile,
+                        llvm::raw_ostream &out);
+
+// True for LLVM bitcode (such as objects compiled with -c --lto=thin).
+bool isBitcode(const std::string &data);
+
+struct LtoInput {
+  std::string name; // used in diagnostics
+  std::string bitcode;
+};
+
+// Links ThinLTO modules into one program: builds the combined summary,
+// imports functions across modules and then optimizes and code generates
+// every module on its own thread (`jobs`, 0 for all cores). Only `main` and,
+// when `hasNativeObjects`, every definition stay visible to the native
+// linker, so everything else can be internalized and dropped when unused.
+// With `profile.use` set, cold blocks move out of line into .text.split.
+// Returns one native object per module in `objects`.
+bool thinLink(const std::vector<LtoInput> &inputs, const TargetConfig &config,
+              const ProfileConfig &profile, unsigned jobs,
+              bool hasNativeObjects, std::vector<std::string> &objects,
+              std::string &error);
+
+// Stamps the target's triple and data layout on `module` and emits it as a
+// native object file into `out`.
+bool emitObject(llvm::Module &module, llvm::TargetMachine &machine,
+                llvm::raw_pwrite_stream &out, std::string &error);
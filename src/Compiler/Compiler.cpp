@@ -1,32 +1,152 @@
 #include "Compiler.hpp"
-#include "../Lexer/Lexer.hpp"
 #include "../Parser/Ast/ConstBool.hpp"
 #include "../Parser/Ast/ConstChar.hpp"
 #include "../Parser/Ast/ConstFloat.hpp"
 #include "../Parser/Ast/ConstInt.hpp"
 #include "../Parser/Ast/ConstString.hpp"
-#include "../Parser/Ast/ImportNode.hpp"
 #include "../Parser/Ast/LoopNode.hpp"
 #include "../Parser/Parser.hpp"
+#include "../Version.hpp"
 #include <fstream>
 #include <iostream>
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/APInt.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/ValueSymbolTable.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Linker/Linker.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/TargetParser/Triple.h>
+#include <map>
 #include <set>
 #include <unordered_map>
 
 using namespace llvm;
 
+// "i32[256]" is an array of 256 i32, "i32[]" a slice of them.
+static bool isArrayType(const std::string &typeName) {
+  return !typeName.empty() && typeName.back() == ']';
+}
+
+static std::string elementTypeName(const std::string &typeName) {
+  return typeName.substr(0, typeName.find('['));
+}
+
+// 0 for a slice
+static uint64_t arrayLength(const std::string &typeName) {
+  return std::strtoull(typeName.c_str() + typeName.find('[') + 1, nullptr,
+                       10);
+}
+
+static const std::set<std::string> laneTypes = {
+    "i8", "i16", "i32", "i64", "u8", "u16", "u32", "u64", "f32", "f64", "bool",
+};
+
+// "v8i32" is a vector of 8 i32 lanes.
+static bool isVectorType(const std::string &typeName, unsigned &lanes,
+                         std::string &element) {
+  size_t digits = 1;
+  while (digits < typeName.size() && std::isdigit(typeName[digits]))
+    ++digits;
+  if (typeName.size() < 3 || typeName[0] != 'v' || digits == 1 ||
+      digits > 5)
+    return false;
+  lanes = std::atoi(typeName.c_str() + 1);
+  element = typeName.substr(digits);
+  return lanes > 0 && laneTypes.count(element);
+}
+
+static bool isVectorType(const std::string &typeName) {
+  unsigned lanes;
+  std::string element;
+  return isVectorType(typeName, lanes, element);
+}
+
+// uN, or a vector of them
+static bool isUnsignedType(const std::string &typeName) {
+  unsigned lanes;
+  std::string element;
+  if (isVectorType(typeName, lanes, element))
+    return element[0] == 'u';
+  return typeName.rfind("u", 0) == 0;
+}
+
+// Converts an integer or float scalar to `type`, which is one or the other.
+static Value *convertScalar(IRBuilder<> &builder, Value *value, Type *type,
+                            bool isSigned) {
+  Type *from = value->getType();
+  if (from == type)
+    return value;
+  if (from->isIntegerTy() && type->isIntegerTy())
+    return builder.CreateIntCast(value, type, isSigned);
+  if (from->isIntegerTy())
+    return isSigned ? builder.CreateSIToFP(value, type)
+                    : builder.CreateUIToFP(value, type);
+  if (type->isIntegerTy())
+    return isSigned ? builder.CreateFPToSI(value, type)
+                    : builder.CreateFPToUI(value, type);
+  return builder.CreateFPCast(value, type);
+}
+
+// The C functions of the prelude that store through a pointer argument.
+static bool writesThrough(StringRef callee, size_t arg) {
+  if (callee == "scanf")
+    return arg > 0;
+  return arg == 0 && (callee == "memcpy" || callee == "memset" ||
+                      callee == "strcpy" || callee == "strcat");
+}
+
+// {T *data, i64 length}, with a data pointer per column for a #[soa] one
+static bool isSlice(Type *type) {
+  auto slice = dyn_cast<StructType>(type);
+  if (!slice || !slice->isLiteral() || slice->getNumElements() < 2 ||
+      !slice->elements().back()->isIntegerTy(64))
+    return false;
+  for (unsigned i = 0; i + 1 < slice->getNumElements(); ++i)
+    if (!slice->getElementType(i)->isPointerTy())
+      return false;
+  return true;
+}
+
 llvm::Type *Compiler::getLLVMType(const std::string &typeName) {
+  unsigned lanes;
+  std::string element;
+  if (isVectorType(typeName, lanes, element))
+    return FixedVectorType::get(getLLVMType(element), lanes);
+  if (StructInfo *soa = soaElement(typeName)) {
+    uint64_t length = arrayLength(typeName);
+    std::vector<llvm::Type *> columns;
+    for (auto &field : soa->fields) {
+      llvm::Type *type = getLLVMType(field.type);
+      if (length)
+        columns.push_back(ArrayType::get(type, length));
+      else
+        columns.push_back(type->getPointerTo());
+    }
+    if (!length)
+      columns.push_back(Type::getInt64Ty(*context));
+    return StructType::get(*context, columns);
+  }
+  if (isArrayType(typeName)) {
+    llvm::Type *element = getLLVMType(elementTypeName(typeName));
+    if (uint64_t length = arrayLength(typeName))
+      return ArrayType::get(element, length);
+    return StructType::get(element->getPointerTo(),
+                           Type::getInt64Ty(*context));
+  }
   if (typeName == "i8")
     return Type::getInt8Ty(*context);
   if (typeName == "i16")
@@ -54,66 +174,631 @@ llvm::Type *Compiler::getLLVMType(const std::string &typeName) {
   if (typeName == "ch")
     return Type::getInt8Ty(*context);
   if (typeName == "str")
-    return Type::getInt8Ty(*context)->getPointerTo();
+    return stringType();
+  if (typeName == "strbuf")
+    return stringBuilderType();
   if (typeName == "bool")
     return Type::getInt1Ty(*context);
+  if (StructInfo *info = structInfo(typeName))
+    return info->type;
   return Type::getVoidTy(*context);
 }
 
+Align Compiler::alignOf(llvm::Type *type) {
+  // an array is aligned as its elements
+  if (auto array = dyn_cast<ArrayType>(type))
+    return alignOf(array->getElementType());
+  Align align = module->getDataLayout().getABITypeAlign(type);
+  auto name = structNames.find(type);
+  if (name != structNames.end()) {
+    StructInfo *info = structInfo(name->second);
+    if (info && info->type == type && info->align)
+      align = std::max(align, Align(info->align));
+  }
+  return align;
+}
+
+AllocaInst *Compiler::entryAlloca(llvm::Type *type, const std::string &name) {
+  BasicBlock &entry = builder->GetInsertBlock()->getParent()->getEntryBlock();
+  IRBuilder<> entryBuilder(&entry, entry.begin());
+  AllocaInst *slot = entryBuilder.CreateAlloca(type, nullptr, name);
+  if (alignOf(type) > slot->getAlign())
+    slot->setAlignment(alignOf(type));
+  return slot;
+}
+
+Compiler::StructInfo *Compiler::structInfo(const std::string &typeName) {
+  auto found = structs.find(typeName);
+  return found != structs.end() ? &found->second : nullptr;
+}
+
+Compiler::StructInfo *Compiler::soaElement(const std::string &arrayType) {
+  if (!isArrayType(arrayType))
+    return nullptr;
+  StructInfo *info = structInfo(elementTypeName(arrayType));
+  return info && info->soa ? info : nullptr;
+}
+
+int Compiler::fieldIndex(const std::string &typeName,
+                         const std::string &field) {
+  StructInfo *info = structInfo(typeName);
+  if (!info) {
+    error = "." + field + ": " +
+            (typeName.empty() ? "not a struct" : typeName + " is not a struct");
+    return -1;
+  }
+  for (size_t i = 0; i < info->fields.size(); ++i)
+    if (info->fields[i].name == field)
+      return i;
+  error = "struct " + typeName + " has no field " + field;
+  return -1;
+}
+
+void Compiler::declareStructs(RootNode *unitRoot) {
+  if (!unitRoot)
+    return;
+  for (auto node : unitRoot->nodes)
+    if (auto structNode = dynamic_cast<StructNode *>(node))
+      declareStruct(structNode);
+}
+
+void Compiler::declareStruct(StructNode *node) {
+  std::string layout;
+  for (auto &field : node->fields)
+    layout += field.type + " " + field.name + ";";
+  uint64_t align = 0;
+  for (auto &attribute : node->attributes) {
+    layout += "#" + attribute.name;
+    for (auto &arg : attribute.args)
+      layout += "," + arg;
+    // a cache line of its own, so that no two threads writing to different
+    // ones ever share a line
+    if (attribute.name == "cacheline")
+      align = std::max<uint64_t>(align, 64);
+    else if (attribute.name == "align")
+      align = std::max<uint64_t>(align, std::stoull(attribute.args[0]));
+  }
+  // the same declaration seen again, through another unit
+  StructInfo *known = structInfo(node->name);
+  if (known && known->layout == layout)
+    return;
+
+  StructInfo info;
+  info.fields = node->fields;
+  info.soa = node->hasAttribute("soa");
+  info.layout = layout;
+  bool packed = node->hasAttribute("packed");
+  const DataLayout &dataLayout = module->getDataLayout();
+  // LLVM lays the elements out at their natural alignment (or none when
+  // packed); fields that ask for more get explicit padding in front
+  std::vector<llvm::Type *> elements;
+  uint64_t offset = 0, fieldsAlign = 1, naturalAlign = 1;
+  for (auto &field : node->fields) {
+    if (getLLVMType(elementTypeName(field.type))->isVoidTy()) {
+      error = "struct " + node->name + ": field " + field.name +
+              " has the unknown type " + field.type +
+              " (a struct must be declared before it is used)";
+      return;
+    }
+    llvm::Type *type = getLLVMType(field.type);
+    uint64_t natural = packed ? 1 : dataLayout.getABITypeAlign(type).value();
+    uint64_t wanted = packed ? 1 : alignOf(type).value();
+    uint64_t at = alignTo(offset, wanted);
+    if (at > alignTo(offset, natural))
+      elements.push_back(ArrayType::get(builder->getInt8Ty(), at - offset));
+    info.elements.push_back(elements.size());
+    elements.push_back(type);
+    offset = at + dataLayout.getTypeAllocSize(type);
+    fieldsAlign = std::max(fieldsAlign, wanted);
+    naturalAlign = std::max(naturalAlign, natural);
+  }
+  uint64_t structAlign = std::max(fieldsAlign, align);
+  // the size is a multiple of the alignment, so are the elements of arrays
+  uint64_t size = alignTo(offset, structAlign);
+  if (size > alignTo(offset, naturalAlign))
+    elements.push_back(ArrayType::get(builder->getInt8Ty(), size - offset));
+  if (structAlign > naturalAlign)
+    info.align = structAlign;
+  info.type = StructType::create(*context, elements, node->name, packed);
+  structNames[info.type] = node->name;
+  structs[node->name] = info;
+}
+
 Compiler::Compiler() {
   context = std::make_unique<LLVMContext>();
   module = std::make_unique<Module>("prex_module", *context);
   builder = std::make_unique<IRBuilder<>>(*context);
 }
 
-Compiler::~Compiler() {}
+Compiler::~Compiler() {
+  clearGenerics();
+  for (auto tree : ownedTrees)
+    deleteAst(tree);
+}
+
+namespace {
+struct ImportedUnit {
+  std::string bitcode;
+  std::vector<Remark> remarks;
+  bool failed = false;
+  std::string error;
+};
+} // namespace
+
+// Compiles one imported module in its own Compiler (and so its own
+// LLVMContext) and returns it as bitcode, which is the only safe way to hand
+// a module over to a different context.
+static ImportedUnit compileImportedUnit(const Compiler &parent,
+                                       ModuleUnit *unit,
+                                       const ImportGraph &graph,
+                                       CompilationCache *cache) {
+  ImportedUnit result;
+  CacheKey key(parent.thinLto ? "thinlto" : "bitcode");
+  if (cache) {
+    key.add(cache->configuration);
+    key.add(unit->modulePath);
+    key.add(unit->source);
+    for (auto dep : graph.transitiveImports(unit))
+      key.addSignatures(dep->root, dep->source);
+    if (cache->lookup(key.str(), result.bitcode))
+      return result;
+  }
+  Compiler subCompiler;
+  subCompiler.target = parent.target;
+  subCompiler.profile = parent.profile;
+  subCompiler.thinLto = parent.thinLto;
+  subCompiler.remarks = parent.remarks;
+  subCompiler.debugInfo = parent.debugInfo;
+  subCompiler.framePointers = parent.framePointers;
+  subCompiler.root = unit->root;
+  subCompiler.importMode = Compiler::ImportMode::Provided;
+  subCompiler.module->setModuleIdentifier(unit->modulePath);
+  subCompiler.module->setSourceFileName(unit->filePath);
+  for (auto dep : graph.transitiveImports(unit))
+    subCompiler.declarePrototypes(dep->root);
+  bool compiled = subCompiler.compile();
+  if (compiled) {
+    if (parent.thinLto)
+      compiled = subCompiler.emitThinLtoBitcodeToBuffer(result.bitcode);
+    else
+      subCompiler.emitBitcodeToBuffer(result.bitcode);
+  }
+  result.remarks = std::move(subCompiler.collectedRemarks);
+  if (!compiled) {
+    result.failed = true;
+    result.error = subCompiler.error;
+    return result;
+  }
+  if (cache)
+    cache->store(key.str(), result.bitcode);
+  return result;
+}
+
+bool Compiler::compileImports() {
+  imports = std::make_unique<ImportGraph>(resolver);
+  ImportGraph &graph = *imports;
+  if (!graph.discover(root)) {
+    error = graph.error;
+    return false;
+  }
+  if (graph.empty())
+    return true;
+  std::unordered_map<ModuleUnit *, ImportedUnit> compiled;
+  // one pool for all waves, sized by the caller
+  std::unique_ptr<llvm::ThreadPool> pool;
+  if (importJobs != 1)
+    pool = std::make_unique<llvm::ThreadPool>(
+        llvm::hardware_concurrency(importJobs));
+  for (auto &wave : graph.getWaves()) {
+    if (wave.size() == 1 || !pool) {
+      for (auto unit : wave)
+        compiled[unit] = compileImportedUnit(*this, unit, graph, cache);
+    } else {
+      std::vector<ImportedUnit> results(wave.size());
+      for (size_t i = 0; i < wave.size(); ++i)
+        pool->async([&, i] {
+          results[i] = compileImportedUnit(*this, wave[i], graph, cache);
+        });
+      pool->wait();
+      for (size_t i = 0; i < wave.size(); ++i)
+        compiled[wave[i]] = std::move(results[i]);
+    }
+    // a later wave imports this one
+    for (auto unit : wave) {
+      ImportedUnit &result = compiled[unit];
+      collectedRemarks.insert(collectedRemarks.end(), result.remarks.begin(),
+                              result.remarks.end());
+      if (result.failed) {
+        error = result.error.empty()
+                    ? "Could not compile module " + unit->modulePath
+                    : result.error;
+        return false;
+      }
+    }
+  }
+  // only what the imports export is visible here; their definitions are
+  // linked in once this module is generated, so their private functions
+  // can't clash with ours
+  for (auto &wave : graph.getWaves())
+    for (auto unit : wave) {
+      declarePrototypes(unit->root);
+      importedModules.push_back(
+          {unit->filePath, std::move(compiled[unit].bitcode)});
+    }
+  return true;
+}
+
+bool Compiler::linkImportedModules() {
+  // in wave order, so dependencies are always merged before dependents
+  for (auto &imported : importedModules) {
+    llvm::MemoryBufferRef buffer(imported.bitcode, imported.name);
+    auto parsed = llvm::parseBitcodeFile(buffer, *context);
+    if (!parsed) {
+      error = "Could not load compiled module " + imported.name + ": " +
+              llvm::toString(parsed.takeError());
+      return false;
+    }
+    if (llvm::Linker::linkModules(*module, std::move(*parsed))) {
+      error = "Could not link module " + imported.name;
+      return false;
+    }
+  }
+  importedModules.clear();
+  return true;
+}
+
+Function *Compiler::declarePrototype(DefunNode *def) {
+  if (!def->typeParams.empty()) {
+    declareGeneric(def);
+    return nullptr;
+  }
+  returnTypes[symbolName(def)] = def->ret_type;
+  if (auto existing = module->getFunction(symbolName(def)))
+    return existing;
+  Function *function =
+      Function::Create(functionType(def), Function::ExternalLinkage,
+                       symbolName(def), module.get());
+  if (const FunctionAbi *abi = abiOf(symbolName(def)))
+    for (auto &[index, attribute] : abiAttributes(*abi))
+      function->addParamAttr(index, attribute);
+  return function;
+}
+
+void Compiler::declarePrototypes(RootNode *unitRoot) {
+  // struct layouts and calling conventions depend on the target
+  if (!unitRoot || !configureTarget())
+    return;
+  declareStructs(unitRoot);
+  for (auto node : unitRoot->nodes)
+    if (auto def = dynamic_cast<DefunNode *>(node))
+      if (def->isPublic)
+        declarePrototype(def);
+}
+
+FunctionType *Compiler::functionType(DefunNode *def) {
+  std::vector<Type *> argTypes;
+  for (auto &arg : def->args)
+    argTypes.push_back(getLLVMType(arg.type));
+  Triple triple(module->getTargetTriple());
+  bool sysv = triple.getArch() == Triple::x86_64 && !triple.isOSWindows();
+  auto isPadding = [&](StructType *type, unsigned element) {
+    auto name = structNames.find(type);
+    StructInfo *info =
+        name != structNames.end() ? structInfo(name->second) : nullptr;
+    return info && info->type == type &&
+           std::find(info->elements.begin(), info->elements.end(),
+                     element) == info->elements.end();
+  };
+  FunctionAbi abi =
+      lowerSignature(getLLVMType(def->ret_type), argTypes,
+                     module->getDataLayout(), sysv, isPadding);
+  if (abi.lowered())
+    abis[symbolName(def)] = abi;
+  else
+    abis.erase(symbolName(def));
+  return abi.type;
+}
+
+const FunctionAbi *Compiler::abiOf(const std::string &symbol) {
+  auto found = abis.find(symbol);
+  return found != abis.end() ? &found->second : nullptr;
+}
+
+std::vector<std::pair<unsigned, llvm::Attribute>>
+Compiler::abiAttributes(const FunctionAbi &abi) {
+  std::vector<std::pair<unsigned, llvm::Attribute>> attributes;
+  unsigned param = 0;
+  if (abi.ret.kind == AbiPassing::Memory) {
+    attributes.push_back(
+        {param, llvm::Attribute::getWithStructRetType(*context, abi.ret.type)});
+    attributes.push_back(
+        {param, llvm::Attribute::get(*context, llvm::Attribute::NoAlias)});
+    attributes.push_back(
+        {param, llvm::Attribute::getWithAlignment(*context,
+                                                  alignOf(abi.ret.type))});
+    ++param;
+  }
+  for (auto &arg : abi.args) {
+    if (arg.kind == AbiPassing::Memory) {
+      // a copy on the stack, in the eightbytes of the stack arguments
+      attributes.push_back(
+          {param, llvm::Attribute::getWithByValType(*context, arg.type)});
+      attributes.push_back(
+          {param, llvm::Attribute::getWithAlignment(
+                      *context, std::max(alignOf(arg.type), Align(8)))});
+    }
+    param += arg.kind == AbiPassing::Registers ? arg.parts.size() : 1;
+  }
+  return attributes;
+}
+
+void Compiler::storeParts(const AbiPassing &passing,
+                          const std::vector<Value *> &parts, Value *address) {
+  StructType *layout = partsLayout(passing);
+  Value *base = builder->CreatePointerCast(address, layout->getPointerTo());
+  const StructLayout *offsets =
+      module->getDataLayout().getStructLayout(layout);
+  for (unsigned i = 0; i < parts.size(); ++i)
+    builder->CreateAlignedStore(
+        parts[i], builder->CreateStructGEP(layout, base, i),
+        commonAlignment(alignOf(passing.type), offsets->getElementOffset(i)));
+}
 
-static std::set<std::string> importedModules;
+std::vector<Value *> Compiler::loadParts(const AbiPassing &passing,
+                                         Value *address) {
+  StructType *layout = partsLayout(passing);
+  Value *base = builder->CreatePointerCast(address, layout->getPointerTo());
+  const StructLayout *offsets =
+      module->getDataLayout().getStructLayout(layout);
+  std::vector<Value *> parts;
+  for (unsigned i = 0; i < passing.parts.size(); ++i)
+    parts.push_back(builder->CreateAlignedLoad(
+        passing.parts[i], builder->CreateStructGEP(layout, base, i),
+        commonAlignment(alignOf(passing.type), offsets->getElementOffset(i))));
+  return parts;
+}
 
-static std::string modulePathToFile(const std::string &modulePath) {
-  std::string file = modulePath;
-  for (auto &c : file)
-    if (c == '.')
-      c = '/';
-  return file + ".prx";
+Value *Compiler::codegenLoweredCall(Function *callee, const FunctionAbi &abi,
+                                    const std::vector<Value *> &args) {
+  if (args.size() != abi.args.size()) {
+    error = callee->getName().str() + " takes " +
+            std::to_string(abi.args.size()) + " arguments";
+    return abi.ret.type->isVoidTy() ? nullptr
+                                    : UndefValue::get(abi.ret.type);
+  }
+  // structs go through stack slots, from which they are passed in pieces
+  // or by address
+  std::vector<Value *> lowered;
+  AllocaInst *result = nullptr;
+  if (abi.ret.kind == AbiPassing::Memory) {
+    result = entryAlloca(abi.ret.type, "sret");
+    lowered.push_back(result);
+  }
+  for (size_t i = 0; i < args.size(); ++i) {
+    const AbiPassing &passing = abi.args[i];
+    if (passing.kind == AbiPassing::Direct) {
+      lowered.push_back(args[i]);
+      continue;
+    }
+    AllocaInst *slot = entryAlloca(passing.type, "arg");
+    builder->CreateStore(args[i], slot);
+    if (passing.kind == AbiPassing::Memory)
+      lowered.push_back(slot);
+    else
+      for (Value *part : loadParts(passing, slot))
+        lowered.push_back(part);
+  }
+  CallInst *call = builder->CreateCall(callee, lowered);
+  call->setCallingConv(callee->getCallingConv());
+  for (auto &[index, attribute] : abiAttributes(abi))
+    call->addParamAttr(index, attribute);
+  if (abi.ret.kind == AbiPassing::Memory)
+    return builder->CreateLoad(abi.ret.type, result);
+  if (abi.ret.kind == AbiPassing::Direct)
+    return call;
+  std::vector<Value *> parts = {call};
+  if (abi.ret.parts.size() > 1) {
+    parts.clear();
+    for (unsigned i = 0; i < abi.ret.parts.size(); ++i)
+      parts.push_back(builder->CreateExtractValue(call, i));
+  }
+  AllocaInst *slot = entryAlloca(abi.ret.type, "ret");
+  storeParts(abi.ret, parts, slot);
+  return builder->CreateLoad(abi.ret.type, slot);
 }
 
-void Compiler::loadAndCompileModule(const std::string &modulePath) {
-  if (importedModules.count(modulePath))
+void Compiler::emitReturn(Value *value) {
+  AbiPassing::Kind kind =
+      currentAbi ? currentAbi->ret.kind : AbiPassing::Direct;
+  if (kind == AbiPassing::Memory) {
+    builder->CreateStore(value, resultPointer);
+    builder->CreateRetVoid();
     return;
-  importedModules.insert(modulePath);
-  std::string filePath = modulePathToFile(modulePath);
-  std::ifstream in(filePath);
-  if (!in.is_open()) {
-    std::cerr << "Could not open module file: " << filePath << std::endl;
-    std::exit(1);
-  }
-  std::string code((std::istreambuf_iterator<char>(in)),
-                   std::istreambuf_iterator<char>());
-  in.close();
-  Lexer lexer(code, filePath);
-  auto tokens = lexer.tokenize();
-  Parser parser(tokens, code, filePath);
-  RootNode *root = parser.parse();
-  Compiler subCompiler;
-  subCompiler.root = root;
-  subCompiler.compile();
-  // Merge subCompiler.module into this->module (TODO: lepsze scalanie, na razie
-  // tylko funkcje)
-  for (auto &f : subCompiler.module->functions()) {
-    if (!module->getFunction(f.getName()))
-      module->getFunctionList().push_back(&f);
   }
-  for (auto &g : subCompiler.module->globals()) {
-    if (!module->getGlobalVariable(g.getName())) {
-      // Create a new global variable in the current module with the same
-      // properties
-      auto *newGlobal = new llvm::GlobalVariable(
-          *module, g.getValueType(), g.isConstant(), g.getLinkage(),
-          g.hasInitializer() ? g.getInitializer() : nullptr, g.getName(),
-          nullptr, g.getThreadLocalMode(), g.getType()->getAddressSpace());
-      newGlobal->setAlignment(g.getAlign());
+  if (kind == AbiPassing::Direct) {
+    builder->CreateRet(value);
+    return;
+  }
+  AllocaInst *slot = entryAlloca(value->getType(), "ret");
+  builder->CreateStore(value, slot);
+  std::vector<Value *> parts = loadParts(currentAbi->ret, slot);
+  Value *result = parts[0];
+  if (parts.size() > 1) {
+    result = UndefValue::get(partsLayout(currentAbi->ret));
+    for (unsigned i = 0; i < parts.size(); ++i)
+      result = builder->CreateInsertValue(result, parts[i], i);
+  }
+  builder->CreateRet(result);
+}
+
+bool Compiler::isPrivate(DefunNode *def) {
+  return !def->isPublic && def->name != "main";
+}
+
+bool Compiler::isInternal(DefunNode *def) {
+  return isPrivate(def) &&
+         (privateSuffix.empty() || instances.count(def->name) > 0);
+}
+
+std::string Compiler::symbolName(DefunNode *def) {
+  return isPrivate(def) && !instances.count(def->name)
+             ? def->name + privateSuffix
+             : def->name;
+}
+
+// An integer literal, or its negation. Literals are i32 and take the type of
+// the variable, operand or result they are used as.
+static bool isIntLiteral(Expression *expr) {
+  while (auto exprNode = dynamic_cast<ExprNode *>(expr))
+    expr = exprNode->value;
+  if (auto unop = dynamic_cast<UnaryOpNode *>(expr))
+    return unop->op == "-" && isIntLiteral(unop->expr);
+  return dynamic_cast<ConstInt *>(expr) != nullptr;
+}
+
+// `typeName` with a bound type parameter replaced: T, T[] or T[N].
+static std::string substituteTypes(
+    const std::string &typeName,
+    const std::map<std::string, std::string> &bindings) {
+  size_t bracket = typeName.find('[');
+  auto bound = bindings.find(typeName.substr(0, bracket));
+  if (bound == bindings.end())
+    return typeName;
+  return bracket == std::string::npos
+             ? bound->second
+             : bound->second + typeName.substr(bracket);
+}
+
+void Compiler::declareGeneric(DefunNode *def) {
+  // a signature from a pre-pass doesn't replace a definition with its body
+  auto known = generics.find(def->name);
+  if (known == generics.end() || def->body)
+    generics[def->name] = def;
+}
+
+void Compiler::clearGenerics() {
+  generics.clear();
+  instances.clear();
+  pendingInstances.clear();
+}
+
+std::string Compiler::bindTypes(const std::string &typeName) {
+  return typeBindings ? substituteTypes(typeName, *typeBindings) : typeName;
+}
+
+bool Compiler::inferTypes(DefunNode *generic, FunctionCallNode *call,
+                          const std::string &resultType,
+                          std::map<std::string, std::string> &bindings,
+                          std::string &why) {
+  if (call->args.size() != generic->args.size()) {
+    why = "takes " + std::to_string(generic->args.size()) + " argument" +
+          (generic->args.size() == 1 ? "" : "s");
+    return false;
+  }
+  auto isParam = [&](const std::string &name) {
+    return std::find(generic->typeParams.begin(), generic->typeParams.end(),
+                     name) != generic->typeParams.end();
+  };
+  // a T[] or T[N] parameter binds T to the element type of the array
+  auto bind = [&](const std::string &pattern, std::string actual) {
+    size_t bracket = pattern.find('[');
+    std::string param = pattern.substr(0, bracket);
+    if (!isParam(param) || actual.empty())
+      return true;
+    if (bracket != std::string::npos) {
+      if (!isArrayType(actual)) {
+        why = "expected an array or a slice for " + pattern + ", not " +
+              actual;
+        return false;
+      }
+      actual = elementTypeName(actual);
+    }
+    auto bound = bindings.find(param);
+    if (bound != bindings.end() && bound->second != actual) {
+      why = param + " is both " + bound->second + " and " + actual;
+      return false;
+    }
+    bindings[param] = actual;
+    return true;
+  };
+  // a literal only decides a type no other argument does: max(x, 0) is
+  // max<i64> for an i64 x
+  for (size_t i = 0; i < call->args.size(); ++i)
+    if (!isIntLiteral(call->args[i]) &&
+        !bind(generic->args[i].type, typeNameOf(call->args[i]->value)))
+      return false;
+  for (size_t i = 0; i < call->args.size(); ++i) {
+    const std::string &pattern = generic->args[i].type;
+    if (isIntLiteral(call->args[i]) &&
+        !bindings.count(pattern.substr(0, pattern.find('['))) &&
+        !bind(pattern, typeNameOf(call->args[i]->value)))
+      return false;
+  }
+  // only a type nothing else binds is taken from the result
+  std::string returned =
+      generic->ret_type.substr(0, generic->ret_type.find('['));
+  if (!resultType.empty() && isParam(returned) && !bindings.count(returned) &&
+      !bind(generic->ret_type, resultType))
+    return false;
+  for (auto &param : generic->typeParams)
+    if (!bindings.count(param)) {
+      why = "can't infer " + param + " from the arguments";
+      return false;
+    }
+  return true;
+}
+
+Function *Compiler::instantiate(FunctionCallNode *call,
+                                const std::string &resultType) {
+  DefunNode *generic = generics.at(call->name);
+  std::map<std::string, std::string> bindings;
+  std::string why;
+  if (!inferTypes(generic, call, resultType, bindings, why)) {
+    error = call->name + ": " + why;
+    return nullptr;
+  }
+  std::string symbol;
+  for (auto &param : generic->typeParams)
+    symbol += (symbol.empty() ? "<" : ",") + bindings[param];
+  symbol = call->name + symbol + ">";
+  // once per module, however often it is called
+  if (Function *function = module->getFunction(symbol))
+    return function;
+  Instance &instance = instances[symbol];
+  if (!instance.def) {
+    instance.generic = call->name;
+    instance.def = std::make_unique<DefunNode>(*generic);
+    instance.def->name = symbol;
+    instance.def->typeParams.clear();
+    instance.def->isPublic = false;
+    for (auto &arg : instance.def->args)
+      arg.type = substituteTypes(arg.type, bindings);
+    instance.def->ret_type = substituteTypes(generic->ret_type, bindings);
+    instance.bindings = bindings;
+  }
+  Function *function = declarePrototype(instance.def.get());
+  function->setLinkage(Function::InternalLinkage);
+  function->setCallingConv(CallingConv::Fast);
+  pendingInstances.push_back(symbol);
+  return function;
+}
+
+void Compiler::lowerInstances() {
+  // an instance may call further instances, which queue up behind it
+  while (!pendingInstances.empty()) {
+    Instance &instance = instances[pendingInstances.back()];
+    pendingInstances.pop_back();
+    // the body, which the signature of a streamed unit doesn't have yet
+    // when the first call is seen
+    instance.def->body = generics.at(instance.generic)->body;
+    if (!instance.def->body) {
+      error = instance.def->name + ": " + instance.generic +
+              " is declared but never defined";
+      continue;
     }
+    typeBindings = &instance.bindings;
+    codegenDefun(instance.def.get());
+    typeBindings = nullptr;
   }
 }
 
@@ -192,6 +877,27 @@ void Compiler::declareLibcFunctions() {
     llvm::Function::Create(ftype, llvm::Function::ExternalLinkage, "memset",
                            module.get());
   }
+  // memcmp
+  if (!module->getFunction("memcmp")) {
+    std::vector<llvm::Type *> args = {
+        llvm::Type::getInt8Ty(*context)->getPointerTo(),
+        llvm::Type::getInt8Ty(*context)->getPointerTo(),
+        llvm::Type::getInt64Ty(*context)};
+    auto ftype =
+        llvm::FunctionType::get(llvm::Type::getInt32Ty(*context), args, false);
+    llvm::Function::Create(ftype, llvm::Function::ExternalLinkage, "memcmp",
+                           module.get());
+  }
+  // realloc
+  if (!module->getFunction("realloc")) {
+    std::vector<llvm::Type *> args = {
+        llvm::Type::getInt8Ty(*context)->getPointerTo(),
+        llvm::Type::getInt64Ty(*context)};
+    auto ftype = llvm::FunctionType::get(
+        llvm::Type::getInt8Ty(*context)->getPointerTo(), args, false);
+    llvm::Function::Create(ftype, llvm::Function::ExternalLinkage, "realloc",
+                           module.get());
+  }
   // strcpy
   if (!module->getFunction("strcpy")) {
     std::vector<llvm::Type *> args = {
@@ -249,14 +955,202 @@ void Compiler::declareLibcFunctions() {
   }
 }
 
-void Compiler::compile() {
-  declareLibcFunctions();
-  if (!root)
+bool Compiler::configureTarget() {
+  if (!machine) {
+    std::string reason;
+    machine = createTargetMachine(target, reason);
+    if (!machine) {
+      error = "can't create target machine: " + reason;
+      return false;
+    }
+    // with a profile, cold blocks move out of line into .text.split
+    if (!profile.use.empty())
+      machine->Options.EnableMachineFunctionSplitter = true;
+  }
+  module->setTargetTriple(machine->getTargetTriple().str());
+  module->setDataLayout(machine->createDataLayout());
+  return true;
+}
+
+void Compiler::optimize() {
+  if (machine)
+    optimizeModule(*module, *machine, target.optLevel, profile);
+}
+
+void Compiler::createDebugInfo() {
+  debugBuilder = std::make_unique<DIBuilder>(*module);
+  // without -g this is what clang uses for -Rpass: instructions carry
+  // locations, but nothing is emitted into the object file
+  compileUnit = debugBuilder->createCompileUnit(
+      dwarf::DW_LANG_C, debugFile(module->getSourceFileName()),
+      "prex " PREX_VERSION, target.optLevel > 0, "", 0, "",
+      debugInfo ? DICompileUnit::FullDebug : DICompileUnit::NoDebug);
+  module->addModuleFlag(Module::Warning, "Debug Info Version",
+                        DEBUG_METADATA_VERSION);
+}
+
+DIFile *Compiler::debugFile(const std::string &path) {
+  auto it = debugFiles.find(path);
+  if (it != debugFiles.end())
+    return it->second;
+  llvm::SmallString<128> directory;
+  llvm::sys::fs::current_path(directory);
+  DIFile *file = debugBuilder->createFile(path, directory);
+  debugFiles[path] = file;
+  return file;
+}
+
+DIType *Compiler::debugType(const std::string &typeName) {
+  llvm::Type *type = getLLVMType(typeName);
+  unsigned lanes;
+  std::string lane;
+  if (isVectorType(typeName, lanes, lane))
+    return debugBuilder->createVectorType(
+        module->getDataLayout().getTypeAllocSizeInBits(type), 0,
+        debugType(lane),
+        debugBuilder->getOrCreateArray(
+            {debugBuilder->getOrCreateSubrange(0, lanes)}));
+  const DataLayout &layout = module->getDataLayout();
+  auto member = [&](const std::string &name, DIType *memberType,
+                    uint64_t offset) {
+    return debugBuilder->createMemberType(
+        compileUnit, name, nullptr, 0, memberType->getSizeInBits(), 0, offset,
+        DINode::FlagZero, memberType);
+  };
+  if (isArrayType(typeName)) {
+    uint64_t bits = layout.getTypeAllocSizeInBits(type);
+    uint64_t length = arrayLength(typeName);
+    auto array = [&](DIType *element) -> DIType * {
+      return debugBuilder->createArrayType(
+          element->getSizeInBits() * length, 0, element,
+          debugBuilder->getOrCreateArray(
+              {debugBuilder->getOrCreateSubrange(0, length)}));
+    };
+    unsigned pointerBits = layout.getPointerSizeInBits();
+    auto pointer = [&](DIType *element) -> DIType * {
+      return debugBuilder->createPointerType(element, pointerBits);
+    };
+    StructInfo *soa = soaElement(typeName);
+    if (!soa) {
+      DIType *element = debugType(elementTypeName(typeName));
+      if (length)
+        return array(element);
+      return debugBuilder->createStructType(
+          compileUnit, typeName, nullptr, 0, bits, 0, DINode::FlagZero,
+          nullptr,
+          debugBuilder->getOrCreateArray(
+              {member("data", pointer(element), 0),
+               member("len", debugType("u64"), pointerBits)}));
+    }
+    // a #[soa] array shows as what it is, a column per field
+    const StructLayout *columns =
+        layout.getStructLayout(cast<StructType>(type));
+    std::vector<Metadata *> members;
+    for (size_t i = 0; i < soa->fields.size(); ++i) {
+      DIType *field = debugType(soa->fields[i].type);
+      members.push_back(member(soa->fields[i].name,
+                               length ? array(field) : pointer(field),
+                               columns->getElementOffsetInBits(i)));
+    }
+    if (!length)
+      members.push_back(
+          member("len", debugType("u64"),
+                 columns->getElementOffsetInBits(soa->fields.size())));
+    return debugBuilder->createStructType(
+        compileUnit, typeName, nullptr, 0, bits, 0, DINode::FlagZero, nullptr,
+        debugBuilder->getOrCreateArray(members));
+  }
+  if (typeName == "str" || typeName == "strbuf") {
+    // the pointing form, an inline str shows up as its bytes in `data`
+    auto cached = debugStructs.find(type);
+    if (cached != debugStructs.end())
+      return cached->second;
+    const StructLayout *fields =
+        layout.getStructLayout(cast<StructType>(type));
+    DIType *debugString = debugBuilder->createStructType(
+        compileUnit, typeName, nullptr, 0, layout.getTypeAllocSizeInBits(type),
+        0, DINode::FlagZero, nullptr,
+        debugBuilder->getOrCreateArray(
+            {member("data",
+                    debugBuilder->createPointerType(
+                        debugType("ch"), layout.getPointerSizeInBits()),
+                    0),
+             member("len", debugType("u64"), fields->getElementOffsetInBits(1)),
+             member(typeName == "str" ? "tag" : "cap", debugType("u64"),
+                    fields->getElementOffsetInBits(2))}));
+    debugStructs[type] = debugString;
+    return debugString;
+  }
+  if (StructInfo *info = structInfo(typeName)) {
+    auto cached = debugStructs.find(info->type);
+    if (cached != debugStructs.end())
+      return cached->second;
+    const StructLayout *fields = layout.getStructLayout(info->type);
+    std::vector<Metadata *> members;
+    for (size_t i = 0; i < info->fields.size(); ++i)
+      members.push_back(
+          member(info->fields[i].name, debugType(info->fields[i].type),
+                 fields->getElementOffsetInBits(info->elements[i])));
+    DIType *debugStruct = debugBuilder->createStructType(
+        compileUnit, typeName, nullptr, 0,
+        layout.getTypeAllocSizeInBits(info->type), info->align * 8,
+        DINode::FlagZero, nullptr, debugBuilder->getOrCreateArray(members));
+    debugStructs[info->type] = debugStruct;
+    return debugStruct;
+  }
+  if (type->isVoidTy())
+    return nullptr;
+  if (type->isPointerTy())
+    return debugBuilder->createPointerType(
+        debugType("ch"), module->getDataLayout().getPointerSizeInBits());
+  unsigned encoding = dwarf::DW_ATE_signed;
+  if (typeName == "ch")
+    encoding = dwarf::DW_ATE_signed_char;
+  else if (typeName == "bool")
+    encoding = dwarf::DW_ATE_boolean;
+  else if (type->isFloatingPointTy())
+    encoding = dwarf::DW_ATE_float;
+  else if (typeName[0] == 'u')
+    encoding = dwarf::DW_ATE_unsigned;
+  unsigned bits = type->isIntegerTy(1) ? 8 : type->getPrimitiveSizeInBits();
+  return debugBuilder->createBasicType(typeName, bits, encoding);
+}
+
+void Compiler::declareDebugVariable(Value *alloca, const std::string &name,
+                                    const std::string &typeName, Node *node,
+                                    unsigned argNo) {
+  if (!debugInfo || !subprogram)
     return;
+  DIFile *file = subprogram->getFile();
+  DILocalVariable *variable =
+      argNo ? debugBuilder->createParameterVariable(
+                  subprogram, name, argNo, file, node->line,
+                  debugType(typeName))
+            : debugBuilder->createAutoVariable(subprogram, name, file,
+                                               node->line, debugType(typeName));
+  debugBuilder->insertDeclare(
+      alloca, variable, debugBuilder->createExpression(),
+      DILocation::get(*context, node->line, node->col, subprogram),
+      builder->GetInsertBlock());
+}
+
+void Compiler::setLocation(Node *node) {
+  if (subprogram && node && node->line)
+    builder->SetCurrentDebugLocation(
+        DILocation::get(*context, node->line, node->col, subprogram));
+}
+
+bool Compiler::compile() {
+  if (!root) {
+    if (!configureTarget())
+      return false;
+    declareLibcFunctions();
+    return true;
+  }
+  if (!beginUnit())
+    return false;
   for (auto node : root->nodes) {
-    if (auto import = dynamic_cast<ImportNode *>(node)) {
-      loadAndCompileModule(import->modulePath);
-    } else if (auto def = dynamic_cast<DefunNode *>(node)) {
+    if (auto def = dynamic_cast<DefunNode *>(node)) {
       codegenDefun(def);
     } else if (auto var = dynamic_cast<VarNode *>(node)) {
       codegenVar(var);
@@ -264,6 +1158,60 @@ void Compiler::compile() {
       codegenVarAssign(assign);
     }
   }
+  return finishUnit();
+}
+
+bool Compiler::compileStream(const std::function<DefunNode *()> &next) {
+  if (!beginUnit())
+    return false;
+  while (DefunNode *def = next())
+    codegenDefun(def);
+  return finishUnit();
+}
+
+bool Compiler::beginUnit() {
+  if (!configureTarget())
+    return false;
+  declareLibcFunctions();
+  if (remarks.enabled())
+    collectRemarks(*context, remarks, collectedRemarks);
+  if ((debugInfo || remarks.enabled()) && !debugBuilder)
+    createDebugInfo();
+  if (framePointers)
+    module->setFramePointer(FramePointerKind::All);
+  if (importMode == ImportMode::Link && !compileImports())
+    return false;
+  // signature pre-pass, so calls may refer to functions defined further down
+  declareStructs(root);
+  for (auto node : root->nodes)
+    if (auto def = dynamic_cast<DefunNode *>(node)) {
+      // a private function shadows what other units export under its name
+      Function *existing = module->getFunction(def->name);
+      if (existing && isPrivate(def) && existing->isDeclaration() &&
+          existing->use_empty())
+        existing->eraseFromParent();
+      Function *function = declarePrototype(def);
+      if (function && isInternal(def))
+        function->setCallingConv(CallingConv::Fast);
+    }
+  return true;
+}
+
+bool Compiler::finishUnit() {
+  lowerInstances();
+  if (debugBuilder)
+    debugBuilder->finalize();
+  if (!error.empty())
+    return false;
+  if (importMode == ImportMode::Link && !thinLto)
+    return linkImportedModules();
+  return true;
+}
+
+Function *Compiler::compileFunction(DefunNode *def) {
+  Function *function = codegenDefun(def);
+  lowerInstances();
+  return function;
 }
 
 void Compiler::printLlvm() { module->print(llvm::outs(), nullptr); }
@@ -279,69 +1227,406 @@ void Compiler::writeLlvmToFile(const std::string &filename) {
   module->print(out, nullptr);
 }
 
+bool Compiler::emitObjectToBuffer(std::string &object) {
+  if (!configureTarget())
+    return false;
+  llvm::SmallVector<char, 0> buffer;
+  llvm::raw_svector_ostream out(buffer);
+  if (!emitObject(*module, *machine, out, error)) {
+    error = "can't emit object: " + error;
+    return false;
+  }
+  object.assign(buffer.begin(), buffer.end());
+  return true;
+}
+
+void Compiler::emitBitcodeToBuffer(std::string &bitcode) {
+  llvm::raw_string_ostream out(bitcode);
+  llvm::WriteBitcodeToFile(*module, out);
+  out.flush();
+}
+
+bool Compiler::emitThinLtoBitcodeToBuffer(std::string &bitcode) {
+  if (!configureTarget())
+    return false;
+  llvm::raw_string_ostream out(bitcode);
+  emitThinLtoBitcode(*module, *machine, target.optLevel, profile, out);
+  out.flush();
+  return true;
+}
+
+bool Compiler::writeObjectToFile(const std::string &filename) {
+  std::string object;
+  if (!emitObjectToBuffer(object)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return false;
+  }
+  std::error_code EC;
+  llvm::raw_fd_ostream out(filename, EC, llvm::sys::fs::OF_None);
+  if (EC) {
+    fprintf(stderr, "can't open file %s: %s\n", filename.c_str(),
+            EC.message().c_str());
+    return false;
+  }
+  out << object;
+  return true;
+}
+
+void Compiler::applyAttributes(Function *function, DefunNode *def) {
+  for (auto &attribute : def->attributes) {
+    if (attribute.name == "inline") {
+      function->addFnAttr(attribute.args.empty()
+                              ? llvm::Attribute::InlineHint
+                              : llvm::Attribute::AlwaysInline);
+    } else if (attribute.name == "noinline") {
+      function->addFnAttr(llvm::Attribute::NoInline);
+    } else if (attribute.name == "cold") {
+      // also makes branches leading to calls of it unlikely
+      function->addFnAttr(llvm::Attribute::Cold);
+      function->addFnAttr(llvm::Attribute::OptimizeForSize);
+    } else if (attribute.name == "hot") {
+      function->addFnAttr(llvm::Attribute::Hot);
+    } else if (attribute.name == "pure") {
+      // no side effects, only depends on its arguments
+      function->setDoesNotAccessMemory();
+      function->setDoesNotThrow();
+      function->addFnAttr(llvm::Attribute::WillReturn);
+    }
+  }
+}
+
 Function *Compiler::codegenDefun(DefunNode *def) {
-  enterScope();
-  std::vector<Type *> argTypes;
-  for (auto &arg : def->args) {
-    argTypes.push_back(getLLVMType(arg.type));
+  if (!def->typeParams.empty()) {
+    declareGeneric(def);
+    return nullptr;
   }
+  enterScope();
   Type *retType = getLLVMType(def->ret_type);
-  FunctionType *funcType = FunctionType::get(retType, argTypes, false);
-  Function *function = Function::Create(funcType, Function::ExternalLinkage,
-                                        def->name, module.get());
+  FunctionType *funcType = functionType(def);
+  const FunctionAbi *abi = abiOf(symbolName(def));
+  // reuse a prototype declared for an import, define it here
+  Function *function = module->getFunction(symbolName(def));
+  if (!function || !function->empty() ||
+      function->getFunctionType() != funcType)
+    function = Function::Create(funcType, Function::ExternalLinkage,
+                                symbolName(def), module.get());
+  // module private functions are free game for interprocedural passes:
+  // they can be dropped, cloned or get their signature rewritten
+  if (isInternal(def)) {
+    function->setLinkage(Function::InternalLinkage);
+    function->setCallingConv(CallingConv::Fast);
+  }
+  // #[memo]: the function becomes a cache lookup, the body goes into an
+  // internal function it calls on a miss
+  Function *memoWrapper = nullptr;
+  if (def->hasAttribute("memo")) {
+    memoWrapper = function;
+    function = Function::Create(funcType, Function::InternalLinkage,
+                                symbolName(def) + ".uncached", module.get());
+    function->setCallingConv(CallingConv::Fast);
+  }
+  applyAttributes(function, def);
+  for (Function *f : {function, memoWrapper}) {
+    if (!f)
+      continue;
+    if (abi)
+      for (auto &[index, attribute] : abiAttributes(*abi))
+        f->addParamAttr(index, attribute);
+    if (machine) {
+      f->addFnAttr("target-cpu", machine->getTargetCPU());
+      if (!machine->getTargetFeatureString().empty())
+        f->addFnAttr("target-features", machine->getTargetFeatureString());
+    }
+    if (framePointers)
+      f->addFnAttr("frame-pointer", "all");
+  }
+  if (debugBuilder) {
+    DIFile *file = debugFile(def->file);
+    std::vector<Metadata *> signature;
+    if (debugInfo) {
+      signature.push_back(debugType(def->ret_type));
+      for (auto &arg : def->args)
+        signature.push_back(debugType(arg.type));
+    }
+    auto type = debugBuilder->createSubroutineType(
+        debugBuilder->getOrCreateTypeArray(signature));
+    auto flags = DISubprogram::SPFlagDefinition;
+    if (function->hasLocalLinkage())
+      flags |= DISubprogram::SPFlagLocalToUnit;
+    if (target.optLevel > 0)
+      flags |= DISubprogram::SPFlagOptimized;
+    subprogram = debugBuilder->createFunction(
+        file, def->name, function->getName(), file, def->line, type,
+        def->line, DINode::FlagPrototyped, flags);
+    function->setSubprogram(subprogram);
+  }
   BasicBlock *bb = BasicBlock::Create(*context, "entry", function);
   builder->SetInsertPoint(bb);
+  setLocation(def);
+  tailCalls.clear();
+  mustTailCalls.clear();
+  addressTaken = false;
+  varTypes.clear();
   // alloc arguments as local vars
-  unsigned idx = 0;
-  for (auto &arg : function->args()) {
+  currentAbi = abi;
+  auto param = function->arg_begin();
+  if (abi && abi->ret.kind == AbiPassing::Memory) {
+    resultPointer = &*param++;
+    resultPointer->setName("result");
+  }
+  for (unsigned idx = 0; idx < def->args.size(); ++idx) {
     auto &argInfo = def->args[idx];
-    arg.setName(argInfo.name);
     llvm::Type *llvmType = getLLVMType(argInfo.type);
-    Value *alloca = builder->CreateAlloca(llvmType, nullptr, argInfo.name);
-    builder->CreateStore(&arg, alloca);
-    declareVar(argInfo.name, alloca);
-    idx++;
-  }
-  if (def->body && !def->body->nodes.empty()) {
-    for (auto node : def->body->nodes) {
-      if (auto var = dynamic_cast<VarNode *>(node)) {
-        codegenVar(var); // local vars
-      } else if (auto assign = dynamic_cast<VarAssignNode *>(node)) {
-        codegenVarAssign(assign);
-      } else if (auto exprStmt = dynamic_cast<ExprNode *>(node)) {
-        codegenExpr(exprStmt->value);
-      } else if (auto ret = dynamic_cast<RetNode *>(node)) {
-        if (ret->expr) {
-          Value *retVal = codegenExpr(ret->expr->value);
-          builder->CreateRet(retVal);
-        }
-      } else if (auto ifNode = dynamic_cast<IfNode *>(node)) {
-        codegenIf(ifNode);
-      } else if (auto loop = dynamic_cast<LoopNode *>(node)) {
-        codegenLoop(loop);
+    AllocaInst *alloca =
+        builder->CreateAlloca(llvmType, nullptr, argInfo.name);
+    if (alignOf(llvmType) > alloca->getAlign())
+      alloca->setAlignment(alignOf(llvmType));
+    AbiPassing::Kind kind = abi ? abi->args[idx].kind : AbiPassing::Direct;
+    if (kind == AbiPassing::Registers) {
+      // put back together from its eightbytes
+      std::vector<Value *> parts;
+      for (size_t i = 0; i < abi->args[idx].parts.size(); ++i) {
+        param->setName(argInfo.name + "." + std::to_string(i));
+        parts.push_back(&*param++);
       }
+      storeParts(abi->args[idx], parts, alloca);
+    } else if (kind == AbiPassing::Memory) {
+      // the byval copy is the callee's already, but variables are allocas;
+      // SROA takes the second copy apart again
+      param->setName(argInfo.name);
+      builder->CreateStore(builder->CreateLoad(llvmType, &*param++),
+                           alloca);
+    } else {
+      param->setName(argInfo.name);
+      builder->CreateStore(&*param++, alloca);
     }
-  } else {
+    declareVar(argInfo.name, alloca, argInfo.type);
+    declareDebugVariable(alloca, argInfo.name, argInfo.type, def, idx + 1);
+  }
+  if (def->body)
+    codegenBody(def->body);
+  // falling off the end returns zero
+  if (!builder->GetInsertBlock()->getTerminator()) {
     if (!retType->isVoidTy())
-      builder->CreateRet(Constant::getNullValue(retType));
+      emitReturn(Constant::getNullValue(retType));
     else
       builder->CreateRetVoid();
   }
+  currentAbi = nullptr;
+  resultPointer = nullptr;
+  if (!addressTaken)
+    for (auto call : tailCalls)
+      call->setTailCall();
+  else if (!mustTailCalls.empty())
+    error = "become in " + def->name +
+            ": the address of a local variable is taken, the callee could "
+            "still use it after the caller's frame is gone";
+  if (subprogram) {
+    debugBuilder->finalizeSubprogram(subprogram);
+    subprogram = nullptr;
+  }
+  builder->SetCurrentDebugLocation(DebugLoc());
   verifyFunction(*function);
   exitScope();
+  if (memoWrapper) {
+    codegenMemo(def, memoWrapper, function);
+    return memoWrapper;
+  }
   return function;
 }
 
+// The cache is a table of `capacity` entries {used, keys..., result}, the
+// keys being the bits of the arguments. A lookup hashes them to a home slot
+// and probes at most memoProbes slots from there; a miss stores the result
+// in the first free slot, or evicts the home slot when they are all taken.
+static const unsigned memoProbes = 8;
+
+void Compiler::codegenMemo(DefunNode *def, Function *wrapper,
+                           Function *body) {
+  std::string where = "#[memo] on " + def->name + ": ";
+  if (structInfo(def->ret_type)) {
+    error = where + "the function must return a scalar, not a " +
+            def->ret_type;
+    return;
+  }
+  if (body->getReturnType()->isVoidTy()) {
+    error = where + "the function must return a value";
+    return;
+  }
+  for (auto &arg : def->args) {
+    Type *type = getLLVMType(arg.type);
+    if (arg.type == "str" ||
+        !(type->isIntegerTy() || type->isFloatingPointTy())) {
+      error = where + "argument " + arg.name + " is a " + arg.type +
+              ", only scalar arguments can be cache keys";
+      return;
+    }
+  }
+  uint64_t capacity = 1024;
+  bool threadLocal = false;
+  for (auto &attribute : def->attributes)
+    if (attribute.name == "memo")
+      for (auto &arg : attribute.args) {
+        if (arg == "thread_local")
+          threadLocal = true;
+        else
+          capacity = PowerOf2Ceil(std::stoull(arg.substr(9)));
+      }
+
+  Type *i64 = builder->getInt64Ty();
+  std::vector<Type *> fields = {builder->getInt8Ty()};
+  for (auto &arg : wrapper->args()) {
+    Type *type = arg.getType();
+    fields.push_back(builder->getIntNTy(type->getScalarSizeInBits()));
+  }
+  fields.push_back(body->getReturnType());
+  StructType *entryType = StructType::get(*context, fields);
+  ArrayType *tableType = ArrayType::get(entryType, capacity);
+  auto table = new GlobalVariable(
+      *module, tableType, false, GlobalValue::InternalLinkage,
+      ConstantAggregateZero::get(tableType), wrapper->getName() + ".memo",
+      nullptr,
+      threadLocal ? GlobalValue::GeneralDynamicTLSModel
+                  : GlobalValue::NotThreadLocal);
+
+  if (debugBuilder) {
+    DIFile *file = debugFile(def->file);
+    auto type = debugBuilder->createSubroutineType(
+        debugBuilder->getOrCreateTypeArray({}));
+    auto flags = DISubprogram::SPFlagDefinition;
+    if (wrapper->hasLocalLinkage())
+      flags |= DISubprogram::SPFlagLocalToUnit;
+    if (target.optLevel > 0)
+      flags |= DISubprogram::SPFlagOptimized;
+    subprogram = debugBuilder->createFunction(
+        file, def->name, wrapper->getName(), file, def->line, type, def->line,
+        DINode::FlagArtificial, flags);
+    wrapper->setSubprogram(subprogram);
+  }
+  BasicBlock *entry = BasicBlock::Create(*context, "entry", wrapper);
+  BasicBlock *probe = BasicBlock::Create(*context, "memo.probe", wrapper);
+  BasicBlock *compare = BasicBlock::Create(*context, "memo.compare", wrapper);
+  BasicBlock *next = BasicBlock::Create(*context, "memo.next", wrapper);
+  BasicBlock *hit = BasicBlock::Create(*context, "memo.hit", wrapper);
+  BasicBlock *miss = BasicBlock::Create(*context, "memo.miss", wrapper);
+  builder->SetInsertPoint(entry);
+  setLocation(def);
+
+  // Fibonacci hashing: the top bits of the product are the best mixed
+  std::vector<Value *> args, keys;
+  Value *hash = ConstantInt::get(i64, 0);
+  for (auto &arg : wrapper->args()) {
+    arg.setName(def->args[args.size()].name);
+    args.push_back(&arg);
+    Value *key = builder->CreateBitCast(&arg, fields[keys.size() + 1]);
+    keys.push_back(key);
+    Value *word = builder->CreateZExtOrTrunc(key, i64);
+    if (key->getType()->getIntegerBitWidth() > 64)
+      word = builder->CreateXor(
+          word, builder->CreateTrunc(builder->CreateLShr(key, 64), i64));
+    hash = builder->CreateMul(builder->CreateXor(hash, word),
+                              ConstantInt::get(i64, 0x9E3779B97F4A7C15ULL));
+  }
+  unsigned bits = Log2_64(capacity);
+  Value *home = bits ? builder->CreateLShr(hash, 64 - bits)
+                     : ConstantInt::get(i64, 0);
+  builder->CreateBr(probe);
+
+  builder->SetInsertPoint(probe);
+  PHINode *slot = builder->CreatePHI(i64, 2, "slot");
+  PHINode *step = builder->CreatePHI(i64, 2, "step");
+  slot->addIncoming(home, entry);
+  step->addIncoming(ConstantInt::get(i64, 0), entry);
+  Value *entryPtr = builder->CreateInBoundsGEP(
+      tableType, table, {ConstantInt::get(i64, 0), slot});
+  auto field = [&](unsigned index) {
+    return builder->CreateStructGEP(entryType, entryPtr, index);
+  };
+  Value *used = builder->CreateLoad(builder->getInt8Ty(), field(0));
+  builder->CreateCondBr(builder->CreateIsNull(used), miss, compare);
+
+  builder->SetInsertPoint(compare);
+  Value *same = builder->getTrue();
+  for (unsigned i = 0; i < keys.size(); ++i) {
+    Value *stored = builder->CreateLoad(fields[i + 1], field(i + 1));
+    same = builder->CreateAnd(same, builder->CreateICmpEQ(stored, keys[i]));
+  }
+  builder->CreateCondBr(same, hit, next);
+
+  builder->SetInsertPoint(next);
+  Value *nextStep = builder->CreateAdd(step, ConstantInt::get(i64, 1));
+  Value *nextSlot =
+      builder->CreateAnd(builder->CreateAdd(slot, ConstantInt::get(i64, 1)),
+                         ConstantInt::get(i64, capacity - 1));
+  slot->addIncoming(nextSlot, next);
+  step->addIncoming(nextStep, next);
+  Value *probes =
+      ConstantInt::get(i64, std::min<uint64_t>(capacity, memoProbes));
+  builder->CreateCondBr(builder->CreateICmpULT(nextStep, probes), probe, miss);
+
+  builder->SetInsertPoint(hit);
+  unsigned resultIndex = fields.size() - 1;
+  builder->CreateRet(
+      builder->CreateLoad(fields[resultIndex], field(resultIndex)));
+
+  builder->SetInsertPoint(miss);
+  PHINode *insertAt = builder->CreatePHI(i64, 2, "insert");
+  insertAt->addIncoming(slot, probe);
+  insertAt->addIncoming(home, next);
+  CallInst *result = builder->CreateCall(body, args);
+  result->setCallingConv(body->getCallingConv());
+  entryPtr = builder->CreateInBoundsGEP(tableType, table,
+                                        {ConstantInt::get(i64, 0), insertAt});
+  for (unsigned i = 0; i < keys.size(); ++i)
+    builder->CreateStore(keys[i], field(i + 1));
+  builder->CreateStore(result, field(resultIndex));
+  builder->CreateStore(builder->getInt8(1), field(0));
+  builder->CreateRet(result);
+
+  if (subprogram) {
+    debugBuilder->finalizeSubprogram(subprogram);
+    subprogram = nullptr;
+  }
+  builder->SetCurrentDebugLocation(DebugLoc());
+  verifyFunction(*wrapper);
+}
+
 Value *Compiler::codegenVar(VarNode *var) {
-  llvm::Type *llvmType = getLLVMType(var->type);
+  std::string typeName = bindTypes(var->type);
+  llvm::Type *llvmType = getLLVMType(typeName);
   if (builder->GetInsertBlock() && builder->GetInsertBlock()->getParent()) {
     // local var
-    Value *alloca = builder->CreateAlloca(llvmType, nullptr, var->name);
-    if (var->value && var->value->value) {
-      Value *init = codegenExpr(var->value->value);
+    AllocaInst *alloca;
+    if (isArrayType(typeName)) {
+      // in the entry block, so an array declared in a loop takes its stack
+      // space once
+      alloca = entryAlloca(llvmType, var->name);
+      // as the SysV ABI aligns arrays of 16 bytes or more, which makes
+      // load_aligned and store_aligned of 16 byte vectors valid on them
+      if (module->getDataLayout().getTypeAllocSize(llvmType) >= 16 &&
+          alloca->getAlign() < 16)
+        alloca->setAlignment(Align(16));
+    } else {
+      alloca = builder->CreateAlloca(llvmType, nullptr, var->name);
+      if (alignOf(llvmType) > alloca->getAlign())
+        alloca->setAlignment(alignOf(llvmType));
+    }
+    declareDebugVariable(alloca, var->name, typeName, var);
+    if (var->value && var->value->value && arrayLength(typeName)) {
+      error = var->name + ": a fixed-size array can't be initialized, "
+                          "assign its elements";
+    } else if (var->value && var->value->value) {
+      Value *init = codegenInit(var->value->value, typeName);
+      if (isIntLiteral(var->value))
+        init = coerce(init, typeName);
       builder->CreateStore(init, alloca);
+    } else if (typeName == "str") {
+      builder->CreateStore(stringLiteral(""), alloca);
+    } else if (typeName == "strbuf") {
+      // empty, without a buffer until the first append
+      builder->CreateStore(Constant::getNullValue(llvmType), alloca);
     }
-    declareVar(var->name, alloca);
+    declareVar(var->name, alloca, typeName);
     return alloca;
   } else {
 
@@ -373,7 +1658,7 @@ Value *Compiler::codegenExpr(Expression *expr) {
     return ConstantInt::get(Type::getInt8Ty(*context), cchar->getValue());
   }
   if (auto cstr = dynamic_cast<ConstString *>(expr)) {
-    return builder->CreateGlobalStringPtr(cstr->getValue());
+    return stringLiteral(cstr->getValue());
   }
   if (auto cbool = dynamic_cast<ConstBool *>(expr)) {
     return ConstantInt::get(Type::getInt1Ty(*context), cbool->getValue());
@@ -381,12 +1666,23 @@ Value *Compiler::codegenExpr(Expression *expr) {
   if (auto id = dynamic_cast<ConstIdentifier *>(expr)) {
     // read local var
     Value *val = lookupVar(id->name);
+    // for loop variables are SSA values, not stack slots
+    if (val && !llvm::isa<llvm::AllocaInst>(val))
+      return val;
     if (val) {
       llvm::Type *elemType = nullptr;
       if (auto allocaInst = llvm::dyn_cast<llvm::AllocaInst>(val))
         elemType = allocaInst->getAllocatedType();
       else
         elemType = val->getType();
+      // an array is passed around as a slice of itself
+      if (isArrayType(varTypes[val]) && arrayLength(varTypes[val])) {
+        std::vector<Value *> data;
+        Value *length;
+        std::string elementType;
+        arrayParts(id->name, data, length, elementType);
+        return makeSlice(data, length);
+      }
       return builder->CreateLoad(elemType, val, id->name);
     }
     // read global var
@@ -410,55 +1706,66 @@ Value *Compiler::codegenExpr(Expression *expr) {
         }
       }
     }
-    Value *l = codegenExpr(binop->left->value);
-    Value *r = codegenExpr(binop->right->value);
-    // --- ADDED: string comparison via strcmp ---
-    // Check if both arguments are strings (str)
-    llvm::Type *lType = l->getType();
-    llvm::Type *rType = r->getType();
-    auto i8ptr = llvm::PointerType::getUnqual(llvm::Type::getInt8Ty(*context));
-    bool isStr = lType == i8ptr && rType == i8ptr;
-    if ((binop->op == "==" || binop->op == "!=") && isStr) {
-      std::vector<llvm::Type *> strcmpArgs = {i8ptr, i8ptr};
-      auto strcmpType = llvm::FunctionType::get(
-          llvm::Type::getInt32Ty(*context), strcmpArgs, false);
-      llvm::Function *strcmpFunc = module->getFunction("strcmp");
-      if (!strcmpFunc) {
-        strcmpFunc =
-            llvm::Function::Create(strcmpType, llvm::Function::ExternalLinkage,
-                                   "strcmp", module.get());
+    Value *l, *r;
+    // s == "literal" is compared to the literal's bytes, once the lengths
+    // match
+    auto leftLiteral = dynamic_cast<ConstString *>(binop->left->value);
+    auto rightLiteral = dynamic_cast<ConstString *>(binop->right->value);
+    if ((binop->op == "==" || binop->op == "!=") &&
+        (leftLiteral != nullptr) != (rightLiteral != nullptr)) {
+      ConstString *literal = leftLiteral ? leftLiteral : rightLiteral;
+      ExprNode *other = leftLiteral ? binop->right : binop->left;
+      Value *str = codegenExpr(other->value);
+      if (str->getType() == stringType()) {
+        Value *equal = codegenStringEquals(str, literal->getValue());
+        return binop->op == "==" ? equal : builder->CreateNot(equal, "nestr");
       }
-      llvm::Value *cmp = builder->CreateCall(strcmpFunc, {l, r}, "strcmpcall");
-      if (binop->op == "==")
-        return builder->CreateICmpEQ(
-            cmp, llvm::ConstantInt::get(llvm::Type::getInt32Ty(*context), 0),
-            "eqstr");
-      else
-        return builder->CreateICmpNE(
-            cmp, llvm::ConstantInt::get(llvm::Type::getInt32Ty(*context), 0),
-            "nestr");
+      Value *literalValue = codegenExpr(literal);
+      l = leftLiteral ? literalValue : str;
+      r = leftLiteral ? str : literalValue;
+    } else {
+      l = codegenExpr(binop->left->value);
+      r = codegenExpr(binop->right->value);
+    }
+    if (l && r && l->getType() != r->getType() &&
+        l->getType()->isIntegerTy() && r->getType()->isIntegerTy()) {
+      if (isIntLiteral(binop->right))
+        r = builder->CreateIntCast(r, l->getType(), true);
+      else if (isIntLiteral(binop->left))
+        l = builder->CreateIntCast(l, r->getType(), true);
+    }
+    // `x / 2` of a float, as in an instance of a generic for f64
+    if (l && r && l->getType()->isFloatingPointTy() &&
+        isIntLiteral(binop->right) && r->getType()->isIntegerTy())
+      r = builder->CreateSIToFP(r, l->getType());
+    else if (l && r && r->getType()->isFloatingPointTy() &&
+             isIntLiteral(binop->left) && l->getType()->isIntegerTy())
+      l = builder->CreateSIToFP(l, r->getType());
+    if (l && r && (l->getType()->isVectorTy() || r->getType()->isVectorTy())) {
+      ExprNode *vector =
+          l->getType()->isVectorTy() ? binop->left : binop->right;
+      return codegenVectorOp(binop->op, l, r,
+                             !isUnsignedType(typeNameOf(vector->value)));
+    }
+    bool isStr = l && r && l->getType() == stringType() &&
+                 r->getType() == stringType();
+    if ((binop->op == "==" || binop->op == "!=") && isStr) {
+      Value *equal = codegenStringEquals(l, r);
+      return binop->op == "==" ? equal : builder->CreateNot(equal, "nestr");
     }
 
-    if (binop->op == "+")
-      return builder->CreateAdd(l, r, "addtmp");
-    if (binop->op == "-")
-      return builder->CreateSub(l, r, "subtmp");
-    if (binop->op == "*")
-      return builder->CreateMul(l, r, "multmp");
-    if (binop->op == "/")
-      return builder->CreateSDiv(l, r, "divtmp");
+    // floats and unsigned integers (an operand of a uN type makes it
+    // unsigned) get their own instructions, as in instances of generics
+    bool isSigned = !isUnsignedType(typeNameOf(binop->left->value)) &&
+                    !isUnsignedType(typeNameOf(binop->right->value));
+    if (l && r && l->getType() == r->getType() &&
+        (l->getType()->isIntegerTy() || l->getType()->isFloatingPointTy()))
+      if (Value *result = codegenArithmetic(binop->op, l, r, isSigned))
+        return result;
     if (binop->op == "==")
       return builder->CreateICmpEQ(l, r, "eqtmp");
     if (binop->op == "!=")
       return builder->CreateICmpNE(l, r, "netmp");
-    if (binop->op == "<")
-      return builder->CreateICmpSLT(l, r, "lttmp");
-    if (binop->op == ">")
-      return builder->CreateICmpSGT(l, r, "gttmp");
-    if (binop->op == "<=")
-      return builder->CreateICmpSLE(l, r, "letmp");
-    if (binop->op == ">=")
-      return builder->CreateICmpSGE(l, r, "getmp");
     if (binop->op == "&&") {
       llvm::Function *function = builder->GetInsertBlock()->getParent();
       llvm::BasicBlock *lhsBB = builder->GetInsertBlock();
@@ -519,10 +1826,11 @@ Value *Compiler::codegenExpr(Expression *expr) {
     }
   }
   if (auto unop = dynamic_cast<UnaryOpNode *>(expr)) {
-    std::cout << "[codegenExpr] UnaryOp: " << unop->op << std::endl;
     Value *val = codegenExpr(unop->expr->value);
     if (unop->op == "-")
-      return builder->CreateNeg(val, "negtmp");
+      return val->getType()->isFPOrFPVectorTy()
+                 ? builder->CreateFNeg(val, "negtmp")
+                 : builder->CreateNeg(val, "negtmp");
     if (unop->op == "+")
       return val;
     if (unop->op == "!")
@@ -531,8 +1839,14 @@ Value *Compiler::codegenExpr(Expression *expr) {
       // If operand is ConstIdentifier, return pointer
       if (auto id = dynamic_cast<ConstIdentifier *>(unop->expr->value)) {
         Value *val = lookupVar(id->name);
-        if (val)
+        if (val && !llvm::isa<llvm::AllocaInst>(val)) {
+          error = "Can't take the address of loop variable " + id->name;
+          return llvm::UndefValue::get(val->getType()->getPointerTo());
+        }
+        if (val) {
+          addressTaken = true;
           return val;
+        }
         if (auto gvar = module->getGlobalVariable(id->name))
           return gvar;
       }
@@ -551,24 +1865,705 @@ Value *Compiler::codegenExpr(Expression *expr) {
   if (auto call = dynamic_cast<FunctionCallNode *>(expr)) {
     return codegenFunctionCall(call);
   }
+  if (auto index = dynamic_cast<IndexNode *>(expr))
+    return codegenIndex(index);
+  if (auto member = dynamic_cast<MemberNode *>(expr))
+    return codegenMember(member);
   return nullptr;
 }
 
-Value *Compiler::codegenFunctionCall(FunctionCallNode *call) {
+// `likely(c)` or `unlikely(c)`, possibly in parentheses.
+static FunctionCallNode *expectCall(Expression *expr) {
+  while (auto exprNode = dynamic_cast<ExprNode *>(expr))
+    expr = exprNode->value;
+  auto call = dynamic_cast<FunctionCallNode *>(expr);
+  if (call && call->args.size() == 1 &&
+      (call->name == "likely" || call->name == "unlikely"))
+    return call;
+  return nullptr;
+}
+
+Value *Compiler::codegenCondition(ExprNode *condition,
+                                  MDNode *&branchWeights) {
+  branchWeights = nullptr;
+  Expression *expr = condition->value;
+  FunctionCallNode *expect = expectCall(expr);
+  if (expect && !module->getFunction(expect->name)) {
+    // the weights llvm.expect would be lowered to
+    MDBuilder weights(*context);
+    branchWeights = expect->name == "likely"
+                        ? weights.createBranchWeights(2000, 1)
+                        : weights.createBranchWeights(1, 2000);
+    expr = expect->args[0]->value;
+  }
+  Value *value = codegenExpr(expr);
+  return builder->CreateICmpNE(value, ConstantInt::get(value->getType(), 0),
+                               "cond");
+}
+
+std::string Compiler::typeNameOf(Expression *expr) {
+  while (auto exprNode = dynamic_cast<ExprNode *>(expr))
+    expr = exprNode->value;
+  // literals, as codegenExpr types them
+  if (dynamic_cast<ConstInt *>(expr))
+    return "i32";
+  if (dynamic_cast<ConstFloat *>(expr))
+    return "f64";
+  if (dynamic_cast<ConstChar *>(expr))
+    return "ch";
+  if (dynamic_cast<ConstBool *>(expr))
+    return "bool";
+  if (dynamic_cast<ConstString *>(expr))
+    return "str";
+  if (auto id = dynamic_cast<ConstIdentifier *>(expr)) {
+    auto it = varTypes.find(lookupVar(id->name));
+    return it != varTypes.end() ? it->second : "";
+  }
+  if (auto index = dynamic_cast<IndexNode *>(expr)) {
+    auto it = varTypes.find(lookupVar(index->name));
+    if (it == varTypes.end())
+      return "";
+    if (it->second == "str")
+      return index->end ? "str" : "ch";
+    std::string element = elementTypeName(it->second);
+    return index->end ? element + "[]" : element;
+  }
+  if (auto member = dynamic_cast<MemberNode *>(expr)) {
+    StructInfo *info = structInfo(typeNameOf(member->object->value));
+    if (info)
+      for (auto &field : info->fields)
+        if (field.name == member->field)
+          return field.type;
+    return "";
+  }
+  if (auto call = dynamic_cast<FunctionCallNode *>(expr)) {
+    // the struct a function returns
+    Function *callee = module->getFunction(call->name + privateSuffix);
+    if (!callee)
+      callee = module->getFunction(call->name);
+    if (!callee && (call->name == "to_str" || call->name == "copy") &&
+        !generics.count(call->name))
+      return "str";
+    auto generic = generics.find(call->name);
+    if (!callee && generic != generics.end()) {
+      // what the instance the call is of returns
+      std::map<std::string, std::string> bindings;
+      std::string why;
+      return inferTypes(generic->second, call, "", bindings, why)
+                 ? substituteTypes(generic->second->ret_type, bindings)
+                 : "";
+    }
+    if (!callee)
+      return "";
+    auto declared = returnTypes.find(callee->getName().str());
+    if (declared != returnTypes.end())
+      return declared->second;
+    // a C function
+    Type *result = callee->getReturnType();
+    if (result->isIntegerTy() && !result->isIntegerTy(1))
+      return "i" + std::to_string(result->getIntegerBitWidth());
+    if (result->isDoubleTy())
+      return "f64";
+    return result->isFloatTy() ? "f32" : "";
+  }
+  if (auto binop = dynamic_cast<BinOpNode *>(expr))
+    return typeNameOf(binop->left->value);
+  if (auto unop = dynamic_cast<UnaryOpNode *>(expr))
+    if (unop->op == "-" || unop->op == "+")
+      return typeNameOf(unop->expr->value);
+  return "";
+}
+
+// Builtins and their number of arguments. Each is a single intrinsic call;
+// a function of the same name in the module takes precedence.
+static const std::map<std::string, unsigned> builtins = {
+    {"popcount", 1},     {"clz", 1},          {"ctz", 1},
+    {"bswap", 1},        {"rotl", 2},         {"rotr", 2},
+    {"add_overflow", 3}, {"mul_overflow", 3}, {"sat_add", 2},
+    {"sat_sub", 2},      {"fma", 3},          {"sqrt", 1},
+};
+
+// String builtins and their number of arguments; see codegenStringBuiltin.
+static const std::map<std::string, unsigned> stringBuiltins = {
+    {"append", 2},
+    {"to_str", 1},
+    {"copy", 1},
+};
+
+Value *Compiler::codegenBuiltin(FunctionCallNode *call) {
+  const std::string &name = call->name;
+  unsigned arity = builtins.at(name);
+  if (call->args.size() != arity) {
+    error = name + " takes " + std::to_string(arity) + " argument" +
+            (arity > 1 ? "s" : "");
+    return UndefValue::get(builder->getInt32Ty());
+  }
+  std::vector<Value *> args;
+  for (auto arg : call->args) {
+    Value *value = codegenExpr(arg->value);
+    if (!value) {
+      error = name + ": invalid argument";
+      return UndefValue::get(builder->getInt32Ty());
+    }
+    args.push_back(value);
+  }
+  Type *type = args[0]->getType();
+  auto intrinsic = [&](Intrinsic::ID id, std::vector<Value *> operands) {
+    Function *f = Intrinsic::getDeclaration(module.get(), id, {type});
+    return builder->CreateCall(f, operands);
+  };
+
+  if (name == "fma" || name == "sqrt") {
+    if (!type->isFloatingPointTy()) {
+      error = name + " expects a floating point argument";
+      return UndefValue::get(type);
+    }
+    for (auto &arg : args)
+      if (arg->getType()->isFloatingPointTy())
+        arg = builder->CreateFPCast(arg, type);
+      else
+        arg = builder->CreateSIToFP(arg, type);
+    return intrinsic(name == "fma" ? Intrinsic::fma : Intrinsic::sqrt, args);
+  }
+
+  if (!type->isIntegerTy() || type->isIntegerTy(1)) {
+    error = name + " expects an integer argument";
+    return UndefValue::get(builder->getInt32Ty());
+  }
+  // the signedness of the first argument's declared type, signed unless it
+  // is one of the uN
+  bool isSigned = typeNameOf(call->args[0]->value).rfind("u", 0) != 0;
+  // the second operand is converted to the type of the first
+  if (args.size() > 1) {
+    if (!args[1]->getType()->isIntegerTy()) {
+      error = name + " expects integer arguments";
+      return UndefValue::get(type);
+    }
+    args[1] = builder->CreateIntCast(args[1], type, isSigned);
+  }
+  if (name == "popcount")
+    return intrinsic(Intrinsic::ctpop, {args[0]});
+  // defined for zero, as the width of the type
+  if (name == "clz")
+    return intrinsic(Intrinsic::ctlz, {args[0], builder->getFalse()});
+  if (name == "ctz")
+    return intrinsic(Intrinsic::cttz, {args[0], builder->getFalse()});
+  if (name == "bswap") {
+    if (type->getIntegerBitWidth() % 16) {
+      error = "bswap expects an integer of 16 bits or more";
+      return UndefValue::get(type);
+    }
+    return intrinsic(Intrinsic::bswap, {args[0]});
+  }
+  // a funnel shift of a value with itself is a rotate
+  if (name == "rotl")
+    return intrinsic(Intrinsic::fshl, {args[0], args[0], args[1]});
+  if (name == "rotr")
+    return intrinsic(Intrinsic::fshr, {args[0], args[0], args[1]});
+  if (name == "sat_add")
+    return intrinsic(isSigned ? Intrinsic::sadd_sat : Intrinsic::uadd_sat,
+                     args);
+  if (name == "sat_sub")
+    return intrinsic(isSigned ? Intrinsic::ssub_sat : Intrinsic::usub_sat,
+                     args);
+
+  // add_overflow(a, b, &result): stores the wrapped result, returns
+  // whether it overflowed
+  auto result = llvm::dyn_cast<AllocaInst>(args[2]);
+  if (!result || result->getAllocatedType() != type) {
+    error = name + " expects the address of a variable of the type of its "
+                   "first argument as the third argument";
+    return UndefValue::get(builder->getInt1Ty());
+  }
+  Intrinsic::ID id;
+  if (name == "add_overflow")
+    id = isSigned ? Intrinsic::sadd_with_overflow
+                  : Intrinsic::uadd_with_overflow;
+  else
+    id = isSigned ? Intrinsic::smul_with_overflow
+                  : Intrinsic::umul_with_overflow;
+  Value *pair = intrinsic(id, {args[0], args[1]});
+  builder->CreateStore(builder->CreateExtractValue(pair, 0), result);
+  return builder->CreateExtractValue(pair, 1);
+}
+
+// Vector builtins and their number of arguments, 0 for shuffle which takes
+// any number of lane indexes.
+static const std::map<std::string, unsigned> vectorBuiltins = {
+    {"splat", 1},      {"load", 2},         {"load_aligned", 2},
+    {"store", 3},      {"store_aligned", 3}, {"shuffle", 0},
+    {"extract", 2},    {"insert", 3},       {"select", 3},
+    {"reduce_add", 1}, {"reduce_mul", 1},   {"reduce_min", 1},
+    {"reduce_max", 1}, {"reduce_and", 1},   {"reduce_or", 1},
+    {"reduce_xor", 1},
+};
+
+Value *Compiler::codegenVectorOp(const std::string &op, Value *l, Value *r,
+                                 bool isSigned) {
+  auto type = cast<FixedVectorType>(
+      (l->getType()->isVectorTy() ? l : r)->getType());
+  Type *lane = type->getElementType();
+  auto broadcast = [&](Value *value) {
+    if (value->getType()->isVectorTy())
+      return value;
+    return builder->CreateVectorSplat(
+        type->getNumElements(),
+        convertScalar(*builder, value, lane, isSigned));
+  };
+  l = broadcast(l);
+  r = broadcast(r);
+  if (l->getType() != r->getType()) {
+    error = "The operands of " + op + " are vectors of different types";
+    return UndefValue::get(type);
+  }
+  if (Value *result = codegenArithmetic(op, l, r, isSigned))
+    return result;
+  error = op + " can't be applied to vectors";
+  return UndefValue::get(type);
+}
+
+Value *Compiler::codegenArithmetic(const std::string &op, Value *l, Value *r,
+                                   bool isSigned) {
+  if (l->getType()->isFPOrFPVectorTy()) {
+    if (op == "+")
+      return builder->CreateFAdd(l, r, "addtmp");
+    if (op == "-")
+      return builder->CreateFSub(l, r, "subtmp");
+    if (op == "*")
+      return builder->CreateFMul(l, r, "multmp");
+    if (op == "/")
+      return builder->CreateFDiv(l, r, "divtmp");
+    if (op == "==")
+      return builder->CreateFCmpOEQ(l, r, "eqtmp");
+    if (op == "!=")
+      return builder->CreateFCmpUNE(l, r, "netmp");
+    if (op == "<")
+      return builder->CreateFCmpOLT(l, r, "lttmp");
+    if (op == ">")
+      return builder->CreateFCmpOGT(l, r, "gttmp");
+    if (op == "<=")
+      return builder->CreateFCmpOLE(l, r, "letmp");
+    if (op == ">=")
+      return builder->CreateFCmpOGE(l, r, "getmp");
+  } else {
+    if (op == "+")
+      return builder->CreateAdd(l, r, "addtmp");
+    if (op == "-")
+      return builder->CreateSub(l, r, "subtmp");
+    if (op == "*")
+      return builder->CreateMul(l, r, "multmp");
+    if (op == "/")
+      return isSigned ? builder->CreateSDiv(l, r, "divtmp")
+                      : builder->CreateUDiv(l, r, "divtmp");
+    if (op == "%")
+      return isSigned ? builder->CreateSRem(l, r, "remtmp")
+                      : builder->CreateURem(l, r, "remtmp");
+    if (op == "^")
+      return builder->CreateXor(l, r, "xortmp");
+    if (op == "==")
+      return builder->CreateICmpEQ(l, r, "eqtmp");
+    if (op == "!=")
+      return builder->CreateICmpNE(l, r, "netmp");
+    if (op == "<")
+      return isSigned ? builder->CreateICmpSLT(l, r, "lttmp")
+                      : builder->CreateICmpULT(l, r, "lttmp");
+    if (op == ">")
+      return isSigned ? builder->CreateICmpSGT(l, r, "gttmp")
+                      : builder->CreateICmpUGT(l, r, "gttmp");
+    if (op == "<=")
+      return isSigned ? builder->CreateICmpSLE(l, r, "letmp")
+                      : builder->CreateICmpULE(l, r, "letmp");
+    if (op == ">=")
+      return isSigned ? builder->CreateICmpSGE(l, r, "getmp")
+                      : builder->CreateICmpUGE(l, r, "getmp");
+  }
+  return nullptr;
+}
+
+Value *Compiler::codegenVectorMemory(FunctionCallNode *call,
+                                     FixedVectorType *type) {
+  const std::string &name = call->name;
+  bool isStore = name.rfind("store", 0) == 0;
+  auto array = dynamic_cast<ConstIdentifier *>(call->args[0]->value);
+  std::vector<Value *> columns;
+  Value *length;
+  std::string elementType;
+  if (!array || !arrayParts(array->name, columns, length, elementType)) {
+    error = name + " expects an array or a slice variable";
+    return UndefValue::get(builder->getInt32Ty());
+  }
+  Value *stored = nullptr;
+  if (isStore) {
+    stored = codegenExpr(call->args[2]->value);
+    type = stored ? dyn_cast<FixedVectorType>(stored->getType()) : nullptr;
+    if (!type) {
+      error = name + " expects a vector to store";
+      return UndefValue::get(builder->getInt32Ty());
+    }
+  }
+  Type *element = getLLVMType(elementType);
+  if (type->getElementType() != element) {
+    error = name + ": the lanes don't have the element type of " +
+            array->name + " (" + elementType + ")";
+    return UndefValue::get(type);
+  }
+  Value *offset = codegenOffset(call->args[1]->value);
+  if (!offset)
+    return UndefValue::get(type);
+  // every lane, from a[i] to a[i + lanes - 1], is in bounds
+  Value *lanes = builder->getInt64(type->getNumElements());
+  boundsCheck(builder->CreateAnd(builder->CreateICmpULE(lanes, length),
+                                 builder->CreateICmpULE(
+                                     offset, builder->CreateSub(length, lanes)),
+                                 "inbounds"),
+              offset, length);
+  Value *address = builder->CreatePointerCast(
+      builder->CreateInBoundsGEP(element, columns[0], offset),
+      type->getPointerTo());
+  // unaligned accesses only assume the alignment of the elements
+  const DataLayout &layout = module->getDataLayout();
+  Align align = name.find("_aligned") != std::string::npos
+                    ? layout.getABITypeAlign(type)
+                    : layout.getABITypeAlign(element);
+  if (isStore)
+    return builder->CreateAlignedStore(stored, address, align);
+  return builder->CreateAlignedLoad(type, address, align, array->name + ".v");
+}
+
+Value *Compiler::codegenVectorBuiltin(FunctionCallNode *call,
+                                      const std::string &typeName) {
+  const std::string &name = call->name;
+  unsigned arity = vectorBuiltins.at(name);
+  if (arity ? call->args.size() != arity : call->args.size() < 2) {
+    error = name + (arity ? " takes " + std::to_string(arity) + " argument" +
+                                (arity > 1 ? "s" : "")
+                          : " takes a vector and lane indexes");
+    return UndefValue::get(builder->getInt32Ty());
+  }
+  if (name == "splat" || name == "load" || name == "load_aligned") {
+    if (typeName.empty()) {
+      error = name + " can only initialize or be assigned to a vector "
+                     "variable, it takes the variable's type";
+      return UndefValue::get(builder->getInt32Ty());
+    }
+    auto type = cast<FixedVectorType>(getLLVMType(typeName));
+    if (name != "splat")
+      return codegenVectorMemory(call, type);
+    Value *value = codegenExpr(call->args[0]->value);
+    if (!value || !(value->getType()->isIntegerTy() ||
+                    value->getType()->isFloatingPointTy())) {
+      error = "splat expects a number";
+      return UndefValue::get(type);
+    }
+    return builder->CreateVectorSplat(
+        type->getNumElements(),
+        convertScalar(*builder, value, type->getElementType(),
+                      !isUnsignedType(typeNameOf(call->args[0]->value))));
+  }
+  if (name == "store" || name == "store_aligned")
+    return codegenVectorMemory(call, nullptr);
+
+  // the rest take a vector first, or for select a mask and then two vectors
+  size_t first = name == "select" ? 1 : 0;
+  Value *vector = codegenExpr(call->args[first]->value);
+  auto type = vector ? dyn_cast<FixedVectorType>(vector->getType()) : nullptr;
+  if (!type) {
+    error = name + " expects a vector";
+    return UndefValue::get(builder->getInt32Ty());
+  }
+  unsigned lanes = type->getNumElements();
+  Type *lane = type->getElementType();
+  bool isSigned = !isUnsignedType(typeNameOf(call->args[first]->value));
+
+  if (name == "shuffle") {
+    // shuffle(a, 3, 2, 1, 0) picks lanes of a, shuffle(a, b, 0, 4, 1, 5)
+    // of a followed by b
+    Value *second = nullptr;
+    size_t from = 1;
+    if (!dynamic_cast<ConstInt *>(call->args[1]->value)) {
+      second = codegenExpr(call->args[1]->value);
+      if (!second || second->getType() != type) {
+        error = "shuffle expects two vectors of the same type";
+        return UndefValue::get(type);
+      }
+      from = 2;
+    }
+    unsigned sources = second ? 2 : 1;
+    std::vector<int> mask;
+    for (size_t i = from; i < call->args.size(); ++i) {
+      auto index = dynamic_cast<ConstInt *>(call->args[i]->value);
+      if (!index || index->getValue() < 0 ||
+          index->getValue() >= sources * lanes) {
+        error = "shuffle lane indexes must be constants below " +
+                std::to_string(sources * lanes);
+        return UndefValue::get(type);
+      }
+      mask.push_back(index->getValue());
+    }
+    if (mask.empty()) {
+      error = "shuffle takes a vector and lane indexes";
+      return UndefValue::get(type);
+    }
+    return builder->CreateShuffleVector(
+        vector, second ? second : UndefValue::get(type), mask, "shuffle");
+  }
+
+  if (name == "extract" || name == "insert") {
+    ExprNode *indexExpr = call->args[1];
+    Value *index = codegenOffset(indexExpr->value);
+    if (!index)
+      return UndefValue::get(type);
+    auto constant = dynamic_cast<ConstInt *>(indexExpr->value);
+    if (constant && (constant->getValue() < 0 || constant->getValue() >= lanes))
+      error = name + ": lane " + std::to_string(constant->getValue()) +
+              " out of bounds for " + std::to_string(lanes) + " lanes";
+    else if (!constant)
+      boundsCheck(builder->CreateICmpULT(index, builder->getInt64(lanes)),
+                  index, builder->getInt64(lanes));
+    if (name == "extract")
+      return builder->CreateExtractElement(vector, index, "lane");
+    Value *value = codegenExpr(call->args[2]->value);
+    if (!value || value->getType()->isVectorTy() ||
+        !(value->getType()->isIntegerTy() ||
+          value->getType()->isFloatingPointTy())) {
+      error = "insert expects a number to put in the lane";
+      return UndefValue::get(type);
+    }
+    return builder->CreateInsertElement(
+        vector, convertScalar(*builder, value, lane, isSigned), index);
+  }
+
+  if (name == "select") {
+    // the lanes of a where the mask is set, of b elsewhere
+    Value *mask = codegenExpr(call->args[0]->value);
+    Value *otherwise = codegenExpr(call->args[2]->value);
+    auto maskType =
+        mask ? dyn_cast<FixedVectorType>(mask->getType()) : nullptr;
+    if (!maskType || maskType->getNumElements() != lanes ||
+        !otherwise || otherwise->getType() != type) {
+      error = "select expects a mask and two vectors with as many lanes";
+      return UndefValue::get(type);
+    }
+    if (!maskType->getElementType()->isIntegerTy(1))
+      mask = builder->CreateICmpNE(mask, Constant::getNullValue(maskType));
+    return builder->CreateSelect(mask, vector, otherwise, "select");
+  }
+
+  // Horizontal reductions. Float sums and products are reassociated, like
+  // the tree a hand-written reduction would use.
+  bool isFloat = lane->isFloatingPointTy();
+  CallInst *reduction = nullptr;
+  if (name == "reduce_add")
+    reduction =
+        isFloat ? builder->CreateFAddReduce(ConstantFP::getNegativeZero(lane),
+                                            vector)
+                : builder->CreateAddReduce(vector);
+  else if (name == "reduce_mul")
+    reduction = isFloat ? builder->CreateFMulReduce(ConstantFP::get(lane, 1.0),
+                                                    vector)
+                        : builder->CreateMulReduce(vector);
+  else if (name == "reduce_min")
+    reduction = isFloat ? builder->CreateFPMinReduce(vector)
+                        : builder->CreateIntMinReduce(vector, isSigned);
+  else if (name == "reduce_max")
+    reduction = isFloat ? builder->CreateFPMaxReduce(vector)
+                        : builder->CreateIntMaxReduce(vector, isSigned);
+  else if (isFloat) {
+    error = name + " expects a vector of integers";
+    return UndefValue::get(lane);
+  } else if (name == "reduce_and")
+    reduction = builder->CreateAndReduce(vector);
+  else if (name == "reduce_or")
+    reduction = builder->CreateOrReduce(vector);
+  else
+    reduction = builder->CreateXorReduce(vector);
+  if (isFloat) {
+    FastMathFlags flags;
+    flags.setAllowReassoc();
+    reduction->setFastMathFlags(flags);
+  }
+  return reduction;
+}
+
+Value *Compiler::codegenFunctionCall(FunctionCallNode *call,
+                                     const std::string &resultType) {
+  bool userDefined = module->getFunction(call->name) ||
+                     module->getFunction(call->name + privateSuffix) ||
+                     generics.count(call->name);
+  if (builtins.count(call->name) && !userDefined)
+    return codegenBuiltin(call);
+  if (vectorBuiltins.count(call->name) && !userDefined)
+    return codegenVectorBuiltin(call);
+  if (stringBuiltins.count(call->name) && !userDefined)
+    return codegenStringBuiltin(call);
+  if (expectCall(call) && !module->getFunction(call->name)) {
+    // a likely/unlikely value outside of an if or loop condition
+    Value *value = codegenExpr(call->args[0]->value);
+    value = builder->CreateICmpNE(value, ConstantInt::get(value->getType(), 0));
+    Function *expect = Intrinsic::getDeclaration(
+        module.get(), Intrinsic::expect, {builder->getInt1Ty()});
+    return builder->CreateCall(
+        expect, {value, builder->getInt1(call->name == "likely")});
+  }
+  if (call->name == "len" && !userDefined) {
+    Value *slice = call->args.size() == 1
+                       ? codegenExpr(call->args[0]->value)
+                       : nullptr;
+    if (slice && slice->getType() == stringType()) {
+      Value *length;
+      stringData(slice, length);
+      return length;
+    }
+    if (slice && slice->getType() == stringBuilderType())
+      return builder->CreateExtractValue(slice, 1, "len");
+    if (!slice || !isSlice(slice->getType())) {
+      error = "len expects an array, a slice, a str or a strbuf";
+      return UndefValue::get(builder->getInt64Ty());
+    }
+    return builder->CreateExtractValue(
+        slice, slice->getType()->getStructNumElements() - 1, "len");
+  }
+  if (call->name == "alloc" && !userDefined) {
+    error = "alloc(n) can only initialize or be assigned to a slice";
+    return UndefValue::get(builder->getInt8Ty()->getPointerTo());
+  }
   std::vector<Value *> argsV;
   for (auto arg : call->args) {
     argsV.push_back(codegenExpr(arg->value));
   }
-  Function *calleeF = module->getFunction(call->name);
+  Function *calleeF = nullptr;
+  if (!privateSuffix.empty())
+    calleeF = module->getFunction(call->name + privateSuffix);
   if (!calleeF)
+    calleeF = module->getFunction(call->name);
+  if (!calleeF && generics.count(call->name)) {
+    calleeF = instantiate(call, resultType);
+    if (!calleeF)
+      return UndefValue::get(builder->getInt32Ty());
+    // literals take the type of their parameter in the instance
+    for (size_t i = 0; i < argsV.size(); ++i)
+      if (isIntLiteral(call->args[i]))
+        argsV[i] = coerce(
+            argsV[i], instances[calleeF->getName().str()].def->args[i].type);
+  }
+  if (!calleeF) {
+    error = "Unknown function " + call->name;
     return nullptr;
-  return builder->CreateCall(calleeF, argsV);
+  }
+  // a slice or strbuf passed for a pointer, or to the variadic part of a C
+  // function such as printf, is its data pointer; a str is a NUL terminated
+  // one
+  const FunctionAbi *abi = abiOf(calleeF->getName().str());
+  std::vector<Type *> params;
+  if (abi)
+    for (auto &arg : abi->args)
+      params.push_back(arg.type);
+  else
+    params = calleeF->getFunctionType()->params().vec();
+  std::vector<Value *> copies;
+  for (size_t i = 0; i < argsV.size(); ++i) {
+    bool toC = i >= params.size() || params[i]->isPointerTy();
+    if (argsV[i] && argsV[i]->getType() == stringType() && toC) {
+      auto literal = dynamic_cast<ConstString *>(call->args[i]->value);
+      // what C gets is a copy of the bytes, or a literal
+      if (writesThrough(calleeF->getName(), i)) {
+        error = call->name + " writes through argument " +
+                std::to_string(i + 1) +
+                ", a str can't be written to; pass a ch array and make a "
+                "str of it with to_str";
+        return nullptr;
+      }
+      if (calleeF->getName() == "free") {
+        // only the bytes copy(s) took from malloc
+        Value *owned = builder->CreateICmpEQ(
+            builder->CreateAnd(stringTag(argsV[i]), 0x80 | StringOwned),
+            builder->getInt8(0x80 | StringOwned));
+        Value *data = builder->CreateExtractValue(argsV[i], 0);
+        argsV[i] = builder->CreateSelect(
+            owned, data,
+            ConstantPointerNull::get(cast<PointerType>(data->getType())));
+      } else if (literal) {
+        argsV[i] = builder->CreateGlobalStringPtr(literal->getValue());
+      } else {
+        Value *copy;
+        argsV[i] = cString(argsV[i], copy);
+        copies.push_back(copy);
+      }
+      continue;
+    }
+    if (argsV[i] && argsV[i]->getType() == stringBuilderType() && toC)
+      argsV[i] = builder->CreateExtractValue(argsV[i], 0);
+    if (!argsV[i] || !isSlice(argsV[i]->getType()))
+      continue;
+    if (i >= params.size())
+      argsV[i] = builder->CreateExtractValue(argsV[i], 0);
+    else if (params[i]->isPointerTy())
+      argsV[i] = builder->CreatePointerCast(
+          builder->CreateExtractValue(argsV[i], 0), params[i]);
+  }
+  if (abi)
+    return codegenLoweredCall(calleeF, *abi, argsV);
+  CallInst *callInst = builder->CreateCall(calleeF, argsV);
+  callInst->setCallingConv(calleeF->getCallingConv());
+  for (Value *copy : copies)
+    builder->CreateCall(module->getFunction("free"), {copy});
+  return callInst;
 }
 
 void Compiler::codegenVarAssign(VarAssignNode *assign) {
   Value *lhsVal = lookupVar(assign->name);
-  if (lhsVal) {
-    Value *rhs = codegenExpr(assign->value->value);
+  if (lhsVal && !llvm::isa<llvm::AllocaInst>(lhsVal)) {
+    error = "Can't assign to loop variable " + assign->name;
+    return;
+  }
+  if (assign->target) {
+    std::string typeName;
+    Value *address = codegenAddress(assign->target, typeName);
+    if (!address) {
+      if (error.empty())
+        error = "Can't assign to a field of " + assign->name;
+      return;
+    }
+    Value *rhs = coerce(codegenInit(assign->value->value, typeName), typeName);
+    builder->CreateStore(rhs, address);
+  } else if (lhsVal && assign->index && varTypes[lhsVal] == "str") {
+    // other strings may share its bytes
+    error = "Can't assign to a byte of the str " + assign->name +
+            ", strings are immutable";
+  } else if (lhsVal && assign->index) {
+    std::vector<Value *> data;
+    std::string elementType;
+    Value *offset =
+        elementIndex(assign->name, assign->index, data, elementType);
+    if (!offset)
+      return;
+    Value *rhs = coerce(codegenExpr(assign->value->value), elementType);
+    StructInfo *soa = soaElement(varTypes[lhsVal]);
+    if (!soa) {
+      builder->CreateStore(
+          rhs, builder->CreateInBoundsGEP(getLLVMType(elementType), data[0],
+                                          offset, assign->name + ".elem"));
+      return;
+    }
+    if (!rhs || rhs->getType() != soa->type) {
+      error = assign->name + "[i] = ...: expected a " + elementType;
+      return;
+    }
+    // scattered over the columns
+    for (size_t i = 0; i < soa->fields.size(); ++i) {
+      Type *column = getLLVMType(soa->fields[i].type);
+      builder->CreateStore(
+          builder->CreateExtractValue(rhs, soa->elements[i]),
+          builder->CreateInBoundsGEP(column, data[i], offset));
+    }
+  } else if (lhsVal && isArrayType(varTypes[lhsVal]) &&
+             arrayLength(varTypes[lhsVal])) {
+    error = "Can't assign to the array " + assign->name +
+            ", assign its elements";
+  } else if (lhsVal) {
+    Value *rhs = codegenInit(assign->value->value, varTypes[lhsVal]);
+    if (isIntLiteral(assign->value))
+      rhs = coerce(rhs, varTypes[lhsVal]);
     builder->CreateStore(rhs, lhsVal);
   } else if (auto gvar = module->getGlobalVariable(assign->name)) {
     Value *rhs = codegenExpr(assign->value->value);
@@ -576,10 +2571,996 @@ void Compiler::codegenVarAssign(VarAssignNode *assign) {
   }
 }
 
+Value *Compiler::codegenInit(Expression *value, const std::string &typeName) {
+  auto call = dynamic_cast<FunctionCallNode *>(value);
+  if (!call || module->getFunction(call->name) ||
+      module->getFunction(call->name + privateSuffix))
+    return codegenExpr(value);
+  if (generics.count(call->name))
+    return codegenFunctionCall(call, typeName);
+  if (call->name == "alloc" && isArrayType(typeName) && !arrayLength(typeName))
+    return codegenAlloc(call, typeName);
+  if (vectorBuiltins.count(call->name) && isVectorType(typeName))
+    return codegenVectorBuiltin(call, typeName);
+  return codegenExpr(value);
+}
+
+bool Compiler::arrayParts(const std::string &name, std::vector<Value *> &data,
+                          Value *&length, std::string &elementType) {
+  auto alloca = dyn_cast_or_null<AllocaInst>(lookupVar(name));
+  std::string type = alloca ? varTypes[alloca] : "";
+  if (type == "str") {
+    elementType = "ch";
+    data.push_back(stringData(
+        builder->CreateLoad(stringType(), alloca, name), length));
+    return true;
+  }
+  if (!isArrayType(type)) {
+    error = name + " is not an array or a slice";
+    return false;
+  }
+  elementType = elementTypeName(type);
+  StructInfo *soa = soaElement(type);
+  unsigned columns = soa ? soa->fields.size() : 1;
+  auto columnName = [&](unsigned i) {
+    return name + "." + (soa ? soa->fields[i].name : "data");
+  };
+  Type *allocated = alloca->getAllocatedType();
+  if (uint64_t n = arrayLength(type)) {
+    // the data is in this frame, whatever gets it may outlive the frame
+    addressTaken = true;
+    for (unsigned i = 0; i < columns; ++i)
+      data.push_back(
+          soa ? builder->CreateInBoundsGEP(
+                    allocated, alloca,
+                    {builder->getInt32(0), builder->getInt32(i),
+                     builder->getInt64(0)},
+                    columnName(i))
+              : builder->CreateConstInBoundsGEP2_64(allocated, alloca, 0, 0,
+                                                    columnName(i)));
+    length = builder->getInt64(n);
+  } else {
+    Value *slice = builder->CreateLoad(allocated, alloca, name);
+    for (unsigned i = 0; i < columns; ++i)
+      data.push_back(builder->CreateExtractValue(slice, i, columnName(i)));
+    length = builder->CreateExtractValue(slice, columns, name + ".len");
+  }
+  return true;
+}
+
+Value *Compiler::makeSlice(const std::vector<Value *> &data, Value *length) {
+  std::vector<Type *> elements;
+  for (Value *column : data)
+    elements.push_back(column->getType());
+  elements.push_back(builder->getInt64Ty());
+  Value *slice = UndefValue::get(StructType::get(*context, elements));
+  for (unsigned i = 0; i < data.size(); ++i)
+    slice = builder->CreateInsertValue(slice, data[i], i);
+  return builder->CreateInsertValue(slice, length, data.size(), "slice");
+}
+
+Value *Compiler::codegenOffset(Expression *expr) {
+  Value *value = codegenExpr(expr);
+  if (!value || !value->getType()->isIntegerTy()) {
+    error = "An array index must be an integer";
+    return nullptr;
+  }
+  bool isSigned = typeNameOf(expr).rfind("u", 0) != 0;
+  return builder->CreateIntCast(value, builder->getInt64Ty(), isSigned);
+}
+
+Value *Compiler::codegenAlloc(FunctionCallNode *call,
+                              const std::string &sliceType) {
+  Value *count =
+      call->args.size() == 1 ? codegenOffset(call->args[0]->value) : nullptr;
+  if (!count) {
+    error = "alloc takes the number of elements";
+    return UndefValue::get(getLLVMType(sliceType));
+  }
+  // the columns of a #[soa] slice share one block, each starting on a cache
+  // line of its own
+  std::vector<Type *> columns;
+  StructInfo *soa = soaElement(sliceType);
+  if (soa)
+    for (auto &field : soa->fields)
+      columns.push_back(getLLVMType(field.type));
+  else
+    columns.push_back(getLLVMType(elementTypeName(sliceType)));
+  uint64_t align = soa ? 64 : alignOf(columns[0]).value();
+  std::vector<Value *> offsets;
+  Value *bytes = builder->getInt64(0);
+  for (Type *column : columns) {
+    offsets.push_back(bytes);
+    uint64_t size = module->getDataLayout().getTypeAllocSize(column);
+    bytes = builder->CreateAdd(bytes,
+                               builder->CreateMul(count,
+                                                  builder->getInt64(size)));
+    if (soa)
+      bytes = builder->CreateAnd(builder->CreateAdd(bytes,
+                                                    builder->getInt64(63)),
+                                 builder->getInt64(~63ULL));
+  }
+  PointerType *i8ptr = builder->getInt8Ty()->getPointerTo();
+  Value *block;
+  if (align > 16) {
+    // more than malloc guarantees; aligned_alloc wants a multiple of it
+    Value *size = builder->CreateAnd(
+        builder->CreateAdd(bytes, builder->getInt64(align - 1)),
+        builder->getInt64(~(align - 1)));
+    FunctionCallee alignedAlloc = module->getOrInsertFunction(
+        "aligned_alloc",
+        FunctionType::get(i8ptr,
+                          {builder->getInt64Ty(), builder->getInt64Ty()},
+                          false));
+    block = builder->CreateCall(alignedAlloc,
+                                {builder->getInt64(align), size});
+  } else {
+    block = builder->CreateCall(module->getFunction("malloc"), {bytes});
+  }
+  std::vector<Value *> data;
+  for (size_t i = 0; i < columns.size(); ++i)
+    data.push_back(builder->CreatePointerCast(
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), block, offsets[i]),
+        columns[i]->getPointerTo()));
+  return makeSlice(data, count);
+}
+
+Function *Compiler::runtimeFailure(const std::string &name,
+                                   const std::string &format,
+                                   unsigned values) {
+  if (Function *failure = module->getFunction(name))
+    return failure;
+  Type *i64 = builder->getInt64Ty();
+  Function *failure = Function::Create(
+      FunctionType::get(builder->getVoidTy(),
+                        std::vector<Type *>(values, i64), false),
+      Function::InternalLinkage, name, module.get());
+  // out of the way of the code that checks
+  failure->addFnAttr(llvm::Attribute::Cold);
+  failure->addFnAttr(llvm::Attribute::NoInline);
+  failure->addFnAttr(llvm::Attribute::NoReturn);
+  IRBuilder<> b(BasicBlock::Create(*context, "entry", failure));
+  PointerType *i8ptr = b.getInt8Ty()->getPointerTo();
+  // what the program printed so far isn't lost with the abort
+  b.CreateCall(module->getOrInsertFunction(
+                   "fflush", FunctionType::get(b.getInt32Ty(), {i8ptr}, false)),
+               {ConstantPointerNull::get(i8ptr)});
+  FunctionCallee dprintf = module->getOrInsertFunction(
+      "dprintf",
+      FunctionType::get(b.getInt32Ty(), {b.getInt32Ty(), i8ptr}, true));
+  std::vector<Value *> args = {b.getInt32(2), b.CreateGlobalStringPtr(format)};
+  for (auto &arg : failure->args())
+    args.push_back(&arg);
+  b.CreateCall(dprintf, args);
+  b.CreateCall(module->getOrInsertFunction(
+      "abort", FunctionType::get(b.getVoidTy(), false)));
+  b.CreateUnreachable();
+  return failure;
+}
+
+void Compiler::runtimeCheck(Value *holds, Function *failure,
+                            ArrayRef<Value *> values) {
+  Function *function = builder->GetInsertBlock()->getParent();
+  BasicBlock *failBB = BasicBlock::Create(*context, "check.fail", function);
+  BasicBlock *okBB = BasicBlock::Create(*context, "check.ok", function);
+  MDBuilder weights(*context);
+  builder->CreateCondBr(holds, okBB, failBB,
+                        weights.createBranchWeights(2000, 1));
+  builder->SetInsertPoint(failBB);
+  builder->CreateCall(failure, values);
+  builder->CreateUnreachable();
+  builder->SetInsertPoint(okBB);
+}
+
+void Compiler::boundsCheck(Value *inBounds, Value *index, Value *length) {
+  runtimeCheck(inBounds,
+               runtimeFailure("prex.bounds_fail",
+                              "index %ld out of bounds for length %ld\n", 2),
+               {index, length});
+}
+
+bool Compiler::indexInBounds(const std::string &name, Expression *index) {
+  while (auto exprNode = dynamic_cast<ExprNode *>(index))
+    index = exprNode->value;
+  Value *array = lookupVar(name);
+  uint64_t length = arrayLength(varTypes[array]);
+  if (auto constant = dynamic_cast<ConstInt *>(index)) {
+    long long value = constant->getValue();
+    if (value < 0 || (length && (uint64_t)value >= length))
+      error = "Index " + std::to_string(value) + " out of bounds for " +
+              name + " (" + varTypes[array] + ")";
+    return length && value >= 0 && (uint64_t)value < length;
+  }
+  auto id = dynamic_cast<ConstIdentifier *>(index);
+  if (!id)
+    return false;
+  Value *var = lookupVar(id->name);
+  for (auto range = indexRanges.rbegin(); range != indexRanges.rend();
+       ++range)
+    if (range->index == var)
+      return range->array == array ||
+             (!range->array && length && range->bound <= length);
+  return false;
+}
+
+Value *Compiler::elementIndex(const std::string &name, ExprNode *index,
+                              std::vector<Value *> &data,
+                              std::string &elementType) {
+  Value *length;
+  if (!arrayParts(name, data, length, elementType))
+    return nullptr;
+  Value *offset = codegenOffset(index->value);
+  if (!offset)
+    return nullptr;
+  // unsigned, so a negative index is out of bounds as well
+  if (!indexInBounds(name, index))
+    boundsCheck(builder->CreateICmpULT(offset, length, "inbounds"), offset,
+                length);
+  return offset;
+}
+
+Value *Compiler::elementAddress(const std::string &name, ExprNode *index,
+                                std::string &elementType) {
+  std::vector<Value *> data;
+  Value *offset = elementIndex(name, index, data, elementType);
+  if (!offset)
+    return nullptr;
+  return builder->CreateInBoundsGEP(getLLVMType(elementType), data[0], offset,
+                                    name + ".elem");
+}
+
+Value *Compiler::codegenIndex(IndexNode *index) {
+  if (index->end && varTypes[lookupVar(index->name)] == "str")
+    return codegenSubstring(index->name, index->index, index->end);
+  std::string elementType;
+  std::vector<Value *> data;
+  StructInfo *soa = soaElement(varTypes[lookupVar(index->name)]);
+  if (!index->end) {
+    Value *offset = elementIndex(index->name, index->index, data, elementType);
+    if (!offset)
+      return UndefValue::get(builder->getInt32Ty());
+    if (!soa)
+      return builder->CreateLoad(
+          getLLVMType(elementType),
+          builder->CreateInBoundsGEP(getLLVMType(elementType), data[0],
+                                     offset, index->name + ".elem"),
+          index->name + ".elem");
+    // gathered from the columns
+    Value *element = UndefValue::get(soa->type);
+    for (size_t i = 0; i < soa->fields.size(); ++i) {
+      Type *column = getLLVMType(soa->fields[i].type);
+      Value *field = builder->CreateLoad(
+          column, builder->CreateInBoundsGEP(column, data[i], offset),
+          index->name + "." + soa->fields[i].name);
+      element = builder->CreateInsertValue(element, field, soa->elements[i]);
+    }
+    return element;
+  }
+  Value *length;
+  if (!arrayParts(index->name, data, length, elementType))
+    return UndefValue::get(builder->getInt32Ty());
+  Value *start = codegenOffset(index->index->value);
+  Value *end = codegenOffset(index->end->value);
+  if (!start || !end)
+    return UndefValue::get(getLLVMType(elementType + "[]"));
+  boundsCheck(builder->CreateICmpULE(end, length), end, length);
+  boundsCheck(builder->CreateICmpULE(start, end), start, end);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = builder->CreateInBoundsGEP(
+        getLLVMType(soa ? soa->fields[i].type : elementType), data[i], start,
+        index->name + ".data");
+  return makeSlice(data,
+                   builder->CreateSub(end, start, index->name + ".len"));
+}
+
+Value *Compiler::codegenAddress(Expression *expr, std::string &typeName) {
+  while (auto exprNode = dynamic_cast<ExprNode *>(expr))
+    expr = exprNode->value;
+  if (auto id = dynamic_cast<ConstIdentifier *>(expr)) {
+    auto alloca = dyn_cast_or_null<AllocaInst>(lookupVar(id->name));
+    if (alloca)
+      typeName = varTypes[alloca];
+    return alloca;
+  }
+  if (auto index = dynamic_cast<IndexNode *>(expr)) {
+    // an element of a #[soa] array is spread over its columns, the bytes of
+    // an inline str are in a copy of it
+    if (index->end || soaElement(varTypes[lookupVar(index->name)]) ||
+        varTypes[lookupVar(index->name)] == "str")
+      return nullptr;
+    return elementAddress(index->name, index->index, typeName);
+  }
+  auto member = dynamic_cast<MemberNode *>(expr);
+  if (!member)
+    return nullptr;
+  auto index = dynamic_cast<IndexNode *>(member->object->value);
+  StructInfo *soa =
+      index && !index->end ? soaElement(varTypes[lookupVar(index->name)])
+                           : nullptr;
+  if (soa) {
+    // a field of such an element is an element of the field's column
+    int field = fieldIndex(elementTypeName(varTypes[lookupVar(index->name)]),
+                           member->field);
+    std::vector<Value *> data;
+    std::string elementType;
+    Value *offset =
+        field < 0 ? nullptr
+                  : elementIndex(index->name, index->index, data, elementType);
+    if (!offset)
+      return nullptr;
+    typeName = soa->fields[field].type;
+    return builder->CreateInBoundsGEP(getLLVMType(typeName), data[field],
+                                      offset,
+                                      index->name + "." + member->field);
+  }
+  std::string objectType;
+  Value *object = codegenAddress(member->object, objectType);
+  if (!object)
+    return nullptr;
+  int field = fieldIndex(objectType, member->field);
+  if (field < 0)
+    return nullptr;
+  StructInfo *info = structInfo(objectType);
+  typeName = info->fields[field].type;
+  return builder->CreateStructGEP(info->type, object, info->elements[field],
+                                  member->field);
+}
+
+Value *Compiler::codegenMember(MemberNode *member) {
+  std::string typeName;
+  if (Value *address = codegenAddress(member, typeName))
+    return builder->CreateLoad(getLLVMType(typeName), address, member->field);
+  if (!error.empty())
+    return UndefValue::get(builder->getInt32Ty());
+  // a field of a value that isn't in memory, such as what a call returns
+  Value *object = codegenExpr(member->object->value);
+  auto name = object ? structNames.find(object->getType()) : structNames.end();
+  std::string objectType = name != structNames.end() ? name->second : "";
+  int field = fieldIndex(objectType, member->field);
+  if (field < 0)
+    return UndefValue::get(builder->getInt32Ty());
+  return builder->CreateExtractValue(
+      object, structInfo(objectType)->elements[field], member->field);
+}
+
+StructType *Compiler::stringType() {
+  // a literal struct, which LLVM passes in three registers rather than
+  // through memory
+  Type *i64 = builder->getInt64Ty();
+  return StructType::get(*context,
+                         {builder->getInt8Ty()->getPointerTo(), i64, i64});
+}
+
+StructType *Compiler::stringBuilderType() {
+  if (StructType *type = StructType::getTypeByName(*context, "strbuf"))
+    return type;
+  Type *i64 = builder->getInt64Ty();
+  return StructType::create(
+      *context, {builder->getInt8Ty()->getPointerTo(), i64, i64}, "strbuf");
+}
+
+// The inline form needs the 24 bytes of a str to be its three words, which
+// they are with 64 bit pointers; elsewhere every str points at its bytes.
+static bool hasInlineStrings(const DataLayout &layout) {
+  return layout.getPointerSize() == 8;
+}
+
+// The shift that puts the last byte of a str at the bottom of its last
+// word.
+static unsigned tagShift(const DataLayout &layout) {
+  return layout.isLittleEndian() ? 56 : 0;
+}
+
+Constant *Compiler::stringLiteral(const std::string &text) {
+  const DataLayout &layout = module->getDataLayout();
+  Type *i64 = builder->getInt64Ty();
+  if (text.size() > 23 || !hasInlineStrings(layout)) {
+    Constant *bytes = ConstantDataArray::getString(*context, text);
+    auto global = new GlobalVariable(*module, bytes->getType(), true,
+                                     GlobalValue::PrivateLinkage, bytes,
+                                     ".str");
+    global->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    global->setAlignment(Align(1));
+    Constant *zero = ConstantInt::get(i64, 0);
+    uint64_t tag = uint64_t(0x80 | StringTerminated) << tagShift(layout);
+    return ConstantStruct::get(
+        stringType(),
+        {ConstantExpr::getInBoundsGetElementPtr(bytes->getType(), global,
+                                                ArrayRef<Constant *>{zero,
+                                                                     zero}),
+         ConstantInt::get(i64, text.size()), ConstantInt::get(i64, tag)});
+  }
+  // the inline bytes, as the words a str is made of
+  unsigned char bytes[24] = {};
+  std::memcpy(bytes, text.data(), text.size());
+  bytes[23] = 23 - text.size();
+  uint64_t words[3] = {};
+  for (unsigned i = 0; i < 24; ++i)
+    words[i / 8] |= uint64_t(bytes[i])
+                    << (layout.isLittleEndian() ? 8 * (i % 8)
+                                                : 56 - 8 * (i % 8));
+  return ConstantStruct::get(
+      stringType(),
+      {ConstantExpr::getIntToPtr(ConstantInt::get(i64, words[0]),
+                                 builder->getInt8Ty()->getPointerTo()),
+       ConstantInt::get(i64, words[1]), ConstantInt::get(i64, words[2])});
+}
+
+Value *Compiler::makeString(Value *data, Value *length, Value *flags) {
+  Value *tag = builder->CreateShl(
+      builder->CreateZExt(builder->CreateOr(flags, builder->getInt8(0x80)),
+                          builder->getInt64Ty()),
+      tagShift(module->getDataLayout()));
+  Value *str = UndefValue::get(stringType());
+  str = builder->CreateInsertValue(str, data, 0);
+  str = builder->CreateInsertValue(str, length, 1);
+  return builder->CreateInsertValue(str, tag, 2, "str");
+}
+
+Value *Compiler::inlineString(Value *data, Value *length) {
+  AllocaInst *slot = entryAlloca(stringType(), "str.inline");
+  builder->CreateStore(Constant::getNullValue(stringType()), slot);
+  Value *bytes =
+      builder->CreatePointerCast(slot, builder->getInt8Ty()->getPointerTo());
+  builder->CreateMemCpy(bytes, MaybeAlign(1), data, MaybeAlign(1), length);
+  builder->CreateStore(
+      builder->CreateTrunc(builder->CreateSub(builder->getInt64(23), length),
+                           builder->getInt8Ty()),
+      builder->CreateConstInBoundsGEP1_64(builder->getInt8Ty(), bytes, 23));
+  return builder->CreateLoad(stringType(), slot, "str");
+}
+
+Value *Compiler::stringTag(Value *str) {
+  Value *word = builder->CreateExtractValue(str, 2);
+  return builder->CreateTrunc(
+      builder->CreateLShr(word, tagShift(module->getDataLayout())),
+      builder->getInt8Ty(), "str.tag");
+}
+
+Value *Compiler::isInlineString(Value *str) {
+  return builder->CreateICmpSGT(stringTag(str), builder->getInt8(-1),
+                                "str.isinline");
+}
+
+Value *Compiler::stringData(Value *str, Value *&length) {
+  Value *isInline = isInlineString(str);
+  length = builder->CreateSelect(
+      isInline,
+      builder->CreateSub(builder->getInt64(23),
+                         builder->CreateZExt(stringTag(str),
+                                             builder->getInt64Ty())),
+      builder->CreateExtractValue(str, 1), "str.len");
+  AllocaInst *slot = entryAlloca(stringType(), "str.bytes");
+  builder->CreateStore(str, slot);
+  return builder->CreateSelect(
+      isInline,
+      builder->CreatePointerCast(slot, builder->getInt8Ty()->getPointerTo()),
+      builder->CreateExtractValue(str, 0), "str.data");
+}
+
+Value *Compiler::cString(Value *str, Value *&copy) {
+  Value *length;
+  Value *data = stringData(str, length);
+  // C may read the stack slot of an inline one, so no tail calls
+  addressTaken = true;
+  Value *terminated = builder->CreateOr(
+      isInlineString(str),
+      builder->CreateICmpNE(
+          builder->CreateAnd(stringTag(str), StringTerminated),
+          builder->getInt8(0)));
+  Function *function = builder->GetInsertBlock()->getParent();
+  BasicBlock *entryBB = builder->GetInsertBlock();
+  BasicBlock *copyBB = BasicBlock::Create(*context, "cstr.copy", function);
+  BasicBlock *doneBB = BasicBlock::Create(*context, "cstr.done", function);
+  builder->CreateCondBr(terminated, doneBB, copyBB);
+  builder->SetInsertPoint(copyBB);
+  Value *bytes = builder->CreateCall(
+      module->getFunction("malloc"),
+      {builder->CreateAdd(length, builder->getInt64(1))}, "cstr");
+  builder->CreateMemCpy(bytes, MaybeAlign(1), data, MaybeAlign(1), length);
+  builder->CreateStore(
+      builder->getInt8(0),
+      builder->CreateInBoundsGEP(builder->getInt8Ty(), bytes, length));
+  builder->CreateBr(doneBB);
+  builder->SetInsertPoint(doneBB);
+  PHINode *pointer = builder->CreatePHI(data->getType(), 2, "cstr.ptr");
+  pointer->addIncoming(data, entryBB);
+  pointer->addIncoming(bytes, copyBB);
+  PHINode *copied = builder->CreatePHI(data->getType(), 2, "cstr.copied");
+  copied->addIncoming(
+      ConstantPointerNull::get(cast<PointerType>(data->getType())), entryBB);
+  copied->addIncoming(bytes, copyBB);
+  copy = copied;
+  return pointer;
+}
+
+Value *Compiler::codegenStringEquals(Value *l, Value *r) {
+  Value *lLength, *rLength;
+  Value *lData = stringData(l, lLength);
+  Value *rData = stringData(r, rLength);
+  Function *function = builder->GetInsertBlock()->getParent();
+  BasicBlock *entryBB = builder->GetInsertBlock();
+  BasicBlock *bytesBB = BasicBlock::Create(*context, "streq.bytes", function);
+  BasicBlock *mergeBB = BasicBlock::Create(*context, "streq.end", function);
+  // the bytes are only compared when the lengths match
+  builder->CreateCondBr(builder->CreateICmpEQ(lLength, rLength), bytesBB,
+                        mergeBB);
+  builder->SetInsertPoint(bytesBB);
+  Value *cmp = builder->CreateCall(module->getFunction("memcmp"),
+                                   {lData, rData, lLength}, "memcmpcall");
+  Value *same = builder->CreateICmpEQ(cmp, builder->getInt32(0));
+  builder->CreateBr(mergeBB);
+  builder->SetInsertPoint(mergeBB);
+  PHINode *equal = builder->CreatePHI(builder->getInt1Ty(), 2, "eqstr");
+  equal->addIncoming(builder->getFalse(), entryBB);
+  equal->addIncoming(same, bytesBB);
+  return equal;
+}
+
+Value *Compiler::codegenSubstring(const std::string &name, ExprNode *start,
+                                  ExprNode *end) {
+  Value *str = builder->CreateLoad(stringType(), lookupVar(name), name);
+  Value *length;
+  Value *data = stringData(str, length);
+  Value *from = codegenOffset(start->value);
+  Value *to = codegenOffset(end->value);
+  if (!from || !to)
+    return UndefValue::get(stringType());
+  boundsCheck(builder->CreateICmpULE(to, length), to, length);
+  boundsCheck(builder->CreateICmpULE(from, to), from, to);
+  Value *bytes =
+      builder->CreateInBoundsGEP(builder->getInt8Ty(), data, from,
+                                 name + ".data");
+  Value *size = builder->CreateSub(to, from, name + ".len");
+  // a substring of an inline str can't point into it, the bytes are copied
+  // to an inline one; any other points into the same bytes
+  Function *function = builder->GetInsertBlock()->getParent();
+  BasicBlock *inlineBB =
+      BasicBlock::Create(*context, "substr.inline", function);
+  BasicBlock *pointBB = BasicBlock::Create(*context, "substr.point", function);
+  BasicBlock *mergeBB = BasicBlock::Create(*context, "substr.end", function);
+  builder->CreateCondBr(isInlineString(str), inlineBB, pointBB);
+  builder->SetInsertPoint(inlineBB);
+  Value *copied = inlineString(bytes, size);
+  builder->CreateBr(mergeBB);
+  builder->SetInsertPoint(pointBB);
+  // still terminated when it ends where `str` does
+  Value *flags = builder->CreateSelect(
+      builder->CreateICmpEQ(to, length),
+      builder->CreateAnd(stringTag(str), StringTerminated),
+      builder->getInt8(0));
+  Value *pointing = makeString(bytes, size, flags);
+  builder->CreateBr(mergeBB);
+  builder->SetInsertPoint(mergeBB);
+  PHINode *substring = builder->CreatePHI(stringType(), 2, "substr");
+  substring->addIncoming(copied, inlineBB);
+  substring->addIncoming(pointing, pointBB);
+  return substring;
+}
+
+Function *Compiler::stringBuilderGrow() {
+  if (Function *grow = module->getFunction("prex.strbuf_grow"))
+    return grow;
+  StructType *type = stringBuilderType();
+  Type *i64 = builder->getInt64Ty();
+  Function *grow = Function::Create(
+      FunctionType::get(builder->getVoidTy(), {type->getPointerTo(), i64},
+                        false),
+      Function::InternalLinkage, "prex.strbuf_grow", module.get());
+  // appending is inlined, growing happens a logarithmic number of times
+  grow->addFnAttr(llvm::Attribute::NoInline);
+  IRBuilder<> b(BasicBlock::Create(*context, "entry", grow));
+  Value *buffer = grow->getArg(0);
+  Value *needed = grow->getArg(1);
+  Value *dataPtr = b.CreateStructGEP(type, buffer, 0);
+  Value *capacityPtr = b.CreateStructGEP(type, buffer, 2);
+  // doubled, so n appends copy O(n) bytes in all
+  Value *capacity = b.CreateShl(b.CreateLoad(i64, capacityPtr), 1);
+  capacity = b.CreateSelect(b.CreateICmpUGT(needed, capacity), needed,
+                            capacity);
+  capacity = b.CreateSelect(b.CreateICmpULT(capacity, b.getInt64(32)),
+                            b.getInt64(32), capacity);
+  Value *data = b.CreateCall(
+      module->getFunction("realloc"),
+      {b.CreateLoad(b.getInt8Ty()->getPointerTo(), dataPtr), capacity});
+  b.CreateStore(data, dataPtr);
+  b.CreateStore(capacity, capacityPtr);
+  b.CreateRetVoid();
+  return grow;
+}
+
+Value *Compiler::arrayString(ExprNode *array) {
+  auto id = dynamic_cast<ConstIdentifier *>(array->value);
+  std::vector<Value *> data;
+  Value *length;
+  std::string elementType;
+  if (!id || !arrayParts(id->name, data, length, elementType))
+    return UndefValue::get(stringType());
+  // up to the first NUL, or all of it when C didn't leave one
+  PointerType *i8ptr = builder->getInt8Ty()->getPointerTo();
+  FunctionCallee strnlen = module->getOrInsertFunction(
+      "strnlen", FunctionType::get(builder->getInt64Ty(),
+                                   {i8ptr, builder->getInt64Ty()}, false));
+  Value *bytes = builder->CreatePointerCast(data[0], i8ptr);
+  Value *used = builder->CreateCall(strnlen, {bytes, length}, "str.len");
+  Value *flags = builder->CreateSelect(builder->CreateICmpULT(used, length),
+                                       builder->getInt8(StringTerminated),
+                                       builder->getInt8(0));
+  return makeString(bytes, used, flags);
+}
+
+Value *Compiler::codegenStringBuiltin(FunctionCallNode *call) {
+  const std::string &name = call->name;
+  unsigned arity = stringBuiltins.at(name);
+  if (call->args.size() != arity) {
+    error = name + " takes " + std::to_string(arity) + " argument" +
+            (arity > 1 ? "s" : "");
+    return UndefValue::get(stringType());
+  }
+  Function *function = builder->GetInsertBlock()->getParent();
+  PointerType *i8ptr = builder->getInt8Ty()->getPointerTo();
+  if (name == "copy") {
+    Value *str = codegenExpr(call->args[0]->value);
+    if (!str || str->getType() != stringType()) {
+      error = "copy expects a str";
+      return UndefValue::get(stringType());
+    }
+    Value *length;
+    Value *data = stringData(str, length);
+    BasicBlock *inlineBB =
+        BasicBlock::Create(*context, "copy.inline", function);
+    BasicBlock *heapBB = BasicBlock::Create(*context, "copy.heap", function);
+    BasicBlock *mergeBB = BasicBlock::Create(*context, "copy.end", function);
+    // up to 23 bytes go inline, without an allocation
+    Value *fits = hasInlineStrings(module->getDataLayout())
+                      ? builder->CreateICmpULE(length, builder->getInt64(23))
+                      : builder->getFalse();
+    builder->CreateCondBr(fits, inlineBB, heapBB);
+    builder->SetInsertPoint(inlineBB);
+    Value *small = inlineString(data, length);
+    builder->CreateBr(mergeBB);
+    builder->SetInsertPoint(heapBB);
+    Value *bytes = builder->CreateCall(
+        module->getFunction("malloc"),
+        {builder->CreateAdd(length, builder->getInt64(1))}, "copy");
+    builder->CreateMemCpy(bytes, MaybeAlign(1), data, MaybeAlign(1), length);
+    builder->CreateStore(
+        builder->getInt8(0),
+        builder->CreateInBoundsGEP(builder->getInt8Ty(), bytes, length));
+    Value *large = makeString(
+        bytes, length, builder->getInt8(StringTerminated | StringOwned));
+    builder->CreateBr(mergeBB);
+    builder->SetInsertPoint(mergeBB);
+    PHINode *result = builder->CreatePHI(stringType(), 2, "copy");
+    result->addIncoming(small, inlineBB);
+    result->addIncoming(large, heapBB);
+    return result;
+  }
+
+  // to_str(b) and append(b, x) work on a strbuf variable
+  std::string typeName;
+  Value *buffer = codegenAddress(call->args[0], typeName);
+  if (name == "to_str" && buffer && isArrayType(typeName) &&
+      elementTypeName(typeName) == "ch")
+    return arrayString(call->args[0]);
+  if (!buffer || typeName != "strbuf") {
+    error = name + " expects a strbuf variable";
+    return UndefValue::get(stringType());
+  }
+  StructType *type = stringBuilderType();
+  if (name == "to_str") {
+    Value *value = builder->CreateLoad(type, buffer);
+    Value *data = builder->CreateExtractValue(value, 0);
+    // there's nothing to point at before the first append
+    Value *flags = builder->CreateSelect(
+        builder->CreateIsNotNull(data), builder->getInt8(StringTerminated),
+        builder->getInt8(0));
+    return makeString(data, builder->CreateExtractValue(value, 1), flags);
+  }
+
+  Value *value = codegenExpr(call->args[1]->value);
+  Value *data = nullptr, *length = nullptr;
+  if (value && value->getType() == stringType()) {
+    data = stringData(value, length);
+  } else if (value && value->getType()->isIntegerTy(8)) {
+    length = builder->getInt64(1);
+  } else {
+    error = "append expects a str or a ch to append";
+    return UndefValue::get(builder->getInt64Ty());
+  }
+  Value *dataPtr = builder->CreateStructGEP(type, buffer, 0);
+  Value *lengthPtr = builder->CreateStructGEP(type, buffer, 1);
+  Value *capacityPtr = builder->CreateStructGEP(type, buffer, 2);
+  Value *used = builder->CreateLoad(builder->getInt64Ty(), lengthPtr);
+  Value *grown = builder->CreateAdd(used, length, "strbuf.len");
+  // with room for the terminator
+  Value *needed = builder->CreateAdd(grown, builder->getInt64(1));
+  BasicBlock *growBB = BasicBlock::Create(*context, "strbuf.grow", function);
+  BasicBlock *appendBB =
+      BasicBlock::Create(*context, "strbuf.append", function);
+  MDBuilder weights(*context);
+  builder->CreateCondBr(
+      builder->CreateICmpUGT(
+          needed, builder->CreateLoad(builder->getInt64Ty(), capacityPtr)),
+      growBB, appendBB, weights.createBranchWeights(1, 2000));
+  builder->SetInsertPoint(growBB);
+  builder->CreateCall(stringBuilderGrow(), {buffer, needed});
+  builder->CreateBr(appendBB);
+  builder->SetInsertPoint(appendBB);
+  Value *bytes = builder->CreateLoad(i8ptr, dataPtr, "strbuf.data");
+  Value *end = builder->CreateInBoundsGEP(builder->getInt8Ty(), bytes, used);
+  if (data)
+    builder->CreateMemCpy(end, MaybeAlign(1), data, MaybeAlign(1), length);
+  else
+    builder->CreateStore(value, end);
+  builder->CreateStore(
+      builder->getInt8(0),
+      builder->CreateInBoundsGEP(builder->getInt8Ty(), bytes, grown));
+  builder->CreateStore(grown, lengthPtr);
+  return grown;
+}
+
+void Compiler::codegenStringMatch(Value *data, const std::string &literal,
+                                  BasicBlock *match, BasicBlock *mismatch) {
+  if (literal.empty()) {
+    builder->CreateBr(match);
+    return;
+  }
+  // memcmp of a known size compared to 0 is expanded into a few loads of
+  // up to 8 (or 16, 32) bytes at -O1 and up
+  Value *cmp = builder->CreateCall(
+      module->getFunction("memcmp"),
+      {data, builder->CreateGlobalStringPtr(literal),
+       builder->getInt64(literal.size())},
+      "memcmpcall");
+  builder->CreateCondBr(builder->CreateICmpEQ(cmp, builder->getInt32(0)),
+                        match, mismatch);
+}
+
+Value *Compiler::codegenStringEquals(Value *str, const std::string &literal) {
+  Function *function = builder->GetInsertBlock()->getParent();
+  BasicBlock *bytesBB = BasicBlock::Create(*context, "streq.bytes", function);
+  BasicBlock *matchBB = BasicBlock::Create(*context, "streq.match", function);
+  BasicBlock *mismatchBB =
+      BasicBlock::Create(*context, "streq.mismatch", function);
+  BasicBlock *mergeBB = BasicBlock::Create(*context, "streq.end", function);
+  Value *length;
+  Value *data = stringData(str, length);
+  // the length of a literal is known, a mismatch in length costs one compare
+  builder->CreateCondBr(
+      builder->CreateICmpEQ(length, builder->getInt64(literal.size())),
+      bytesBB, mismatchBB);
+  builder->SetInsertPoint(bytesBB);
+  codegenStringMatch(data, literal, matchBB, mismatchBB);
+  builder->SetInsertPoint(matchBB);
+  builder->CreateBr(mergeBB);
+  builder->SetInsertPoint(mismatchBB);
+  builder->CreateBr(mergeBB);
+  builder->SetInsertPoint(mergeBB);
+  PHINode *equal = builder->CreatePHI(builder->getInt1Ty(), 2, "eqstr");
+  equal->addIncoming(builder->getTrue(), matchBB);
+  equal->addIncoming(builder->getFalse(), mismatchBB);
+  return equal;
+}
+
+// Integer value of a match pattern, `5` or `-5`.
+static bool integerLiteral(Expression *pattern, long long &value) {
+  if (auto literal = dynamic_cast<ConstInt *>(pattern)) {
+    value = literal->getValue();
+    return true;
+  }
+  auto negative = dynamic_cast<UnaryOpNode *>(pattern);
+  if (negative && negative->op == "-" && negative->expr)
+    if (auto literal = dynamic_cast<ConstInt *>(negative->expr->value)) {
+      value = -literal->getValue();
+      return true;
+    }
+  return false;
+}
+
+// Whether a literal is a value of `type`; bool counts as unsigned.
+static bool fitsInteger(long long value, IntegerType *type,
+                        const std::string &typeName) {
+  unsigned bits = type->getBitWidth();
+  if (isUnsignedType(typeName) || bits == 1)
+    return value >= 0 && (bits >= 64 || value < (1LL << bits));
+  return bits >= 64 || (value >= -(1LL << (bits - 1)) &&
+                        value < (1LL << (bits - 1)));
+}
+
+static Expression *unwrap(Expression *expr) {
+  while (auto node = dynamic_cast<ExprNode *>(expr))
+    expr = node->value;
+  return expr;
+}
+
+// Adds the literals of `x == A`, `A == x` or `x == A || x == B ...` to
+// `patterns`; false when `condition` is anything else.
+static bool equalityPatterns(Expression *condition, std::string &subject,
+                             std::vector<Expression *> &patterns) {
+  auto cmp = dynamic_cast<BinOpNode *>(unwrap(condition));
+  if (!cmp)
+    return false;
+  if (cmp->op == "||")
+    return equalityPatterns(cmp->left, subject, patterns) &&
+           equalityPatterns(cmp->right, subject, patterns);
+  if (cmp->op != "==")
+    return false;
+  Expression *left = unwrap(cmp->left);
+  Expression *right = unwrap(cmp->right);
+  if (!dynamic_cast<ConstIdentifier *>(left))
+    std::swap(left, right);
+  auto id = dynamic_cast<ConstIdentifier *>(left);
+  long long value;
+  if (!id || (!dynamic_cast<ConstString *>(right) &&
+              !integerLiteral(right, value)))
+    return false;
+  if (!subject.empty() && id->name != subject)
+    return false;
+  subject = id->name;
+  patterns.push_back(right);
+  return true;
+}
+
+MatchNode *Compiler::chainAsMatch(IfNode *ifNode) {
+  std::string subject;
+  std::vector<MatchArm> arms;
+  BodyNode *otherwise = nullptr;
+  size_t strings = 0, patterns = 0;
+  for (IfNode *arm = ifNode; arm; arm = arm->elseIf) {
+    // a switch would drop the branch weights of likely/unlikely
+    if (expectCall(arm->condition->value))
+      return nullptr;
+    MatchArm matchArm;
+    if (!equalityPatterns(arm->condition, subject, matchArm.patterns))
+      return nullptr;
+    for (auto pattern : matchArm.patterns)
+      strings += dynamic_cast<ConstString *>(pattern) != nullptr;
+    patterns += matchArm.patterns.size();
+    matchArm.body = arm->body;
+    arms.push_back(matchArm);
+    otherwise = arm->elseBody;
+  }
+  // two compares are as cheap as a switch
+  if (arms.size() < 3)
+    return nullptr;
+  // loading a variable has no side effects, so testing it once instead of
+  // once per arm changes nothing; its type has to fit the literals though
+  Type *type = nullptr;
+  Value *variable = lookupVar(subject);
+  if (auto alloca = llvm::dyn_cast_or_null<AllocaInst>(variable))
+    type = alloca->getAllocatedType();
+  else if (variable)
+    type = variable->getType();
+  else if (auto global = module->getGlobalVariable(subject))
+    type = global->getValueType();
+  bool fits = strings == patterns ? type == stringType()
+                                  : strings == 0 && type && type->isIntegerTy();
+  if (!fits)
+    return nullptr;
+  // a literal out of the variable's range never compares equal, a case
+  // label would be truncated into one that does
+  if (strings == 0) {
+    auto it = varTypes.find(variable);
+    std::string typeName = it != varTypes.end() ? it->second : "";
+    for (auto &arm : arms)
+      for (auto pattern : arm.patterns) {
+        long long value;
+        integerLiteral(pattern, value);
+        if (!fitsInteger(value, llvm::cast<IntegerType>(type), typeName))
+          return nullptr;
+      }
+  }
+  auto match = new MatchNode(new ExprNode(new ConstIdentifier(subject)));
+  match->line = ifNode->line;
+  match->col = ifNode->col;
+  match->arms = arms;
+  match->otherwise = otherwise;
+  return match;
+}
+
+void Compiler::codegenMatch(MatchNode *match) {
+  Value *subject = codegenExpr(match->subject->value);
+  Function *function = builder->GetInsertBlock()->getParent();
+  BasicBlock *mergeBB = BasicBlock::Create(*context, "match.end", function);
+  BasicBlock *otherwiseBB =
+      match->otherwise ? BasicBlock::Create(*context, "match.else", function)
+                       : mergeBB;
+  std::vector<BasicBlock *> bodies;
+  for (size_t i = 0; i < match->arms.size(); ++i)
+    bodies.push_back(BasicBlock::Create(*context, "match.arm", function));
+
+  if (subject->getType() == stringType()) {
+    // a switch on the length, then the literals of that length, in arm
+    // order so the first of two equal literals wins
+    std::map<size_t, std::vector<std::pair<std::string, size_t>>> byLength;
+    for (size_t i = 0; i < match->arms.size(); ++i)
+      for (auto pattern : match->arms[i].patterns) {
+        auto literal = dynamic_cast<ConstString *>(pattern);
+        if (!literal) {
+          error = "Integer pattern in a match on a string";
+          return;
+        }
+        byLength[literal->getValue().size()].push_back(
+            {literal->getValue(), i});
+      }
+    Value *length;
+    Value *data = stringData(subject, length);
+    SwitchInst *dispatch =
+        builder->CreateSwitch(length, otherwiseBB, byLength.size());
+    for (auto &[size, candidates] : byLength) {
+      BasicBlock *caseBB = BasicBlock::Create(*context, "str.case", function);
+      dispatch->addCase(builder->getInt64(size), caseBB);
+      builder->SetInsertPoint(caseBB);
+      for (size_t k = 0; k < candidates.size(); ++k) {
+        BasicBlock *nextBB =
+            k + 1 < candidates.size()
+                ? BasicBlock::Create(*context, "str.case.next", function)
+                : otherwiseBB;
+        codegenStringMatch(data, candidates[k].first,
+                           bodies[candidates[k].second], nextBB);
+        if (nextBB != otherwiseBB)
+          builder->SetInsertPoint(nextBB);
+      }
+    }
+  } else if (auto type = llvm::dyn_cast<IntegerType>(subject->getType())) {
+    // dense cases become a jump table, sparse ones a binary search
+    SwitchInst *dispatch =
+        builder->CreateSwitch(subject, otherwiseBB, bodies.size());
+    std::string typeName = typeNameOf(match->subject->value);
+    std::set<uint64_t> seen;
+    for (size_t i = 0; i < match->arms.size(); ++i)
+      for (auto pattern : match->arms[i].patterns) {
+        long long value;
+        if (!integerLiteral(pattern, value)) {
+          error = "String pattern in a match on an integer";
+          return;
+        }
+        if (!fitsInteger(value, type, typeName)) {
+          error = "Pattern " + std::to_string(value) + " doesn't fit the " +
+                  (typeName.empty() ? "integer" : typeName) +
+                  " subject of match";
+          return;
+        }
+        auto constant = ConstantInt::get(type, value, /*IsSigned=*/true);
+        if (seen.insert(constant->getZExtValue()).second)
+          dispatch->addCase(constant, bodies[i]);
+      }
+  } else {
+    error = "Can only match on integers and strings";
+    return;
+  }
+
+  for (size_t i = 0; i < match->arms.size(); ++i) {
+    builder->SetInsertPoint(bodies[i]);
+    enterScope();
+    codegenBody(match->arms[i].body);
+    exitScope();
+    if (!builder->GetInsertBlock()->getTerminator())
+      builder->CreateBr(mergeBB);
+  }
+  if (match->otherwise) {
+    builder->SetInsertPoint(otherwiseBB);
+    enterScope();
+    codegenBody(match->otherwise);
+    exitScope();
+    if (!builder->GetInsertBlock()->getTerminator())
+      builder->CreateBr(mergeBB);
+  }
+  builder->SetInsertPoint(mergeBB);
+}
+
 void Compiler::codegenIf(IfNode *ifNode) {
-  llvm::Value *condValue = codegenExpr(ifNode->condition->value);
-  condValue = builder->CreateICmpNE(
-      condValue, llvm::ConstantInt::get(condValue->getType(), 0), "ifcond");
+  if (ifNode->elseIf)
+    if (MatchNode *match = chainAsMatch(ifNode)) {
+      codegenMatch(match);
+      delete match->subject->value;
+      delete match->subject;
+      delete match;
+      return;
+    }
+  llvm::MDNode *weights;
+  llvm::Value *condValue = codegenCondition(ifNode->condition, weights);
 
   llvm::Function *function = builder->GetInsertBlock()->getParent();
   llvm::BasicBlock *thenBB =
@@ -590,34 +3571,17 @@ void Compiler::codegenIf(IfNode *ifNode) {
 
   if (ifNode->elseIf || ifNode->elseBody) {
     elseBB = llvm::BasicBlock::Create(*context, "else", function);
-    builder->CreateCondBr(condValue, thenBB, elseBB);
+    builder->CreateCondBr(condValue, thenBB, elseBB, weights);
   } else {
-    builder->CreateCondBr(condValue, thenBB, mergeBB);
+    builder->CreateCondBr(condValue, thenBB, mergeBB, weights);
   }
 
   // Emit then block
   builder->SetInsertPoint(thenBB);
   enterScope();
-  for (auto node : ifNode->body->nodes) {
-    if (auto var = dynamic_cast<VarNode *>(node)) {
-      codegenVar(var);
-    } else if (auto assign = dynamic_cast<VarAssignNode *>(node)) {
-      codegenVarAssign(assign);
-    } else if (auto exprStmt = dynamic_cast<ExprNode *>(node)) {
-      codegenExpr(exprStmt->value);
-    } else if (auto ret = dynamic_cast<RetNode *>(node)) {
-      if (ret->expr) {
-        llvm::Value *retVal = codegenExpr(ret->expr->value);
-        builder->CreateRet(retVal);
-      }
-    } else if (auto innerIf = dynamic_cast<IfNode *>(node)) {
-      codegenIf(innerIf);
-    } else if (auto loop = dynamic_cast<LoopNode *>(node)) {
-      codegenLoop(loop);
-    }
-  }
+  codegenBody(ifNode->body);
   exitScope();
-  if (!thenBB->getTerminator())
+  if (!builder->GetInsertBlock()->getTerminator())
     builder->CreateBr(mergeBB);
 
   // Emit else/else if block
@@ -630,25 +3594,7 @@ void Compiler::codegenIf(IfNode *ifNode) {
       if (!builder->GetInsertBlock()->getTerminator())
         builder->CreateBr(mergeBB);
     } else if (ifNode->elseBody) {
-      for (auto node : ifNode->elseBody->nodes) {
-        if (auto var = dynamic_cast<VarNode *>(node)) {
-          codegenVar(var);
-        } else if (auto assign = dynamic_cast<VarAssignNode *>(node)) {
-          codegenVarAssign(assign);
-        } else if (auto exprStmt = dynamic_cast<ExprNode *>(node)) {
-          codegenExpr(exprStmt->value);
-        } else if (auto ret = dynamic_cast<RetNode *>(node)) {
-          if (ret->expr) {
-            llvm::Value *retVal = codegenExpr(ret->expr->value);
-            builder->CreateRet(retVal);
-          }
-        } else if (auto innerIf = dynamic_cast<IfNode *>(node)) {
-          codegenIf(innerIf);
-        } else if (auto loop = dynamic_cast<LoopNode *>(node)) {
-          codegenLoop(loop);
-        }
-      }
-
+      codegenBody(ifNode->elseBody);
       if (!builder->GetInsertBlock()->getTerminator())
         builder->CreateBr(mergeBB);
     } else {
@@ -661,6 +3607,346 @@ void Compiler::codegenIf(IfNode *ifNode) {
   builder->SetInsertPoint(mergeBB);
 }
 
+void Compiler::codegenBecome(RetNode *ret) {
+  auto callNode = static_cast<FunctionCallNode *>(ret->expr->value);
+  Function *caller = builder->GetInsertBlock()->getParent();
+  std::string where = "become " + callNode->name + " in " +
+                      caller->getName().str() + ": ";
+  // a lowered call isn't a call of the same signature anymore
+  if (currentAbi || abiOf(callNode->name + privateSuffix) ||
+      abiOf(callNode->name)) {
+    error = where + "structs can't be passed or returned through become";
+    return;
+  }
+  // the callee would run after this frame, and the array in it, is gone
+  for (ExprNode *arg : callNode->args) {
+    std::string name;
+    if (auto id = dynamic_cast<ConstIdentifier *>(arg->value))
+      name = id->name;
+    else if (auto index = dynamic_cast<IndexNode *>(arg->value))
+      name = index->end ? index->name : "";
+    auto alloca = dyn_cast_or_null<AllocaInst>(lookupVar(name));
+    if (alloca && isArrayType(varTypes[alloca]) &&
+        arrayLength(varTypes[alloca])) {
+      error = where + name + " is an array on the stack of the caller";
+      return;
+    }
+  }
+  auto call = llvm::dyn_cast_or_null<CallInst>(codegenExpr(callNode));
+  if (!call) {
+    error = where + "unknown function";
+    return;
+  }
+  // what musttail requires of the two functions
+  Function *callee = call->getCalledFunction();
+  if (callee->getFunctionType() != caller->getFunctionType()) {
+    error = where + "the callee must take the same parameter types and "
+                    "return the same type as the caller";
+    return;
+  }
+  if (callee->getCallingConv() != caller->getCallingConv()) {
+    error = where + "can't tail call between a pub and a private function, "
+                    "they use different calling conventions";
+    return;
+  }
+  call->setTailCallKind(CallInst::TCK_MustTail);
+  mustTailCalls.push_back(call);
+  if (call->getType()->isVoidTy())
+    builder->CreateRetVoid();
+  else
+    builder->CreateRet(call);
+}
+
+void Compiler::codegenStmt(Node *node) {
+  setLocation(node);
+  if (auto var = dynamic_cast<VarNode *>(node)) {
+    codegenVar(var);
+  } else if (auto assign = dynamic_cast<VarAssignNode *>(node)) {
+    codegenVarAssign(assign);
+  } else if (auto exprStmt = dynamic_cast<ExprNode *>(node)) {
+    codegenExpr(exprStmt->value);
+  } else if (auto ret = dynamic_cast<RetNode *>(node)) {
+    if (ret->become) {
+      codegenBecome(ret);
+    } else if (ret->expr) {
+      llvm::Value *retVal = codegenExpr(ret->expr->value);
+      // the error is reported once the unit is done
+      if (!retVal)
+        return;
+      auto call = llvm::dyn_cast<llvm::CallInst>(retVal);
+      if (call && dynamic_cast<FunctionCallNode *>(ret->expr->value) &&
+          !call->getCalledFunction()->isIntrinsic())
+        tailCalls.push_back(call);
+      Type *retType = builder->GetInsertBlock()->getParent()->getReturnType();
+      if (isIntLiteral(ret->expr) && retType->isIntegerTy())
+        retVal = builder->CreateIntCast(retVal, retType, true);
+      emitReturn(retVal);
+    }
+  } else if (auto ifNode = dynamic_cast<IfNode *>(node)) {
+    codegenIf(ifNode);
+  } else if (auto loop = dynamic_cast<LoopNode *>(node)) {
+    codegenLoop(loop);
+  } else if (auto forNode = dynamic_cast<ForNode *>(node)) {
+    codegenFor(forNode);
+  } else if (auto match = dynamic_cast<MatchNode *>(node)) {
+    codegenMatch(match);
+  }
+}
+
+void Compiler::codegenBody(BodyNode *body) {
+  for (auto node : body->nodes) {
+    // anything after a ret is unreachable
+    if (builder->GetInsertBlock()->getTerminator())
+      break;
+    codegenStmt(node);
+  }
+}
+
+llvm::Value *Compiler::coerce(llvm::Value *value,
+                              const std::string &typeName) {
+  llvm::Type *type = getLLVMType(typeName);
+  if (!value || value->getType() == type || !value->getType()->isIntegerTy() ||
+      !type->isIntegerTy())
+    return value;
+  return builder->CreateIntCast(value, type, typeName[0] != 'u');
+}
+
+llvm::MDNode *Compiler::loopMetadata(const std::vector<::Attribute> &attributes,
+                                     bool mustProgress) {
+  std::vector<llvm::Metadata *> operands = {nullptr}; // the loop id itself
+  // where the loop starts, for remarks about it
+  if (auto location = builder->getCurrentDebugLocation())
+    operands.push_back(location.get());
+  auto hint = [&](const char *name, llvm::Constant *value = nullptr) {
+    std::vector<llvm::Metadata *> hint = {MDString::get(*context, name)};
+    if (value)
+      hint.push_back(ConstantAsMetadata::get(value));
+    operands.push_back(MDNode::get(*context, hint));
+  };
+  if (mustProgress)
+    hint("llvm.loop.mustprogress");
+  for (auto &attribute : attributes) {
+    int count = attribute.args.empty()
+                    ? 0
+                    : std::atoi(attribute.args[0].c_str());
+    if (attribute.name == "unroll") {
+      if (count == 0)
+        hint("llvm.loop.unroll.enable");
+      else if (count == 1)
+        hint("llvm.loop.unroll.disable");
+      else
+        hint("llvm.loop.unroll.count", builder->getInt32(count));
+    } else if (attribute.name == "vectorize") {
+      hint("llvm.loop.vectorize.enable", builder->getTrue());
+      if (count)
+        hint("llvm.loop.vectorize.width", builder->getInt32(count));
+    } else if (attribute.name == "no_vectorize") {
+      // what clang emits for vectorize(disable)
+      hint("llvm.loop.vectorize.width", builder->getInt32(1));
+    }
+  }
+  if (operands.size() == 1)
+    return nullptr;
+  MDNode *loopId = MDNode::getDistinct(*context, operands);
+  loopId->replaceOperandWith(0, loopId);
+  return loopId;
+}
+
+static bool writesVariable(Node *node, const std::string &name);
+static bool writesVariable(Expression *expr, const std::string &name);
+
+static bool writesVariable(ExprNode *expr, const std::string &name) {
+  return expr && writesVariable(expr->value, name);
+}
+
+// Whether `expr` assigns to the variable `name` or takes its address.
+static bool writesVariable(Expression *expr, const std::string &name) {
+  if (auto node = dynamic_cast<ExprNode *>(expr))
+    return writesVariable(node->value, name);
+  if (auto binop = dynamic_cast<BinOpNode *>(expr)) {
+    auto left = dynamic_cast<ConstIdentifier *>(binop->left->value);
+    return (binop->op == "=" && left && left->name == name) ||
+           writesVariable(binop->left->value, name) ||
+           writesVariable(binop->right->value, name);
+  }
+  if (auto unop = dynamic_cast<UnaryOpNode *>(expr)) {
+    auto operand = dynamic_cast<ConstIdentifier *>(unop->expr->value);
+    return (unop->op == "&" && operand && operand->name == name) ||
+           writesVariable(unop->expr->value, name);
+  }
+  if (auto call = dynamic_cast<FunctionCallNode *>(expr)) {
+    for (auto arg : call->args)
+      if (writesVariable(arg->value, name))
+        return true;
+    return false;
+  }
+  if (auto index = dynamic_cast<IndexNode *>(expr))
+    return writesVariable(index->index, name) ||
+           (index->end && writesVariable(index->end, name));
+  if (auto member = dynamic_cast<MemberNode *>(expr))
+    return writesVariable(member->object, name);
+  return false;
+}
+
+static bool writesVariable(Node *node, const std::string &name) {
+  if (!node)
+    return false;
+  if (auto expr = dynamic_cast<ExprNode *>(node))
+    return writesVariable(expr->value, name);
+  if (auto body = dynamic_cast<BodyNode *>(node)) {
+    for (auto child : body->nodes)
+      if (writesVariable(child, name))
+        return true;
+    return false;
+  }
+  if (auto var = dynamic_cast<VarNode *>(node))
+    return var->name == name || writesVariable(var->value, name);
+  if (auto assign = dynamic_cast<VarAssignNode *>(node))
+    return (assign->name == name && !assign->index && !assign->target) ||
+           writesVariable(assign->target, name) ||
+           writesVariable(assign->index, name) ||
+           writesVariable(assign->value, name);
+  if (auto ret = dynamic_cast<RetNode *>(node))
+    return writesVariable(ret->expr, name);
+  if (auto ifNode = dynamic_cast<IfNode *>(node))
+    return writesVariable(ifNode->condition, name) ||
+           writesVariable(ifNode->body, name) ||
+           writesVariable(ifNode->elseIf, name) ||
+           writesVariable(ifNode->elseBody, name);
+  if (auto loop = dynamic_cast<LoopNode *>(node))
+    return writesVariable(loop->condition, name) ||
+           writesVariable(loop->body, name);
+  if (auto loop = dynamic_cast<ForNode *>(node))
+    return writesVariable(loop->start, name) ||
+           writesVariable(loop->end, name) ||
+           writesVariable(loop->step, name) ||
+           writesVariable(loop->body, name);
+  if (auto match = dynamic_cast<MatchNode *>(node)) {
+    if (writesVariable(match->subject, name) ||
+        writesVariable(match->otherwise, name))
+      return true;
+    for (auto &arm : match->arms)
+      if (writesVariable(arm.body, name))
+        return true;
+  }
+  return false;
+}
+
+void Compiler::codegenFor(ForNode *loop) {
+  // Emitted in the rotated form LLVM canonicalizes loops to: a guard, then
+  // the body, then a latch that steps the induction variable and tests it.
+  // The variable is a phi rather than a stack slot and the latch only steps
+  // it while it stays below the end, so the step can't wrap, the trip count
+  // is known up front and nothing needs to be rebuilt before unrolling or
+  // vectorizing.
+  std::string typeName = bindTypes(loop->type);
+  bool isSigned = typeName[0] != 'u';
+  llvm::Type *type = getLLVMType(typeName);
+  llvm::Value *start = coerce(codegenExpr(loop->start->value), typeName);
+  llvm::Value *end = coerce(codegenExpr(loop->end->value), typeName);
+  llvm::Value *step =
+      loop->step ? coerce(codegenExpr(loop->step->value), typeName)
+                 : llvm::ConstantInt::get(type, 1);
+  auto less = [&](llvm::Value *a, llvm::Value *b) {
+    return isSigned ? builder->CreateICmpSLT(a, b, "for.cond")
+                    : builder->CreateICmpULT(a, b, "for.cond");
+  };
+  auto constStepNode =
+      loop->step ? dynamic_cast<ConstInt *>(loop->step->value) : nullptr;
+  // a variable step is checked once, before the loop
+  if (loop->step && !constStepNode) {
+    llvm::Value *zero = llvm::ConstantInt::get(type, 0);
+    runtimeCheck(isSigned ? builder->CreateICmpSGT(step, zero)
+                          : builder->CreateICmpNE(step, zero),
+                 runtimeFailure("prex.step_fail",
+                                "loop step %ld is not positive\n", 1),
+                 {isSigned
+                      ? builder->CreateSExtOrTrunc(step, builder->getInt64Ty())
+                      : builder->CreateZExtOrTrunc(step,
+                                                   builder->getInt64Ty())});
+  }
+  // Another round runs while index + step < end, that is index < end - step
+  // with the subtraction clamped to the smallest value of the type. A step
+  // of 1 can't overshoot the end and tests the stepped variable.
+  bool unitStep =
+      !loop->step || (constStepNode && constStepNode->getValue() == 1);
+  llvm::Value *limit =
+      unitStep ? end
+               : builder->CreateBinaryIntrinsic(
+                     isSigned ? llvm::Intrinsic::ssub_sat
+                              : llvm::Intrinsic::usub_sat,
+                     end, step, nullptr, "for.limit");
+
+  llvm::Function *function = builder->GetInsertBlock()->getParent();
+  llvm::BasicBlock *preheaderBB = builder->GetInsertBlock();
+  llvm::BasicBlock *bodyBB =
+      llvm::BasicBlock::Create(*context, "for.body", function);
+  llvm::BasicBlock *latchBB =
+      llvm::BasicBlock::Create(*context, "for.latch", function);
+  llvm::BasicBlock *afterBB =
+      llvm::BasicBlock::Create(*context, "for.end", function);
+  builder->CreateCondBr(less(start, end), bodyBB, afterBB);
+
+  builder->SetInsertPoint(bodyBB);
+  llvm::PHINode *index = builder->CreatePHI(type, 2, loop->name);
+  index->addIncoming(start, preheaderBB);
+  if (debugInfo && subprogram) {
+    auto location =
+        DILocation::get(*context, loop->line, loop->col, subprogram);
+    debugBuilder->insertDbgValueIntrinsic(
+        index,
+        debugBuilder->createAutoVariable(subprogram, loop->name,
+                                         subprogram->getFile(), loop->line,
+                                         debugType(typeName)),
+        debugBuilder->createExpression(), location, bodyBB);
+  }
+  // The body runs for start <= index < end only. With a start of at least 0,
+  // a constant step and an end of len(a) or a constant, index a[index]
+  // needs no bounds check as long as the body doesn't change what `a` is.
+  auto constStart = dynamic_cast<ConstInt *>(loop->start->value);
+  bool nonNegative = !isSigned || (constStart && constStart->getValue() >= 0);
+  bool constStep = !loop->step || constStepNode;
+  auto lenCall = dynamic_cast<FunctionCallNode *>(loop->end->value);
+  auto constEnd = dynamic_cast<ConstInt *>(loop->end->value);
+  bool hasRange = false;
+  if (nonNegative && constStep && lenCall && lenCall->name == "len" &&
+      lenCall->args.size() == 1 && !module->getFunction("len")) {
+    auto array = dynamic_cast<ConstIdentifier *>(lenCall->args[0]->value);
+    if (array && !writesVariable(loop->body, array->name) &&
+        lookupVar(array->name)) {
+      indexRanges.push_back({index, lookupVar(array->name), 0});
+      hasRange = true;
+    }
+  } else if (nonNegative && constStep && constEnd &&
+             constEnd->getValue() >= 0) {
+    indexRanges.push_back({index, nullptr, (uint64_t)constEnd->getValue()});
+    hasRange = true;
+  }
+  enterScope();
+  declareVar(loop->name, index, typeName);
+  codegenBody(loop->body);
+  exitScope();
+  if (hasRange)
+    indexRanges.pop_back();
+  if (!builder->GetInsertBlock()->getTerminator())
+    builder->CreateBr(latchBB);
+  // keep the latch behind the blocks of the body
+  latchBB->moveAfter(builder->GetInsertBlock());
+
+  builder->SetInsertPoint(latchBB);
+  setLocation(loop);
+  llvm::Value *next = builder->CreateAdd(index, step, loop->name + ".next",
+                                         /*HasNUW=*/!isSigned,
+                                         /*HasNSW=*/isSigned);
+  auto backEdge = builder->CreateCondBr(
+      unitStep ? less(next, end) : less(index, limit), bodyBB, afterBB);
+  backEdge->setMetadata(llvm::LLVMContext::MD_loop,
+                        loopMetadata(loop->attributes, true));
+  index->addIncoming(next, latchBB);
+  afterBB->moveAfter(latchBB);
+  builder->SetInsertPoint(afterBB);
+}
+
 void Compiler::codegenLoop(LoopNode *loop) {
   llvm::Function *function = builder->GetInsertBlock()->getParent();
   llvm::BasicBlock *condBB =
@@ -672,35 +3958,20 @@ void Compiler::codegenLoop(LoopNode *loop) {
 
   builder->CreateBr(condBB);
   builder->SetInsertPoint(condBB);
-  llvm::Value *condValue = codegenExpr(loop->condition->value);
-  condValue = builder->CreateICmpNE(
-      condValue, llvm::ConstantInt::get(condValue->getType(), 0), "loopcond");
-  builder->CreateCondBr(condValue, bodyBB, afterBB);
+  llvm::MDNode *weights;
+  llvm::Value *condValue = codegenCondition(loop->condition, weights);
+  builder->CreateCondBr(condValue, bodyBB, afterBB, weights);
 
   builder->SetInsertPoint(bodyBB);
   enterScope();
-  for (auto node : loop->body->nodes) {
-    if (auto var = dynamic_cast<VarNode *>(node)) {
-      codegenVar(var);
-    } else if (auto assign = dynamic_cast<VarAssignNode *>(node)) {
-      codegenVarAssign(assign);
-    } else if (auto exprStmt = dynamic_cast<ExprNode *>(node)) {
-      codegenExpr(exprStmt->value);
-    } else if (auto ret = dynamic_cast<RetNode *>(node)) {
-      if (ret->expr) {
-        llvm::Value *retVal = codegenExpr(ret->expr->value);
-        builder->CreateRet(retVal);
-      }
-    } else if (auto innerIf = dynamic_cast<IfNode *>(node)) {
-      codegenIf(innerIf);
-    } else if (auto innerLoop = dynamic_cast<LoopNode *>(node)) {
-      codegenLoop(innerLoop);
-    }
-  }
+  codegenBody(loop->body);
   exitScope();
 
   if (!builder->GetInsertBlock()->getTerminator()) {
-    builder->CreateBr(condBB);
+    setLocation(loop);
+    auto backEdge = builder->CreateBr(condBB);
+    if (llvm::MDNode *metadata = loopMetadata(loop->attributes, false))
+      backEdge->setMetadata(llvm::LLVMContext::MD_loop, metadata);
   }
 
   builder->SetInsertPoint(afterBB);
@@ -714,9 +3985,11 @@ void Compiler::exitScope() {
     localsStack.pop_back();
 }
 
-void Compiler::declareVar(const std::string &name, llvm::Value *value) {
+void Compiler::declareVar(const std::string &name, llvm::Value *value,
+                          const std::string &typeName) {
   if (!localsStack.empty())
     localsStack.back()[name] = value;
+  varTypes[value] = typeName;
 }
 
 llvm::Value *Compiler::lookupVar(const std::string &name) {
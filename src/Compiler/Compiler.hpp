@@ -1,5 +1,6 @@
 #pragma once
 #include "../Parser/Ast/Arg.hpp"
+#include "../Parser/Ast/Attribute.hpp"
 #include "../Parser/Ast/BinOpNode.hpp"
 #include "../Parser/Ast/BodyNode.hpp"
 #include "../Parser/Ast/ConstChar.hpp"
@@ -8,18 +9,30 @@
 #include "../Parser/Ast/ConstString.hpp"
 #include "../Parser/Ast/DefunNode.hpp"
 #include "../Parser/Ast/ExprNode.hpp"
+#include "../Parser/Ast/ForNode.hpp"
 #include "../Parser/Ast/FunctionCallNode.hpp"
 #include "../Parser/Ast/IfNode.hpp"
+#include "../Parser/Ast/IndexNode.hpp"
 #include "../Parser/Ast/LoopNode.hpp"
+#include "../Parser/Ast/MatchNode.hpp"
+#include "../Parser/Ast/MemberNode.hpp"
 #include "../Parser/Ast/RetNode.hpp"
 #include "../Parser/Ast/RootNode.hpp"
+#include "../Parser/Ast/StructNode.hpp"
 #include "../Parser/Ast/UnaryOpNode.hpp"
 #include "../Parser/Ast/VarAssignNode.hpp"
 #include "../Parser/Ast/VarNode.hpp"
 #include "../Parser/Node.hpp"
+#include "../Cache/CompilationCache.hpp"
+#include "Abi.hpp"
+#include "Backend.hpp"
+#include "ImportGraph.hpp"
+#include "Remarks.hpp"
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
@@ -27,6 +40,7 @@
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Verifier.h>
+#include <map>
 #include <memory>
 #include <stack>
 #include <string>
@@ -37,36 +51,384 @@ public:
   Compiler();
   ~Compiler();
   RootNode *root;
-  void compile();
+  // False (with `error` set) when an imported module can't be loaded or
+  // linked.
+  bool compile();
+  // compile() for a `root` that only holds signatures and imports (see
+  // Parser::parseSignatures): the functions are lowered one at a time as
+  // `next` returns them, until it returns nullptr. Nothing refers to a
+  // function after it was lowered, so `next` may delete the previous one;
+  // except for a generic function, which is lowered once per instance when
+  // the unit is done and has to stay until compileStream returns.
+  bool compileStream(const std::function<DefunNode *()> &next);
+  std::string error;
+  // Lowers a single function into `module`; callers declare what it uses.
+  llvm::Function *compileFunction(DefunNode *def);
   void printLlvm();
   void writeLlvmToFile(const std::string &filename);
-  void loadAndCompileModule(const std::string &modulePath);
+  // Creates `machine` for `target` (once) and stamps the module with its
+  // triple and data layout; false with `error` set for an unknown target.
+  bool configureTarget();
+  // Runs the -O pipeline selected by target.optLevel, with `profile`.
+  void optimize();
+  bool writeObjectToFile(const std::string &filename);
+  bool emitObjectToBuffer(std::string &object);
+  void emitBitcodeToBuffer(std::string &bitcode);
+  // Summary carrying bitcode for a ThinLTO link, see emitThinLtoBitcode.
+  bool emitThinLtoBitcodeToBuffer(std::string &bitcode);
+  // Compiles every transitively imported module in parallel, wave by wave,
+  // declares what they export and keeps them in `importedModules`.
+  bool compileImports();
+  // Links `importedModules` into `module`.
+  bool linkImportedModules();
+  // Declares (without defining) the public functions of another unit, so
+  // calls into it can be resolved at link time.
+  llvm::Function *declarePrototype(DefunNode *def);
+  // Also declares the structs of `unitRoot`, its functions may use them.
+  void declarePrototypes(RootNode *unitRoot);
+  // Declares the structs of another unit (or a file split over several
+  // modules) before prototypes that use them are declared one at a time.
+  void declareStructs(RootNode *unitRoot);
+  // Forgets the generic functions declared so far, and their instances, for
+  // callers that reuse one Compiler for several modules and free the ASTs
+  // in between (the daemon).
+  void clearGenerics();
+  // Parsed trees this compiler frees when it is destroyed, after the
+  // generic instances that point into them. `root` may be made of their
+  // nodes; it isn't freed itself.
+  std::vector<RootNode *> ownedTrees;
+  // Set by callers that split one file over several modules (the daemon):
+  // private functions then keep external linkage and the C calling
+  // convention under their name plus this suffix, unique per file.
+  std::string privateSuffix;
+
+  // How `import` statements of `root` are resolved.
+  enum class ImportMode {
+    Link,     // compile the imported modules and link them in
+    Provided, // the caller already declared everything this unit needs
+  };
+  ImportMode importMode = ImportMode::Link;
+  // Keep imported modules separate as ThinLTO bitcode instead of linking
+  // them in; the program is put together by thinLink.
+  bool thinLto = false;
+  std::vector<LtoInput> importedModules;
+  // Reuses compiled imported modules across runs when set.
+  CompilationCache *cache = nullptr;
+  // Where the sources of imported modules come from.
+  SourceResolver resolver = readSourceFile;
+  // Threads that compile the imported modules of one wave: 0 for all cores,
+  // 1 for none, for callers that already run compilations in parallel.
+  unsigned importJobs = 0;
+  // The imported modules, kept for as long as generics point into them.
+  std::unique_ptr<ImportGraph> imports;
 
   // Helper to declare libc functions in LLVM module
   void declareLibcFunctions();
 
+  TargetConfig target;
+  ProfileConfig profile;
+  std::unique_ptr<llvm::TargetMachine> machine;
+  // Enabled remarks of the passes run after compile() end up in
+  // `collectedRemarks`, pointing at the source lines the instructions were
+  // generated for.
+  RemarkOptions remarks;
+  std::vector<Remark> collectedRemarks;
+  // -g: DWARF line tables, functions, types and variables.
+  bool debugInfo = false;
+  // -fno-omit-frame-pointer: every function keeps a frame pointer, so
+  // profilers can walk the stack without unwind tables.
+  bool framePointers = false;
+
   // LLVM context
   std::unique_ptr<llvm::LLVMContext> context;
   std::unique_ptr<llvm::Module> module;
   std::unique_ptr<llvm::IRBuilder<>> builder;
 
 private:
+  // What compile() does before and after lowering the functions of `root`.
+  bool beginUnit();
+  bool finishUnit();
   llvm::Function *codegenDefun(DefunNode *def);
   llvm::Value *codegenExpr(Expression *expr);
   llvm::Value *codegenVar(VarNode *var);
   void codegenVarAssign(VarAssignNode *assign);
-  llvm::Value *codegenFunctionCall(FunctionCallNode *call);
+  // `resultType` is the type of the variable the call initializes, if any.
+  llvm::Value *codegenFunctionCall(FunctionCallNode *call,
+                                   const std::string &resultType = "");
+  // popcount, clz, ctz, bswap, rotl, rotr, add_overflow, mul_overflow,
+  // sat_add, sat_sub, fma and sqrt, lowered to their LLVM intrinsics.
+  llvm::Value *codegenBuiltin(FunctionCallNode *call);
+  // Vectors: `v8i32` is 8 lanes of i32. Operators work lanewise, with a
+  // scalar operand used in every lane; comparisons give a mask of bools.
+  llvm::Value *codegenVectorOp(const std::string &op, llvm::Value *l,
+                               llvm::Value *r, bool isSigned);
+  // `l op r` of two operands of the same integer or floating point type, or
+  // vectors of them; nullptr for an operator it doesn't cover.
+  llvm::Value *codegenArithmetic(const std::string &op, llvm::Value *l,
+                                 llvm::Value *r, bool isSigned);
+  // shuffle, splat, extract, insert, select, the reduce_ family and the
+  // loads and stores; `typeName` is the vector type for splat and the loads.
+  llvm::Value *codegenVectorBuiltin(FunctionCallNode *call,
+                                    const std::string &typeName = "");
+  // load(a, i), store(a, i, v) and their _aligned forms: the lanes of
+  // `type` from or to the elements a[i] onwards, bounds checked.
+  llvm::Value *codegenVectorMemory(FunctionCallNode *call,
+                                   llvm::FixedVectorType *type);
   llvm::Type *getLLVMType(const std::string &typeName);
+  // The alignment of a variable of `type`, more than LLVM's for a struct
+  // with #[align(N)] or #[cacheline], or an array of one.
+  llvm::Align alignOf(llvm::Type *type);
+  // A stack slot in the entry block, taken once however often the code
+  // using it runs.
+  llvm::AllocaInst *entryAlloca(llvm::Type *type, const std::string &name);
+  // The value stored into a variable of type `typeName`. alloc, splat, load
+  // and load_aligned take their type from that variable.
+  llvm::Value *codegenInit(Expression *value, const std::string &typeName);
+
+  // Arrays and slices. A T[N] lives on the stack, a T[] is a {T *data, i64
+  // length} pair; an array used as a value decays to a slice of itself.
+  // Indexing checks the index against the length unless indexInBounds
+  // proves it in range. The elements of an array of a #[soa] struct are
+  // spread over one column per field: a T[N] is a struct of the N-element
+  // arrays and a T[] has a data pointer per column.
+  llvm::Value *codegenIndex(IndexNode *index);
+  // The data pointers, length and element type of the array or slice
+  // `name`; false with `error` set when it is neither.
+  bool arrayParts(const std::string &name, std::vector<llvm::Value *> &data,
+                  llvm::Value *&length, std::string &elementType);
+  // The bounds checked index name[index], nullptr on an error.
+  llvm::Value *elementIndex(const std::string &name, ExprNode *index,
+                            std::vector<llvm::Value *> &data,
+                            std::string &elementType);
+  // Where name[index] is, unless it has columns.
+  llvm::Value *elementAddress(const std::string &name, ExprNode *index,
+                              std::string &elementType);
+  // An index or length as an i64, following the signedness of its type.
+  llvm::Value *codegenOffset(Expression *expr);
+  llvm::Value *makeSlice(const std::vector<llvm::Value *> &data,
+                         llvm::Value *length);
+  // `alloc(n)`: n elements of the slice type `sliceType` from malloc.
+  llvm::Value *codegenAlloc(FunctionCallNode *call,
+                            const std::string &sliceType);
+  // Continues when `holds` does, otherwise calls `failure` with `values`.
+  void runtimeCheck(llvm::Value *holds, llvm::Function *failure,
+                    llvm::ArrayRef<llvm::Value *> values);
+  // A cold function `name` that prints `format` with its i64 arguments to
+  // stderr and aborts.
+  llvm::Function *runtimeFailure(const std::string &name,
+                                 const std::string &format, unsigned values);
+  // Continues when `inBounds` holds, otherwise reports `index` and `length`
+  // and aborts.
+  void boundsCheck(llvm::Value *inBounds, llvm::Value *index,
+                   llvm::Value *length);
+  // What a counted loop proves about its variable in the body: 0 <= index
+  // < len(array), or 0 <= index < bound.
+  struct IndexRange {
+    llvm::Value *index;
+    llvm::Value *array; // nullptr when only `bound` is known
+    uint64_t bound;
+  };
+  std::vector<IndexRange> indexRanges;
+  bool indexInBounds(const std::string &name, Expression *index);
+
+  // Strings. A str is 24 bytes: {i8 *data, i64 length, i64 tag} when it
+  // points at its bytes, or up to 23 bytes kept inline, followed by zeros
+  // and 23 minus the length in the last byte, which is the terminator of a
+  // 23 byte string. The top bit of the last byte tells the two apart: it is
+  // set in the tag of a pointing str, along with StringTerminated when a NUL
+  // follows its bytes and StringOwned when they come from malloc. `s[i]` is
+  // bounds checked like an array element, `s[a:b]` points into the bytes of
+  // `s`, or is inline when `s` is.
+  enum : uint8_t { StringTerminated = 1, StringOwned = 2 };
+  llvm::StructType *stringType();
+  // {i8 *data, i64 length, i64 capacity}, the buffer a strbuf appends to;
+  // there is always a NUL after its bytes once it has one.
+  llvm::StructType *stringBuilderType();
+  // Inline up to 23 bytes, otherwise pointing at a constant.
+  llvm::Constant *stringLiteral(const std::string &text);
+  // A str pointing at `length` bytes at `data`; `flags` is an i8.
+  llvm::Value *makeString(llvm::Value *data, llvm::Value *length,
+                          llvm::Value *flags);
+  // An inline str of the `length` (at most 23) bytes at `data`.
+  llvm::Value *inlineString(llvm::Value *data, llvm::Value *length);
+  // The last byte, and whether that makes `str` inline.
+  llvm::Value *stringTag(llvm::Value *str);
+  llvm::Value *isInlineString(llvm::Value *str);
+  // Where the bytes of `str` are, an inline one is stored to a stack slot.
+  llvm::Value *stringData(llvm::Value *str, llvm::Value *&length);
+  // A NUL terminated pointer to the bytes of `str`, for C. Without a
+  // terminator they are copied to the heap; `copy` is what to free after the
+  // call, a null pointer when nothing was copied.
+  llvm::Value *cString(llvm::Value *str, llvm::Value *&copy);
+  llvm::Value *codegenStringEquals(llvm::Value *l, llvm::Value *r);
+  // `s[start:end]` of the str variable `name`.
+  llvm::Value *codegenSubstring(const std::string &name, ExprNode *start,
+                                ExprNode *end);
+  // append(b, s), to_str(b) and copy(s).
+  llvm::Value *codegenStringBuiltin(FunctionCallNode *call);
+  // to_str(a) of a ch array: a str of its bytes up to the first NUL.
+  llvm::Value *arrayString(ExprNode *array);
+  // Grows a strbuf to at least the given capacity, doubling it.
+  llvm::Function *stringBuilderGrow();
+  // Structs, by name. `elements` maps the fields to the elements of `type`,
+  // which may have padding in between for #[align(N)] fields.
+  struct StructInfo {
+    llvm::StructType *type;
+    std::vector<Arg> fields;
+    std::vector<unsigned> elements;
+    uint64_t align = 0; // when over-aligned, 0 for the natural alignment
+    bool soa = false;
+    std::string layout; // as declared, to tell a redeclaration apart
+  };
+  std::unordered_map<std::string, StructInfo> structs;
+  std::unordered_map<llvm::Type *, std::string> structNames;
+  void declareStruct(StructNode *node);
+  // nullptr unless `typeName` is a struct
+  StructInfo *structInfo(const std::string &typeName);
+  // The struct of an array type's columns, nullptr unless it is #[soa].
+  StructInfo *soaElement(const std::string &arrayType);
+  // The index of `field` in the struct `typeName`, -1 with `error` set
+  // when it has none.
+  int fieldIndex(const std::string &typeName, const std::string &field);
+  // The address of what `expr` reads when that is in memory (a variable, an
+  // element or a field of either), with its type name; nullptr otherwise.
+  llvm::Value *codegenAddress(Expression *expr, std::string &typeName);
+  llvm::Value *codegenMember(MemberNode *member);
+
+  // Calls of the functions taking or returning structs follow the C ABI of
+  // the target (see Abi.hpp); their lowered signatures, by symbol.
+  std::unordered_map<std::string, FunctionAbi> abis;
+  const FunctionAbi *abiOf(const std::string &symbol);
+  llvm::FunctionType *functionType(DefunNode *def);
+  std::vector<std::pair<unsigned, llvm::Attribute>>
+  abiAttributes(const FunctionAbi &abi);
+  // The eightbytes of a struct passed in registers, to and from the struct
+  // at `address`.
+  void storeParts(const AbiPassing &passing,
+                  const std::vector<llvm::Value *> &parts,
+                  llvm::Value *address);
+  std::vector<llvm::Value *> loadParts(const AbiPassing &passing,
+                                       llvm::Value *address);
+  llvm::Value *codegenLoweredCall(llvm::Function *callee,
+                                  const FunctionAbi &abi,
+                                  const std::vector<llvm::Value *> &args);
+  // Of the function being generated: where an sret result goes.
+  const FunctionAbi *currentAbi = nullptr;
+  llvm::Value *resultPointer = nullptr;
+  void emitReturn(llvm::Value *value);
+
+  // Not `pub` and not main.
+  bool isPrivate(DefunNode *def);
+  // Private without a privateSuffix, or an instance: internal linkage and
+  // fastcc.
+  bool isInternal(DefunNode *def);
+  std::string symbolName(DefunNode *def);
+
+  // Generic functions, by name. A call infers the type arguments from its
+  // arguments (and from the variable it initializes, for a type that is
+  // only returned), declares the instance `name<types>` and queues it;
+  // lowerInstances generates the queued ones once the functions of the unit
+  // are done. Every module calling an instance has an internal copy.
+  std::unordered_map<std::string, DefunNode *> generics;
+  // The declared return type of every function by symbol, instances
+  // included, for typeNameOf.
+  std::unordered_map<std::string, std::string> returnTypes;
+  struct Instance {
+    std::string generic;
+    std::unique_ptr<DefunNode> def; // the generic's, with the types bound
+    std::map<std::string, std::string> bindings;
+  };
+  std::unordered_map<std::string, Instance> instances;
+  std::vector<std::string> pendingInstances;
+  // Of the instance being generated.
+  const std::map<std::string, std::string> *typeBindings = nullptr;
+  void declareGeneric(DefunNode *def);
+  // False with `why` set when a type argument conflicts or is unknown.
+  bool inferTypes(DefunNode *generic, FunctionCallNode *call,
+                  const std::string &resultType,
+                  std::map<std::string, std::string> &bindings,
+                  std::string &why);
+  // nullptr with `error` set when the types can't be inferred.
+  llvm::Function *instantiate(FunctionCallNode *call,
+                              const std::string &resultType);
+  void lowerInstances();
+  // `typeName` with the type parameters of the instance being generated
+  // replaced by its type arguments.
+  std::string bindTypes(const std::string &typeName);
+  void applyAttributes(llvm::Function *function, DefunNode *def);
+  // #[memo]: `wrapper` looks the arguments up in a hidden cache and calls
+  // `body` only on a miss.
+  void codegenMemo(DefunNode *def, llvm::Function *wrapper,
+                   llvm::Function *body);
+  // Lowers an if/loop condition to i1. `likely(c)`/`unlikely(c)` are
+  // unwrapped and reported as branch weights for the conditional branch.
+  llvm::Value *codegenCondition(ExprNode *condition,
+                                llvm::MDNode *&branchWeights);
+
+  // `ret f(x)` calls of the function being generated, marked `tail` at its
+  // end unless the address of one of its locals is taken: a tail call may
+  // not use the caller's stack. `become` calls need that guarantee.
+  std::vector<llvm::CallInst *> tailCalls;
+  std::vector<llvm::CallInst *> mustTailCalls;
+  bool addressTaken = false;
+  void codegenBecome(RetNode *ret);
 
   // Stos map lokalnych zmiennych (nazwa -> alloca)
   std::vector<std::unordered_map<std::string, llvm::Value *>> localsStack;
 
   void enterScope();
   void exitScope();
-  void declareVar(const std::string &name, llvm::Value *value);
+  void declareVar(const std::string &name, llvm::Value *value,
+                  const std::string &typeName = "");
+  // declared type names of the locals, by their alloca (or loop index)
+  std::unordered_map<llvm::Value *, std::string> varTypes;
+  // The declared type of the variable an expression reads, or of its left
+  // operand; "" when it isn't known.
+  std::string typeNameOf(Expression *expr);
   llvm::Value *lookupVar(const std::string &name);
 
   // Dodaj deklarację obsługi if
   void codegenIf(IfNode *ifNode);
+  // `if (x == 1) .. else if (x == 2 || x == 3) ..` on one variable, as a
+  // match to lower as a switch; nullptr when the chain has another shape.
+  MatchNode *chainAsMatch(IfNode *ifNode);
+  // A switch on integers; on strings a switch on the length, followed by
+  // the literals of that length.
+  void codegenMatch(MatchNode *match);
+  // Branches to `match` when the bytes at `data` equal `literal`, which is
+  // as long as they are.
+  void codegenStringMatch(llvm::Value *data, const std::string &literal,
+                          llvm::BasicBlock *match,
+                          llvm::BasicBlock *mismatch);
+  llvm::Value *codegenStringEquals(llvm::Value *str,
+                                   const std::string &literal);
   void codegenLoop(LoopNode *loop);
+  void codegenFor(ForNode *loop);
+  void codegenStmt(Node *node);
+  // Statements up to the first one that ends the current block (ret).
+  void codegenBody(BodyNode *body);
+  // llvm.loop metadata for loop attributes, nullptr if there is nothing to
+  // say. Counted loops are known to terminate (`mustProgress`).
+  llvm::MDNode *loopMetadata(const std::vector<Attribute> &attributes,
+                             bool mustProgress);
+  // Integer conversion following the signedness of `typeName`.
+  llvm::Value *coerce(llvm::Value *value, const std::string &typeName);
+
+  // Source locations, set up by compile() for -g and remarks; for remarks
+  // alone the compile unit doesn't emit any debug info.
+  std::unique_ptr<llvm::DIBuilder> debugBuilder;
+  llvm::DICompileUnit *compileUnit = nullptr;
+  llvm::DISubprogram *subprogram = nullptr; // of the function being generated
+  std::unordered_map<std::string, llvm::DIFile *> debugFiles;
+  void createDebugInfo();
+  llvm::DIFile *debugFile(const std::string &path);
+  // nullptr for void
+  llvm::DIType *debugType(const std::string &typeName);
+  std::unordered_map<llvm::Type *, llvm::DIType *> debugStructs;
+  // Describes the stack slot of a local variable or argument (argNo > 0).
+  void declareDebugVariable(llvm::Value *alloca, const std::string &name,
+                            const std::string &typeName, Node *node,
+                            unsigned argNo = 0);
+  // Following instructions belong to `node`'s line.
+  void setLocation(Node *node);
 };
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "ImportGraph.hpp"
+#include "../Lexer/Lexer.hpp"
+#include "../Parser/Ast/ImportNode.hpp"
+#include "../Parser/Parser.hpp"
+#include <algorithm>
+#include <deque>
+#include <fstream>
+
+std::string ImportGraph::modulePathToFile(const std::string &modulePath) {
+  std::string file = modulePath;
+  for (auto &c : file)
+    if (c == '.')
+      c = '/';
+  return file + ".prx";
+}
+
+bool readSourceFile(const std::string &file, std::string &source) {
+  std::ifstream in(file);
+  if (!in.is_open())
+    return false;
+  source = std::string((std::istreambuf_iterator<char>(in)),
+                       std::istreambuf_iterator<char>());
+  return true;
+}
+
+ModuleUnit::~ModuleUnit() { deleteAst(root); }
+
+static std::vector<std::string> importsOf(RootNode *root) {
+  std::vector<std::string> imports;
+  if (!root)
+    return imports;
+  for (auto node : root->nodes)
+    if (auto import = dynamic_cast<ImportNode *>(node))
+      imports.push_back(import->modulePath);
+  return imports;
+}
+
+ModuleUnit *ImportGraph::load(const std::string &modulePath) {
+  auto unit = std::make_unique<ModuleUnit>();
+  unit->modulePath = modulePath;
+  unit->filePath = modulePathToFile(modulePath);
+  if (!resolver(unit->filePath, unit->source)) {
+    error = "Could not open module file: " + unit->filePath;
+    return nullptr;
+  }
+  Lexer lexer(unit->source, unit->filePath);
+  auto tokens = lexer.tokenize();
+  Parser parser(tokens, unit->source, unit->filePath);
+  unit->root = parser.parse();
+  if (parser.failed()) {
+    error = parser.getError();
+    return nullptr;
+  }
+  ModuleUnit *raw = unit.get();
+  units[modulePath] = std::move(unit);
+  return raw;
+}
+
+bool ImportGraph::discover(RootNode *root) {
+  // breadth-first walk over import statements, every module parsed once
+  std::deque<ModuleUnit *> pending;
+  for (auto &path : importsOf(root)) {
+    if (units.count(path))
+      continue;
+    ModuleUnit *unit = load(path);
+    if (!unit)
+      return false;
+    pending.push_back(unit);
+  }
+  while (!pending.empty()) {
+    ModuleUnit *unit = pending.front();
+    pending.pop_front();
+    for (auto &path : importsOf(unit->root)) {
+      auto found = units.find(path);
+      ModuleUnit *dep = nullptr;
+      if (found != units.end()) {
+        dep = found->second.get();
+      } else {
+        dep = load(path);
+        if (!dep)
+          return false;
+        pending.push_back(dep);
+      }
+      if (dep != unit)
+        unit->imports.push_back(dep);
+    }
+  }
+
+  waves.clear();
+  std::set<ModuleUnit *> visiting;
+  for (auto &entry : units)
+    assignWave(entry.second.get(), visiting);
+  for (auto &entry : units) {
+    ModuleUnit *unit = entry.second.get();
+    if (waves.size() <= unit->wave)
+      waves.resize(unit->wave + 1);
+    waves[unit->wave].push_back(unit);
+  }
+  // keep the link order independent of hash map iteration order
+  for (auto &wave : waves)
+    std::sort(wave.begin(), wave.end(), [](ModuleUnit *a, ModuleUnit *b) {
+      return a->modulePath < b->modulePath;
+    });
+  return true;
+}
+
+int ImportGraph::assignWave(ModuleUnit *unit,
+                            std::set<ModuleUnit *> &visiting) {
+  if (unit->wave >= 0)
+    return unit->wave;
+  visiting.insert(unit);
+  int wave = 0;
+  for (auto dep : unit->imports) {
+    // modules only need their imports' signatures, so an import cycle is
+    // broken at the back edge instead of being rejected
+    if (visiting.count(dep))
+      continue;
+    wave = std::max(wave, assignWave(dep, visiting) + 1);
+  }
+  visiting.erase(unit);
+  unit->wave = wave;
+  return wave;
+}
+
+std::vector<ModuleUnit *>
+ImportGraph::transitiveImports(ModuleUnit *unit) const {
+  std::vector<ModuleUnit *> result;
+  std::set<ModuleUnit *> seen = {unit};
+  std::deque<ModuleUnit *> pending(unit->imports.begin(),
+                                   unit->imports.end());
+  while (!pending.empty()) {
+    ModuleUnit *dep = pending.front();
+    pending.pop_front();
+    if (!seen.insert(dep).second)
+      continue;
+    result.push_back(dep);
+    pending.insert(pending.end(), dep->imports.begin(), dep->imports.end());
+  }
+  return result;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "../Parser/Ast/DefunNode.hpp"
+#include "../Parser/Ast/RootNode.hpp"
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Looks up the source of an imported file such as "util/io.prx"; false if
+// there is no such file.
+using SourceResolver =
+    std::function<bool(const std::string &file, std::string &source)>;
+
+// Reads imported files relative to the working directory.
+bool readSourceFile(const std::string &file, std::string &source);
+
+// One imported module: its source, parsed AST and direct imports. The AST
+// is freed with the unit.
+struct ModuleUnit {
+  std::string modulePath;
+  std::string filePath;
+  std::string source;
+  RootNode *root = nullptr;
+  std::vector<ModuleUnit *> imports;
+  int wave = -1;
+  ModuleUnit() = default;
+  ModuleUnit(const ModuleUnit &) = delete;
+  ModuleUnit &operator=(const ModuleUnit &) = delete;
+  ~ModuleUnit();
+};
+
+// Discovers the whole import graph of a program before anything is compiled
+// and groups the modules into waves. A module only depends on modules from
+// earlier waves, so every module of one wave can be compiled in parallel.
+class ImportGraph {
+public:
+  explicit ImportGraph(SourceResolver resolver = readSourceFile)
+      : resolver(std::move(resolver)) {}
+
+  // Parses every reachable module; false (with `error` set) if a module is
+  // missing or doesn't parse.
+  bool discover(RootNode *root);
+  std::string error;
+  const std::vector<std::vector<ModuleUnit *>> &getWaves() const {
+    return waves;
+  }
+  // All modules reachable through the imports of `unit` (not `unit` itself).
+  std::vector<ModuleUnit *> transitiveImports(ModuleUnit *unit) const;
+  bool empty() const { return units.empty(); }
+
+  static std::string modulePathToFile(const std::string &modulePath);
+
+private:
+  SourceResolver resolver;
+  std::unordered_map<std::string, std::unique_ptr<ModuleUnit>> units;
+  std::vector<std::vector<ModuleUnit *>> waves;
+
+  ModuleUnit *load(const std::string &modulePath);
+  int assignWave(ModuleUnit *unit, std::set<ModuleUnit *> &visiting);
+};
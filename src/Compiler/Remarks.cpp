@@ -0,0 +1,200 @@
+#include "Remarks.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/Function.h>
+#include <tuple>
+
+namespace {
+struct RemarkCollector : llvm::DiagnosticHandler {
+  RemarkOptions options;
+  std::vector<Remark> &remarks;
+  RemarkCollector(const RemarkOptions &options, std::vector<Remark> &remarks)
+      : options(options), remarks(remarks) {}
+
+  // passes only build remarks that somebody asked for
+  bool isPassedOptRemarkEnabled(llvm::StringRef) const override {
+    return options.passed;
+  }
+  bool isMissedOptRemarkEnabled(llvm::StringRef) const override {
+    return options.missed;
+  }
+  bool isAnalysisRemarkEnabled(llvm::StringRef) const override {
+    return options.analysis;
+  }
+  bool isAnyRemarkEnabled() const override { return options.enabled(); }
+
+  bool handleDiagnostics(const llvm::DiagnosticInfo &info) override {
+    std::string kind = remarkKind(info.getKind());
+    if (kind.empty())
+      return false;
+    auto &optimization =
+        static_cast<const llvm::DiagnosticInfoOptimizationBase &>(info);
+    if (!optimization.isEnabled())
+      return true;
+    Remark remark;
+    remark.kind = kind;
+    remark.pass = optimization.getPassName();
+    remark.name = optimization.getRemarkName().str();
+    remark.function = optimization.getFunction().getName().str();
+    auto location = optimization.getLocation();
+    // values created by the optimizer may not have a line
+    if (optimization.isLocationAvailable() && location.getLine()) {
+      remark.file = location.getRelativePath().str();
+      remark.line = location.getLine();
+      remark.column = location.getColumn();
+    }
+    remark.message = optimization.getMsg();
+    remarks.push_back(remark);
+    return true;
+  }
+
+  static std::string remarkKind(int kind) {
+    switch (kind) {
+    case llvm::DK_OptimizationRemark:
+    case llvm::DK_MachineOptimizationRemark:
+      return "passed";
+    case llvm::DK_OptimizationRemarkMissed:
+    case llvm::DK_MachineOptimizationRemarkMissed:
+      return "missed";
+    case llvm::DK_OptimizationRemarkAnalysis:
+    case llvm::DK_OptimizationRemarkAnalysisFPCommute:
+    case llvm::DK_OptimizationRemarkAnalysisAliasing:
+    case llvm::DK_MachineOptimizationRemarkAnalysis:
+      return "analysis";
+    default:
+      return "";
+    }
+  }
+};
+} // namespace
+
+void collectRemarks(llvm::LLVMContext &context, const RemarkOptions &options,
+                    std::vector<Remark> &remarks) {
+  context.setDiagnosticHandler(
+      std::make_unique<RemarkCollector>(options, remarks));
+}
+
+static auto remarkOrder(const Remark &r) {
+  return std::tie(r.file, r.line, r.column, r.kind, r.pass, r.name,
+                  r.function, r.message);
+}
+
+void sortRemarks(std::vector<Remark> &remarks) {
+  std::sort(remarks.begin(), remarks.end(),
+            [](const Remark &a, const Remark &b) {
+              return remarkOrder(a) < remarkOrder(b);
+            });
+  remarks.erase(std::unique(remarks.begin(), remarks.end(),
+                            [](const Remark &a, const Remark &b) {
+                              return remarkOrder(a) == remarkOrder(b);
+                            }),
+                remarks.end());
+}
+
+void printRemarks(const std::vector<Remark> &remarks) {
+  for (auto &remark : remarks) {
+    if (remark.file.empty())
+      fprintf(stderr, "<%s>: ", remark.function.c_str());
+    else
+      fprintf(stderr, "%s:%u:%u: ", remark.file.c_str(), remark.line,
+              remark.column);
+    fprintf(stderr, "%s remark: %s", remark.kind.c_str(),
+            remark.message.c_str());
+    // remarks requested with a loop hint are reported without a pass
+    if (!remark.pass.empty())
+      fprintf(stderr, " [%s]", remark.pass.c_str());
+    fprintf(stderr, "\n");
+  }
+}
+
+static std::string jsonString(const std::string &s) {
+  std::string out = "\"";
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+static std::string yamlString(const std::string &s) {
+  std::string out = "'";
+  for (char c : s) {
+    if (c == '\'')
+      out += "''";
+    else if (c == '\n')
+      out += ' ';
+    else
+      out += c;
+  }
+  return out + "'";
+}
+
+static void writeJson(const std::vector<Remark> &remarks, std::ostream &out) {
+  out << "[\n";
+  for (size_t i = 0; i < remarks.size(); ++i) {
+    auto &r = remarks[i];
+    out << "  {\"kind\": " << jsonString(r.kind)
+        << ", \"pass\": " << jsonString(r.pass)
+        << ", \"name\": " << jsonString(r.name)
+        << ", \"function\": " << jsonString(r.function);
+    if (!r.file.empty())
+      out << ", \"file\": " << jsonString(r.file) << ", \"line\": " << r.line
+          << ", \"column\": " << r.column;
+    out << ", \"message\": " << jsonString(r.message) << "}"
+        << (i + 1 < remarks.size() ? "," : "") << "\n";
+  }
+  out << "]\n";
+}
+
+// the layout of LLVM's own -fsave-optimization-record files, so the same
+// tools read it, with the message as a single string
+static void writeYaml(const std::vector<Remark> &remarks, std::ostream &out) {
+  for (auto &r : remarks) {
+    std::string tag = r.kind == "passed"   ? "Passed"
+                      : r.kind == "missed" ? "Missed"
+                                           : "Analysis";
+    out << "--- !" << tag << "\n";
+    out << "Pass:            " << yamlString(r.pass) << "\n";
+    out << "Name:            " << yamlString(r.name) << "\n";
+    if (!r.file.empty())
+      out << "DebugLoc:        { File: " << yamlString(r.file)
+          << ", Line: " << r.line << ", Column: " << r.column << " }\n";
+    out << "Function:        " << yamlString(r.function) << "\n";
+    out << "Args:\n";
+    out << "  - String:          " << yamlString(r.message) << "\n";
+    out << "...\n";
+  }
+}
+
+bool writeRemarks(const std::vector<Remark> &remarks, const std::string &path,
+                  std::string &error) {
+  std::ofstream out(path);
+  if (!out.is_open()) {
+    error = "can't open " + path;
+    return false;
+  }
+  bool json =
+      path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+  if (json)
+    writeJson(remarks, out);
+  else
+    writeYaml(remarks, out);
+  if (!out.good()) {
+    error = "can't write " + path;
+    return false;
+  }
+  return true;
+}
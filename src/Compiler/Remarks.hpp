@@ -0,0 +1,43 @@
+#pragma once
+#include <llvm/IR/LLVMContext.h>
+#include <string>
+#include <vector>
+
+// Which optimization remarks to collect (--remarks) and where to write them
+// (--remarks-output, YAML or JSON by extension).
+struct RemarkOptions {
+  bool passed = false;   // optimizations that were applied
+  bool missed = false;   // optimizations that were tried and failed
+  bool analysis = false; // why: the facts the decisions were based on
+  std::string output;
+  bool enabled() const { return passed || missed || analysis; }
+};
+
+struct Remark {
+  std::string kind; // "passed", "missed" or "analysis"
+  std::string pass; // e.g. "inline", "loop-vectorize"
+  std::string name; // e.g. "NotInlined", "MissedDetail"
+  std::string function;
+  std::string file; // empty when the remark has no source location
+  unsigned line = 0;
+  unsigned column = 0;
+  std::string message;
+};
+
+// Installs a diagnostic handler on `context` that enables the remarks
+// selected by `options` and appends them to `remarks`. Other diagnostics
+// are reported as before.
+void collectRemarks(llvm::LLVMContext &context, const RemarkOptions &options,
+                    std::vector<Remark> &remarks);
+
+// Sorts by source location and drops duplicates (a function cloned or
+// inlined into several places reports the same thing more than once).
+void sortRemarks(std::vector<Remark> &remarks);
+
+// file:line:col: <kind> remark: <message> [<pass>], one per line.
+void printRemarks(const std::vector<Remark> &remarks);
+
+// Writes JSON for a path ending in .json and YAML otherwise; false with
+// `error` set when the file can't be written.
+bool writeRemarks(const std::vector<Remark> &remarks, const std::string &path,
+                  std::string &error);
@@ -0,0 +1,419 @@
+#include "Daemon.hpp"
+#include "../Cache/CompilationCache.hpp"
+#include "../Compiler/Backend.hpp"
+#include "../Compiler/Compiler.hpp"
+#include "../Compiler/ImportGraph.hpp"
+#include "../Driver/Driver.hpp"
+#include "../Driver/Options.hpp"
+#include "../Lexer/Lexer.hpp"
+#include "../Parser/Ast/ImportNode.hpp"
+#include "../Parser/Parser.hpp"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <map>
+#include <set>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+std::string defaultSocketPath() {
+  if (const char *runtime = std::getenv("XDG_RUNTIME_DIR"))
+    return std::string(runtime) + "/prex.sock";
+  return "/tmp/prex-" + std::to_string(getuid()) + ".sock";
+}
+
+// A source file as of the last request that used it.
+struct WarmFile {
+  std::string source;
+  RootNode *root = nullptr;
+};
+
+class Daemon {
+public:
+  explicit Daemon(const std::string &workDir);
+  int handle(const Options &options);
+
+private:
+  Compiler compiler; // owns the warm LLVMContext
+  std::string workDir;
+  std::map<std::string, WarmFile> files;
+  // per-function object files, keyed by function source and signatures
+  std::unordered_map<std::string, std::string> functionObjects;
+  std::set<std::string> usedObjects;
+  std::string configuration; // target and -O level of the current request
+
+  WarmFile *load(const std::string &path, std::string &error);
+  bool gatherProgram(const Options &options,
+                     std::vector<std::string> &program, std::string &error);
+  bool objectsOf(const std::string &path, const std::string &signatures,
+                 const std::vector<RootNode *> &roots,
+                 std::vector<std::string> &objects);
+  void evictUnused();
+};
+
+Daemon::Daemon(const std::string &workDir) : workDir(workDir) {
+  llvm::sys::fs::create_directories(workDir);
+}
+
+WarmFile *Daemon::load(const std::string &path, std::string &error) {
+  std::ifstream in(path);
+  if (!in.is_open()) {
+    error = "Could not open file " + path;
+    return nullptr;
+  }
+  std::string source((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+  WarmFile &file = files[path];
+  if (file.root && file.source == source)
+    return &file;
+  Lexer lexer(source, path);
+  auto tokens = lexer.tokenize();
+  Parser parser(tokens, source, path);
+  RootNode *root = parser.parse();
+  if (parser.failed()) {
+    error = parser.getError();
+    return nullptr;
+  }
+  // requests are served one at a time and this one hasn't used the old tree
+  // yet; the compiler only still points into it through its generics
+  if (file.root) {
+    compiler.clearGenerics();
+    deleteAst(file.root);
+  }
+  file.source = source;
+  file.root = root;
+  return &file;
+}
+
+// Sources from the command line followed by everything they import.
+bool Daemon::gatherProgram(const Options &options,
+                           std::vector<std::string> &program,
+                           std::string &error) {
+  std::set<std::string> seen;
+  for (auto &source : options.sources) {
+    llvm::SmallString<256> path(source);
+    llvm::sys::fs::make_absolute(path);
+    if (seen.insert(path.str().str()).second)
+      program.push_back(path.str().str());
+  }
+  for (size_t i = 0; i < program.size(); ++i) {
+    WarmFile *file = load(program[i], error);
+    if (!file)
+      return false;
+    for (auto node : file->root->nodes) {
+      if (auto import = dynamic_cast<ImportNode *>(node)) {
+        llvm::SmallString<256> path(
+            ImportGraph::modulePathToFile(import->modulePath));
+        llvm::sys::fs::make_absolute(path);
+        if (seen.insert(path.str().str()).second)
+          program.push_back(path.str().str());
+      }
+    }
+  }
+  return true;
+}
+
+bool Daemon::objectsOf(const std::string &path, const std::string &signatures,
+                       const std::vector<RootNode *> &roots,
+                       std::vector<std::string> &objects) {
+  WarmFile &file = files[path];
+  // private functions are called across the per-function objects, so they
+  // stay external under a name unique to their file
+  CacheKey fileKey("file");
+  fileKey.add(path);
+  std::string privateSuffix = "." + fileKey.str().substr(0, 16);
+  for (auto node : file.root->nodes) {
+    auto def = dynamic_cast<DefunNode *>(node);
+    // a generic function is compiled into the objects of its callers
+    if (!def || !def->typeParams.empty())
+      continue;
+    CacheKey key("function");
+    key.add(configuration);
+    key.add(privateSuffix);
+    key.add(signatures);
+    key.add(file.source.substr(def->sourceBegin,
+                               def->sourceEnd - def->sourceBegin));
+    std::string hash = key.str();
+    usedObjects.insert(hash);
+    auto found = functionObjects.find(hash);
+    if (found != functionObjects.end()) {
+      objects.push_back(found->second);
+      continue;
+    }
+    // a fresh module in the warm context holding just this function
+    compiler.module =
+        std::make_unique<llvm::Module>(def->name, *compiler.context);
+    compiler.module->setSourceFileName(path);
+    if (!compiler.configureTarget()) {
+      std::cerr << compiler.error << std::endl;
+      return false;
+    }
+    compiler.declareLibcFunctions();
+    compiler.privateSuffix = privateSuffix;
+    // the ASTs may have been reloaded since the previous function
+    compiler.clearGenerics();
+    // the structs first, the prototypes lower their arguments by layout
+    for (auto root : roots)
+      compiler.declareStructs(root);
+    for (auto node : file.root->nodes)
+      if (auto local = dynamic_cast<DefunNode *>(node))
+        compiler.declarePrototype(local);
+    for (auto root : roots)
+      compiler.declarePrototypes(root);
+    if (!compiler.compileFunction(def) || !compiler.error.empty()) {
+      std::cerr << compiler.error << std::endl;
+      return false;
+    }
+    compiler.optimize();
+    std::string objectPath = workDir + "/" + hash + ".o";
+    std::error_code EC;
+    llvm::raw_fd_ostream out(objectPath, EC, llvm::sys::fs::OF_None);
+    std::string error;
+    if (EC || !emitObject(*compiler.module, *compiler.machine, out, error)) {
+      fprintf(stderr, "Error: can't compile %s in %s\n", def->name.c_str(),
+              path.c_str());
+      return false;
+    }
+    functionObjects[hash] = objectPath;
+    objects.push_back(objectPath);
+  }
+  return true;
+}
+
+void Daemon::evictUnused() {
+  for (auto it = functionObjects.begin(); it != functionObjects.end();) {
+    if (usedObjects.count(it->first)) {
+      ++it;
+      continue;
+    }
+    llvm::sys::fs::remove(it->second);
+    it = functionObjects.erase(it);
+  }
+  usedObjects.clear();
+}
+
+int Daemon::handle(const Options &options) {
+  // the compiler outlives the request that failed
+  compiler.error.clear();
+  std::string requested = cacheConfiguration(options);
+  if (requested != configuration) {
+    // objects of the previous configuration stay cached under their own key
+    compiler.target = options.target;
+    compiler.profile = options.profile;
+    compiler.framePointers = options.framePointers;
+    compiler.machine.reset();
+    configuration = requested;
+  }
+  std::vector<std::string> program;
+  std::string error;
+  if (!gatherProgram(options, program, error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  // every function is compiled against the signatures of the whole program,
+  // so a changed signature recompiles everything and a changed body only
+  // recompiles that function
+  std::vector<RootNode *> roots;
+  CacheKey signatureKey("signatures");
+  for (auto &path : program) {
+    roots.push_back(files[path].root);
+    signatureKey.add(path);
+    signatureKey.addSignatures(files[path].root, files[path].source);
+  }
+  std::string signatures = signatureKey.str();
+
+  int ret = 0;
+  if (options.compileOnly) {
+    for (size_t i = 0; i < options.sources.size() && !ret; ++i) {
+      std::vector<std::string> objects;
+      if (!objectsOf(program[i], signatures, roots, objects)) {
+        ret = 1;
+        break;
+      }
+      std::string output = options.output;
+      if (output.empty()) {
+        output = options.sources[i];
+        if (llvm::sys::path::extension(output) == ".prx")
+          output.resize(output.size() - 4);
+        output += ".o";
+      }
+      std::string command = "clang -r";
+      if (!options.target.triple.empty())
+        command += " --target=" + options.target.triple;
+      for (auto &object : objects)
+        command += " " + object;
+      command += " -o " + output;
+      if (system(command.c_str()) != 0) {
+        printf("Error: Failed to link %s\n", output.c_str());
+        ret = 1;
+      }
+    }
+  } else {
+    std::vector<std::string> objects;
+    for (auto &path : program)
+      if (!objectsOf(path, signatures, roots, objects)) {
+        ret = 1;
+        break;
+      }
+    if (!ret) {
+      std::string output =
+          options.output.empty() ? "output.elf" : options.output;
+      std::string command = "clang";
+      if (!options.target.triple.empty())
+        command += " --target=" + options.target.triple;
+      if (options.profile.generate)
+        command += " -fprofile-generate";
+      for (auto &object : objects)
+        command += " " + object;
+      for (auto &object : options.objects)
+        command += " " + object;
+      command += " -o " + output;
+      if (system(command.c_str()) != 0) {
+        printf("Error: Failed to compile LLVM IR to ELF!\n");
+        ret = 1;
+      } else {
+        printf("Generated executable: %s\n", output.c_str());
+      }
+    }
+  }
+  evictUnused();
+  return ret;
+}
+
+// Requests are NUL separated fields: the client's working directory, then
+// its arguments, closed by an empty field. The reply is the output of the
+// compilation followed by '\1' and the exit code.
+static bool readRequest(int fd, std::vector<std::string> &fields) {
+  std::string data;
+  char buffer[4096];
+  while (true) {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n <= 0)
+      break;
+    data.append(buffer, n);
+    if (data.size() >= 2 && data[data.size() - 1] == '\0' &&
+        data[data.size() - 2] == '\0')
+      break;
+  }
+  size_t start = 0;
+  while (start < data.size()) {
+    size_t end = data.find('\0', start);
+    if (end == std::string::npos || end == start)
+      break;
+    fields.push_back(data.substr(start, end - start));
+    start = end + 1;
+  }
+  return !fields.empty();
+}
+
+static void serve(Daemon &daemon, int client) {
+  std::vector<std::string> fields;
+  if (!readRequest(client, fields))
+    return;
+  std::vector<char *> argv = {const_cast<char *>("prex")};
+  for (size_t i = 1; i < fields.size(); ++i)
+    argv.push_back(const_cast<char *>(fields[i].c_str()));
+
+  char previousDir[4096];
+  if (!getcwd(previousDir, sizeof(previousDir)))
+    previousDir[0] = '\0';
+  // everything the compilation prints (including clang) goes to the client
+  fflush(stdout);
+  int savedOut = dup(1), savedErr = dup(2);
+  dup2(client, 1);
+  dup2(client, 2);
+  int ret = 1;
+  Options options;
+  if (chdir(fields[0].c_str()) != 0)
+    printf("Error: Could not enter %s\n", fields[0].c_str());
+  else if (parseOptions(argv.size(), argv.data(), options))
+    ret = daemon.handle(options);
+  fflush(stdout);
+  std::cout.flush();
+  dup2(savedOut, 1);
+  dup2(savedErr, 2);
+  close(savedOut);
+  close(savedErr);
+  if (previousDir[0])
+    chdir(previousDir);
+  std::string status = "\1" + std::to_string(ret);
+  write(client, status.data(), status.size());
+}
+
+int runDaemon(const std::string &socketPath) {
+  signal(SIGPIPE, SIG_IGN);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (fd < 0 || socketPath.size() >= sizeof(addr.sun_path)) {
+    printf("Error: Could not create socket %s\n", socketPath.c_str());
+    return 1;
+  }
+  strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+  unlink(socketPath.c_str());
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+    printf("Error: Could not listen on %s\n", socketPath.c_str());
+    return 1;
+  }
+  printf("prex daemon listening on %s\n", socketPath.c_str());
+  fflush(stdout);
+  Daemon daemon(socketPath + ".objects");
+  while (true) {
+    int client = accept(fd, nullptr, nullptr);
+    if (client < 0)
+      continue;
+    serve(daemon, client);
+    close(client);
+  }
+}
+
+bool runRemote(const std::string &socketPath, int argc, char *argv[],
+               int &exitCode) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+  if (fd < 0 || connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    close(fd);
+    return false;
+  }
+  std::string request = std::string(cwd) + '\0';
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--remote" || arg.compare(0, 9, "--socket=") == 0)
+      continue;
+    request += arg + '\0';
+  }
+  request += '\0';
+  if (write(fd, request.data(), request.size()) != (ssize_t)request.size()) {
+    close(fd);
+    return false;
+  }
+  std::string reply;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+    reply.append(buffer, n);
+  close(fd);
+  size_t status = reply.rfind('\1');
+  if (status == std::string::npos)
+    return false;
+  fwrite(reply.data(), 1, status, stdout);
+  exitCode = std::atoi(reply.c_str() + status + 1);
+  return true;
+}
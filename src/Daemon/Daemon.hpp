@@ -0,0 +1,16 @@
+#pragma once
+#include <string>
+
+// $XDG_RUNTIME_DIR/prex.sock, or /tmp/prex-<uid>.sock
+std::string defaultSocketPath();
+
+// prex --daemon: serves compile requests on a Unix socket. Parsed files,
+// the LLVMContext, the target machine and the object code of every function
+// stay in memory between requests; only functions whose source (or the
+// signatures they are compiled against) changed are compiled again.
+int runDaemon(const std::string &socketPath);
+
+// prex --remote: hands the command line over to a running daemon and relays
+// its output. Returns false when no daemon answered.
+bool runRemote(const std::string &socketPath, int argc, char *argv[],
+               int &exitCode);
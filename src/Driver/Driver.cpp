@@ -0,0 +1,366 @@
+#include "Driver.hpp"
+#include "../Compiler/Compiler.hpp"
+#include "../Lexer/Lexer.hpp"
+#include "../Parser/Parser.hpp"
+#include "Pipeline.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/ThreadPool.h>
+#include <memory>
+#include <vector>
+
+RootNode *parseSourceFile(const std::string &path) {
+  std::string content;
+  return parseSourceFile(path, content);
+}
+
+static void readSourceOrExit(const std::string &path, std::string &content) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    printf("Error: Could not open file %s\n", path.c_str());
+    std::exit(1);
+  }
+  content = std::string((std::istreambuf_iterator<char>(file)),
+                        std::istreambuf_iterator<char>());
+}
+
+static void exitOnParseError(const Parser &parser) {
+  if (parser.failed()) {
+    std::cerr << parser.getError() << std::endl;
+    std::exit(1);
+  }
+}
+
+RootNode *parseSourceFile(const std::string &path, std::string &content) {
+  readSourceOrExit(path, content);
+  Lexer lexer(content, path);
+  std::vector<Token> tokens = lexer.tokenize();
+  Parser parser(tokens, content, path);
+  RootNode *root = parser.parse();
+  exitOnParseError(parser);
+  return root;
+}
+
+bool compileStreamed(Compiler &compiler,
+                     const std::vector<std::string> &sources) {
+  std::vector<Node *> signatures;
+  std::vector<bool> exportAll;
+  for (auto &source : sources) {
+    std::string content;
+    readSourceOrExit(source, content);
+    Lexer lexer(content, source);
+    Parser parser(lexer, content, source);
+    RootNode *root = parser.parseSignatures();
+    exitOnParseError(parser);
+    signatures.insert(signatures.end(), root->nodes.begin(),
+                      root->nodes.end());
+    exportAll.push_back(parser.exportAll);
+    delete root;
+  }
+  compiler.root = new RootNode(signatures);
+
+  size_t index = 0;
+  std::string content;
+  std::unique_ptr<Lexer> lexer;
+  std::unique_ptr<Parser> parser;
+  DefunNode *previous = nullptr;
+  // lowered per instance at the end of the unit
+  std::vector<DefunNode *> generics;
+  bool compiled = compiler.compileStream([&]() -> DefunNode * {
+    deleteAst(previous);
+    previous = nullptr;
+    while (true) {
+      if (!parser) {
+        if (index == sources.size())
+          return nullptr;
+        readSourceOrExit(sources[index], content);
+        lexer = std::make_unique<Lexer>(content, sources[index]);
+        parser = std::make_unique<Parser>(*lexer, content, sources[index]);
+        parser->exportAll = exportAll[index++];
+      }
+      Node *node = parser->parseNext();
+      exitOnParseError(*parser);
+      if (!node) {
+        parser.reset();
+        lexer.reset();
+      } else if (auto def = dynamic_cast<DefunNode *>(node)) {
+        if (def->typeParams.empty())
+          previous = def;
+        else
+          generics.push_back(def);
+        return def;
+      } else {
+        deleteAst(node); // imports and structs were declared by the pre-pass
+      }
+    }
+  });
+  for (auto def : generics)
+    deleteAst(def);
+  return compiled;
+}
+
+std::string cacheConfiguration(const Options &options) {
+  // "native" is resolved so a cache shared between machines stays correct
+  TargetConfig target = resolveTarget(options.target);
+  std::string configuration = target.triple + ";" + target.cpu + ";" +
+                              target.features + ";O" +
+                              std::to_string(target.optLevel);
+  if (options.thinLto)
+    configuration += ";thinlto";
+  if (options.debugInfo)
+    configuration += ";g";
+  if (options.framePointers)
+    configuration += ";frame-pointers";
+  if (options.profile.generate)
+    configuration += ";profile-generate=" + options.profile.generateFile;
+  if (!options.profile.use.empty()) {
+    // a new profile changes the code even when the sources don't
+    std::string profile;
+    readSourceFile(options.profile.use, profile);
+    CacheKey key("profile");
+    key.add(profile);
+    configuration += ";profile-use=" + key.str();
+  }
+  return configuration;
+}
+
+static bool endsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool writeFile(const std::string &path, const std::string &data) {
+  std::ofstream out(path, std::ios::binary);
+  out << data;
+  return out.good();
+}
+
+static bool reportRemarks(const Options &options,
+                          std::vector<Remark> &remarks) {
+  sortRemarks(remarks);
+  printRemarks(remarks);
+  std::string error;
+  if (!options.remarks.output.empty() &&
+      !writeRemarks(remarks, options.remarks.output, error)) {
+    std::cerr << "Error: " << error << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static std::string objectFileFor(const std::string &source) {
+  std::string base = source;
+  if (base.size() > 4 && base.compare(base.size() - 4, 4, ".prx") == 0)
+    base.resize(base.size() - 4);
+  return base + ".o";
+}
+
+int compileSeparately(const Options &options, CompilationCache *cache) {
+  std::vector<RootNode *> roots;
+  std::vector<std::string> contents(options.sources.size());
+  for (size_t i = 0; i < options.sources.size(); ++i)
+    roots.push_back(parseSourceFile(options.sources[i], contents[i]));
+
+  std::vector<int> failed(roots.size(), 0);
+  std::vector<std::vector<Remark>> remarks(roots.size());
+  llvm::ThreadPool pool;
+  for (size_t i = 0; i < roots.size(); ++i) {
+    pool.async([&, i] {
+      std::string objectFile = options.output.empty()
+                                   ? objectFileFor(options.sources[i])
+                                   : options.output;
+      // imports are only declared here, their objects are built separately
+      ImportGraph graph;
+      if (!graph.discover(roots[i])) {
+        std::cerr << graph.error << std::endl;
+        failed[i] = 1;
+        return;
+      }
+      CacheKey key("object");
+      if (cache) {
+        key.add(cache->configuration);
+        // the object names its source file, in the debug info as well
+        key.add(options.sources[i]);
+        key.add(contents[i]);
+        for (size_t j = 0; j < roots.size(); ++j)
+          if (j != i)
+            key.addSignatures(roots[j], contents[j]);
+        for (auto &wave : graph.getWaves())
+          for (auto unit : wave)
+            key.addSignatures(unit->root, unit->source);
+        std::string object;
+        if (cache->lookup(key.str(), object)) {
+          failed[i] = !writeFile(objectFile, object);
+          return;
+        }
+      }
+      Compiler compiler;
+      compiler.target = options.target;
+      compiler.profile = options.profile;
+      compiler.remarks = options.remarks;
+      compiler.debugInfo = options.debugInfo;
+      compiler.framePointers = options.framePointers;
+      compiler.root = roots[i];
+      compiler.importMode = Compiler::ImportMode::Provided;
+      compiler.module->setSourceFileName(options.sources[i]);
+      for (size_t j = 0; j < roots.size(); ++j)
+        if (j != i)
+          compiler.declarePrototypes(roots[j]);
+      for (auto &wave : graph.getWaves())
+        for (auto unit : wave)
+          compiler.declarePrototypes(unit->root);
+      if (!compiler.compile()) {
+        std::cerr << compiler.error << std::endl;
+        failed[i] = 1;
+        return;
+      }
+      std::string object;
+      bool emitted;
+      if (options.thinLto) {
+        emitted = compiler.emitThinLtoBitcodeToBuffer(object);
+      } else {
+        compiler.optimize();
+        emitted = compiler.emitObjectToBuffer(object);
+      }
+      remarks[i] = std::move(compiler.collectedRemarks);
+      if (!emitted) {
+        std::cerr << compiler.error << std::endl;
+        failed[i] = 1;
+        return;
+      }
+      if (cache)
+        cache->store(key.str(), object);
+      failed[i] = !writeFile(objectFile, object);
+    });
+  }
+  pool.wait();
+  if (options.remarks.enabled()) {
+    std::vector<Remark> all;
+    for (auto &unitRemarks : remarks)
+      all.insert(all.end(), unitRemarks.begin(), unitRemarks.end());
+    if (!reportRemarks(options, all))
+      return 1;
+  }
+  for (size_t i = 0; i < roots.size(); ++i)
+    if (failed[i]) {
+      printf("Error: Failed to compile %s\n", options.sources[i].c_str());
+      return 1;
+    }
+  return 0;
+}
+
+int compileAndLink(const Options &options, CompilationCache *cache) {
+  std::string output = options.output.empty() ? "output.elf" : options.output;
+  std::string command = "clang";
+  // bitcode objects (from -c --lto=thin) go through the ThinLTO link, native
+  // objects straight to the linker
+  std::vector<LtoInput> ltoInputs;
+  std::vector<std::string> nativeObjects;
+  std::vector<std::string> temporaries; // objects made here, for the link
+  for (auto &object : options.objects) {
+    std::string data;
+    if (endsWith(object, ".o") && readSourceFile(object, data) &&
+        isBitcode(data))
+      ltoInputs.push_back({object, std::move(data)});
+    else
+      nativeObjects.push_back(object);
+  }
+  if (!options.sources.empty()) {
+    Compiler compiler;
+    compiler.target = options.target;
+    compiler.profile = options.profile;
+    compiler.remarks = options.remarks;
+    compiler.debugInfo = options.debugInfo;
+    compiler.framePointers = options.framePointers;
+    compiler.module->setSourceFileName(options.sources[0]);
+    compiler.cache = cache;
+    compiler.thinLto = options.thinLto;
+    bool compiled;
+    if (options.pipeline) {
+      compiled = compilePipelined(compiler, options.sources);
+    } else if (options.stream) {
+      compiled = compileStreamed(compiler, options.sources);
+    } else {
+      std::vector<Node *> nodes;
+      for (auto &source : options.sources) {
+        RootNode *root = parseSourceFile(source);
+        nodes.insert(nodes.end(), root->nodes.begin(), root->nodes.end());
+      }
+      compiler.root = new RootNode(nodes);
+      compiled = compiler.compile();
+    }
+    if (!compiled) {
+      std::cerr << compiler.error << std::endl;
+      return 1;
+    }
+    if (options.thinLto) {
+      ltoInputs.insert(ltoInputs.end(), compiler.importedModules.begin(),
+                       compiler.importedModules.end());
+      ltoInputs.push_back({options.sources[0], ""});
+      if (!compiler.emitThinLtoBitcodeToBuffer(ltoInputs.back().bitcode)) {
+        std::cerr << compiler.error << std::endl;
+        return 1;
+      }
+    } else {
+      // code generated here, by the target machine with the profile's
+      // function splitting; clang only links
+      compiler.optimize();
+      compiler.writeLlvmToFile("output.ll");
+      std::string object;
+      if (!compiler.emitObjectToBuffer(object)) {
+        std::cerr << compiler.error << std::endl;
+        return 1;
+      }
+      llvm::SmallString<128> path;
+      llvm::sys::fs::createTemporaryFile("prex", "o", path);
+      writeFile(path.str().str(), object);
+      temporaries.push_back(path.str().str());
+      command += " " + temporaries.back();
+    }
+    if (options.remarks.enabled() &&
+        !reportRemarks(options, compiler.collectedRemarks))
+      return 1;
+  }
+  if (!ltoInputs.empty()) {
+    std::vector<std::string> objects;
+    std::string error;
+    bool nativeCode = !nativeObjects.empty() ||
+                      (!options.sources.empty() && !options.thinLto);
+    if (!thinLink(ltoInputs, options.target, options.profile, options.ltoJobs,
+                  nativeCode, objects, error)) {
+      std::cerr << "Error: ThinLTO link failed: " << error << std::endl;
+      return 1;
+    }
+    for (auto &object : objects) {
+      llvm::SmallString<128> path;
+      llvm::sys::fs::createTemporaryFile("prex-lto", "o", path);
+      writeFile(path.str().str(), object);
+      temporaries.push_back(path.str().str());
+      command += " " + temporaries.back();
+    }
+  }
+  if (!options.target.triple.empty())
+    command += " --target=" + options.target.triple;
+  if (options.debugInfo)
+    command += " -g";
+  // only links the profile runtime, which writes the .profraw file at exit;
+  // the code was instrumented by the optimization pipeline
+  if (options.profile.generate)
+    command += " -fprofile-generate";
+  for (auto &object : nativeObjects)
+    command += " " + object;
+  command += " -o " + output;
+  int ret = system(command.c_str());
+  for (auto &object : temporaries)
+    llvm::sys::fs::remove(object);
+  if (ret != 0) {
+    printf("Error: Failed to compile LLVM IR to ELF!\n");
+    return 1;
+  }
+  printf("Generated executable: %s\n", output.c_str());
+  return 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "../Cache/CompilationCache.hpp"
+#include "../Parser/Ast/RootNode.hpp"
+#include "Options.hpp"
+#include <string>
+#include <vector>
+
+// Lexes and parses one source file, exits on errors like the parser does.
+RootNode *parseSourceFile(const std::string &path);
+RootNode *parseSourceFile(const std::string &path, std::string &content);
+
+class Compiler;
+
+// --stream: a signature pre-pass over `sources`, then their functions are
+// parsed, lowered and deleted one at a time, so the tokens and the AST of
+// a single function are all that is kept in memory. Exits on parse errors.
+bool compileStreamed(Compiler &compiler,
+                     const std::vector<std::string> &sources);
+
+// Everything besides the sources that changes the generated code.
+std::string cacheConfiguration(const Options &options);
+
+// -c: every source is its own compilation unit and becomes its own object
+// file. Calls into the other sources and into imports are only declared.
+int compileSeparately(const Options &options, CompilationCache *cache);
+
+// Default mode: all sources (and their imports) in one module, linked into
+// an executable together with any object files from the command line.
+int compileAndLink(const Options &options, CompilationCache *cache);
@@ -0,0 +1,194 @@
+#include "Options.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string.h>
+#include <unistd.h>
+
+void printUsage(const char *argv0) {
+  printf("Usage: %s [options] <file1.prx> [file2.prx ...] [file.o ...]\n",
+         argv0);
+  printf("Options:\n");
+  printf("  -c                  compile each source into its own object file\n");
+  printf("  -o <file>           output file\n");
+  printf("  -O0 .. -O3          optimization level (default -O0)\n");
+  printf("  -g                  emit DWARF debug info\n");
+  printf("  -fno-omit-frame-pointer\n");
+  printf("                      keep frame pointers for stack unwinding\n");
+  printf("  --target=<triple>   generate code for another target, e.g.\n");
+  printf("                      aarch64-linux-gnu (default: the host)\n");
+  printf("  --mcpu=<cpu>        CPU to tune and select instructions for;\n");
+  printf("                      `native` is the host CPU and its features\n");
+  printf("  -march=native       same as --mcpu=native\n");
+  printf("  --mattr=<features>  enable/disable features, e.g. +avx2,-fma\n");
+  printf("  --profile-generate[=<dir>]\n");
+  printf("                      instrument the program, it writes a .profraw\n");
+  printf("                      profile (into <dir>) when it exits\n");
+  printf("  --profile-use=<file.profdata>\n");
+  printf("                      optimize branches, inlining and function\n");
+  printf("                      order for a merged profile; build it at the\n");
+  printf("                      same -O level (-O1 or higher) as the\n");
+  printf("                      instrumented program\n");
+  printf("  --lto=thin          emit ThinLTO bitcode (with -c) or link the\n");
+  printf("                      program with ThinLTO, inlining across modules\n");
+  printf("  --lto-jobs=<n>      parallel ThinLTO backends (0: every core)\n");
+  printf("  --remarks=<kinds>   report optimizations by source line; kinds\n");
+  printf("                      is a list of passed,missed,analysis or all\n");
+  printf("  --remarks-output=<file>\n");
+  printf("                      also write them as JSON (*.json) or YAML\n");
+  printf("  --stream            parse and lower one function at a time,\n");
+  printf("                      freeing it before reading the next\n");
+  printf("  --pipeline          --stream with lexing, parsing and code\n");
+  printf("                      generation running concurrently\n");
+  printf("  --cache[=<dir>]     reuse compiled modules from an on-disk cache\n");
+  printf("                      (also enabled by setting PREX_CACHE_DIR)\n");
+  printf("  --cache-size=<MB>   evict old cache entries beyond this size\n");
+  printf("  --cache-stats       print cache statistics\n");
+  printf("  --no-cache          disable the cache\n");
+  printf("  --daemon            keep compiler state warm and serve requests\n");
+  printf("  --remote            compile through a running daemon\n");
+  printf("  --socket=<path>     daemon socket\n");
+}
+
+static bool endsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool startsWith(const std::string &s, const std::string &prefix) {
+  return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+  if (std::getenv("PREX_CACHE_DIR"))
+    options.useCache = true;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--cache") {
+      options.useCache = true;
+    } else if (startsWith(arg, "--cache=")) {
+      options.useCache = true;
+      options.cacheDir = arg.substr(8);
+    } else if (startsWith(arg, "--cache-size=")) {
+      options.cacheSizeMB = std::strtoull(arg.c_str() + 13, nullptr, 10);
+    } else if (arg == "--cache-stats") {
+      options.cacheStats = true;
+    } else if (arg == "--no-cache") {
+      options.useCache = false;
+    } else if (arg == "--daemon") {
+      options.daemon = true;
+    } else if (arg == "--remote") {
+      options.remote = true;
+    } else if (startsWith(arg, "--socket=")) {
+      options.socket = arg.substr(9);
+    } else if (startsWith(arg, "--target=")) {
+      options.target.triple = arg.substr(9);
+    } else if (startsWith(arg, "--mcpu=")) {
+      options.target.cpu = arg.substr(7);
+    } else if (startsWith(arg, "-march=")) {
+      options.target.cpu = arg.substr(7);
+    } else if (startsWith(arg, "--mattr=")) {
+      if (!options.target.features.empty())
+        options.target.features += ",";
+      options.target.features += arg.substr(8);
+    } else if (arg.size() == 3 && startsWith(arg, "-O") && arg[2] >= '0' &&
+               arg[2] <= '3') {
+      options.target.optLevel = arg[2] - '0';
+    } else if (arg == "--profile-generate") {
+      options.profile.generate = true;
+    } else if (startsWith(arg, "--profile-generate=")) {
+      options.profile.generate = true;
+      options.profile.generateFile = arg.substr(19) + "/default_%m.profraw";
+    } else if (startsWith(arg, "--profile-use=")) {
+      options.profile.use = arg.substr(14);
+      if (access(options.profile.use.c_str(), R_OK) != 0) {
+        printf("Error: can't read profile %s\n", options.profile.use.c_str());
+        return false;
+      }
+    } else if (arg == "--lto=thin") {
+      options.thinLto = true;
+    } else if (startsWith(arg, "--lto=")) {
+      printf("Error: only --lto=thin is supported\n");
+      return false;
+    } else if (startsWith(arg, "--lto-jobs=")) {
+      options.ltoJobs = std::strtoul(arg.c_str() + 11, nullptr, 10);
+    } else if (startsWith(arg, "--remarks=")) {
+      std::string kinds = arg.substr(10);
+      size_t begin = 0;
+      while (begin <= kinds.size()) {
+        size_t end = kinds.find(',', begin);
+        if (end == std::string::npos)
+          end = kinds.size();
+        std::string kind = kinds.substr(begin, end - begin);
+        if (kind == "passed") {
+          options.remarks.passed = true;
+        } else if (kind == "missed") {
+          options.remarks.missed = true;
+        } else if (kind == "analysis") {
+          options.remarks.analysis = true;
+        } else if (kind == "all") {
+          options.remarks.passed = options.remarks.missed =
+              options.remarks.analysis = true;
+        } else {
+          printf("Error: unknown remark kind '%s'\n", kind.c_str());
+          return false;
+        }
+        begin = end + 1;
+      }
+    } else if (startsWith(arg, "--remarks-output=")) {
+      options.remarks.output = arg.substr(17);
+    } else if (arg == "-g") {
+      options.debugInfo = true;
+    } else if (arg == "-fno-omit-frame-pointer") {
+      options.framePointers = true;
+    } else if (arg == "-fomit-frame-pointer") {
+      options.framePointers = false;
+    } else if (arg == "--stream") {
+      options.stream = true;
+    } else if (arg == "--pipeline") {
+      options.stream = true;
+      options.pipeline = true;
+    } else if (arg == "-c") {
+      options.compileOnly = true;
+    } else if (arg == "-o") {
+      if (i + 1 >= argc) {
+        printf("Error: -o needs a file name\n");
+        return false;
+      }
+      options.output = argv[++i];
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      printf("Error: unknown option %s\n", arg.c_str());
+      return false;
+    } else if (endsWith(arg, ".o") || endsWith(arg, ".a")) {
+      options.objects.push_back(arg);
+    } else {
+      options.sources.push_back(arg);
+    }
+  }
+  if (options.sources.empty() && options.objects.empty() &&
+      !options.cacheStats && !options.daemon) {
+    printUsage(argv[0]);
+    return false;
+  }
+  if (options.target.cpu == "native" && !options.target.triple.empty()) {
+    printf("Error: --mcpu=native only applies to the host target\n");
+    return false;
+  }
+  if (options.profile.generate && !options.profile.use.empty()) {
+    printf("Error: --profile-generate and --profile-use exclude each other\n");
+    return false;
+  }
+  if (!options.remarks.output.empty() && !options.remarks.enabled()) {
+    printf("Error: --remarks-output needs --remarks\n");
+    return false;
+  }
+  if (options.stream && options.compileOnly) {
+    printf("Error: --stream and --pipeline can't be combined with -c\n");
+    return false;
+  }
+  if (options.compileOnly && !options.output.empty() &&
+      options.sources.size() != 1) {
+    printf("Error: -o with -c needs exactly one source file\n");
+    return false;
+  }
+  return true;
+}
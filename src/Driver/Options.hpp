@@ -0,0 +1,38 @@
+#pragma once
+#include "../Compiler/Backend.hpp"
+#include "../Compiler/Remarks.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Command line of the `prex` executable.
+struct Options {
+  std::vector<std::string> sources; // .prx files
+  std::vector<std::string> objects; // prebuilt objects handed to the linker
+  bool compileOnly = false;         // -c: one object file per source
+  std::string output;               // -o
+  TargetConfig target;              // --target, --mcpu, --mattr, -O
+  ProfileConfig profile;            // --profile-generate, --profile-use
+  bool thinLto = false;             // --lto=thin
+  unsigned ltoJobs = 0;             // --lto-jobs, 0 for every core
+  RemarkOptions remarks;            // --remarks, --remarks-output
+  bool debugInfo = false;           // -g
+  bool framePointers = false;       // -fno-omit-frame-pointer
+  bool stream = false;              // --stream: a function at a time
+  bool pipeline = false;            // --pipeline: --stream on threads
+
+  // persistent compilation cache
+  bool useCache = false;
+  std::string cacheDir;
+  uint64_t cacheSizeMB = 1024;
+  bool cacheStats = false;
+
+  // compiler daemon
+  bool daemon = false; // --daemon: serve requests on `socket`
+  bool remote = false; // --remote: send this compilation to the daemon
+  std::string socket;
+};
+
+void printUsage(const char *argv0);
+// Returns false (after printing why) on a malformed command line.
+bool parseOptions(int argc, char *argv[], Options &options);
@@ -0,0 +1,182 @@
+#include "Pipeline.hpp"
+#include "../Compiler/Compiler.hpp"
+#include "../Lexer/Lexer.hpp"
+#include "../Parser/Parser.hpp"
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace {
+// Bounded ring buffer for one producer and one consumer thread. Neither
+// side takes a lock: each only moves its own index, and waits on the other
+// one while the queue is full or empty.
+template <typename T> class SpscQueue {
+public:
+  explicit SpscQueue(size_t capacity) : slots(capacity + 1) {}
+
+  void push(T value) {
+    size_t tail = this->tail.load(std::memory_order_relaxed);
+    size_t next = (tail + 1) % slots.size();
+    while (next == head.load(std::memory_order_acquire))
+      head.wait(next, std::memory_order_acquire);
+    slots[tail] = std::move(value);
+    this->tail.store(next, std::memory_order_release);
+    this->tail.notify_one();
+  }
+
+  T pop() {
+    size_t head = this->head.load(std::memory_order_relaxed);
+    while (head == tail.load(std::memory_order_acquire))
+      tail.wait(head, std::memory_order_acquire);
+    T value = std::move(slots[head]);
+    this->head.store((head + 1) % slots.size(), std::memory_order_release);
+    this->head.notify_one();
+    return value;
+  }
+
+private:
+  std::vector<T> slots;
+  // on their own cache lines, each is written by one thread only
+  alignas(64) std::atomic<size_t> head{0}; // next slot to pop
+  alignas(64) std::atomic<size_t> tail{0}; // next slot to push
+};
+
+// A file's tokens are split into chunks, the last one ends with EOF_TOKEN.
+struct TokenChunk {
+  size_t file = 0;
+  std::shared_ptr<const std::string> source;
+  std::vector<Token> tokens;
+};
+
+struct ParsedFunction {
+  size_t file = 0;
+  DefunNode *def = nullptr; // nullptr after the last one
+};
+
+const size_t chunkTokens = 4096;
+const size_t queuedChunks = 16;
+const size_t queuedFunctions = 64;
+} // namespace
+
+bool compilePipelined(Compiler &compiler,
+                      const std::vector<std::string> &sources) {
+  // the first error of each stage, reported once every thread is done
+  std::string prepassError, lexError, parseError;
+
+  std::vector<Node *> signatures;
+  std::vector<bool> exportAll(sources.size());
+  std::thread prepass([&] {
+    for (size_t i = 0; i < sources.size() && prepassError.empty(); ++i) {
+      std::string content;
+      if (!readSourceFile(sources[i], content)) {
+        prepassError = "Error: Could not open file " + sources[i];
+        return;
+      }
+      Lexer lexer(content, sources[i]);
+      Parser parser(lexer, content, sources[i]);
+      RootNode *root = parser.parseSignatures();
+      if (parser.failed())
+        prepassError = parser.getError();
+      signatures.insert(signatures.end(), root->nodes.begin(),
+                        root->nodes.end());
+      exportAll[i] = parser.exportAll;
+      delete root;
+    }
+  });
+
+  SpscQueue<TokenChunk> chunks(queuedChunks);
+  std::thread lexing([&] {
+    for (size_t i = 0; i < sources.size(); ++i) {
+      auto content = std::make_shared<std::string>();
+      if (!readSourceFile(sources[i], *content) && lexError.empty())
+        lexError = "Error: Could not open file " + sources[i];
+      Lexer lexer(*content, sources[i]);
+      TokenChunk chunk{i, content, {}};
+      chunk.tokens.reserve(chunkTokens);
+      while (true) {
+        chunk.tokens.push_back(lexer.next());
+        bool end = chunk.tokens.back().type == "EOF_TOKEN";
+        if (end || chunk.tokens.size() == chunkTokens) {
+          chunks.push(std::move(chunk));
+          chunk = TokenChunk{i, content, {}};
+          chunk.tokens.reserve(chunkTokens);
+        }
+        if (end)
+          break;
+      }
+    }
+  });
+
+  SpscQueue<ParsedFunction> functions(queuedFunctions);
+  std::thread parsing([&] {
+    for (size_t i = 0; i < sources.size(); ++i) {
+      TokenChunk chunk = chunks.pop();
+      size_t next = 0;
+      bool end = false;
+      auto tokenSource = [&] {
+        if (end) // the rest belongs to the next file
+          return chunk.tokens.back();
+        if (next == chunk.tokens.size()) {
+          chunk = chunks.pop();
+          next = 0;
+        }
+        end = chunk.tokens[next].type == "EOF_TOKEN";
+        return chunk.tokens[next++];
+      };
+      // keeps the chunk's source alive while the parser copies it
+      std::shared_ptr<const std::string> content = chunk.source;
+      Parser parser(tokenSource, *content, sources[i]);
+      while (Node *node = parser.parseNext()) {
+        if (auto def = dynamic_cast<DefunNode *>(node))
+          functions.push({i, def});
+        else
+          deleteAst(node); // imports and structs are declared by the pre-pass
+      }
+      if (parser.failed() && parseError.empty())
+        parseError = parser.getError();
+      // the parser stops at an error, the lexer doesn't
+      while (!end)
+        tokenSource();
+    }
+    functions.push({});
+  });
+
+  prepass.join();
+  DefunNode *previous = nullptr;
+  // lowered per instance at the end of the unit
+  std::vector<DefunNode *> generics;
+  bool done = false;
+  auto nextFunction = [&]() -> DefunNode * {
+    deleteAst(previous);
+    previous = nullptr;
+    ParsedFunction item = functions.pop();
+    done = !item.def;
+    if (!item.def)
+      return nullptr;
+    item.def->isPublic |= exportAll[item.file];
+    if (item.def->typeParams.empty())
+      previous = item.def;
+    else
+      generics.push_back(item.def);
+    return item.def;
+  };
+  bool compiled = false;
+  if (prepassError.empty()) {
+    compiler.root = new RootNode(signatures);
+    compiled = compiler.compileStream(nextFunction);
+  }
+  // drained, so the other stages can finish after an error
+  while (!done)
+    nextFunction();
+  lexing.join();
+  parsing.join();
+  for (auto def : generics)
+    deleteAst(def);
+
+  for (auto error : {prepassError, lexError, parseError})
+    if (!error.empty()) {
+      compiler.error = error;
+      return false;
+    }
+  return compiled;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <string>
+#include <vector>
+
+class Compiler;
+
+// --pipeline: --stream with every stage on its own thread. One thread runs
+// the signature pre-pass, one lexes `sources` into chunks of tokens, one
+// parses them into functions and the calling thread lowers those into
+// `compiler` as they arrive. The stages are connected by bounded queues, so
+// a stage that gets ahead waits and memory stays bounded as with --stream.
+// False with compiler.error set on a parse or compile error.
+bool compilePipelined(Compiler &compiler,
+                      const std::vector<std::string> &sources);
@@ -6,13 +6,22 @@ Lexer::Lexer(const std::string &input, const std::string &filename)
 
 std::vector<Token> Lexer::tokenize() {
   tokens.clear();
+  Token token = next();
+  while (token.type != "EOF_TOKEN") {
+    tokens.push_back(token);
+    token = next();
+  }
+  tokens.push_back(token);
+  return tokens;
+}
+
+Token Lexer::next() {
   while (!isAtEnd()) {
     Token token = nextToken();
     if (token.type != "EOF_TOKEN")
-      tokens.push_back(token);
+      return token;
   }
-  tokens.push_back(Token(EOF_TOKEN, "", pos));
-  return tokens;
+  return Token(EOF_TOKEN, "", pos);
 }
 
 void Lexer::advance() { pos++; }
@@ -46,7 +55,8 @@ std::string Lexer::readNumber() {
   while (!isAtEnd()) {
     if (isDigit(peek())) {
       advance();
-    } else if (peek() == '.' && !dotFound) {
+    } else if (peek() == '.' && !dotFound && isDigit(peekNext())) {
+      // "0..n" is a range, not the number "0."
       dotFound = true;
       advance();
     } else {
@@ -98,6 +108,8 @@ TokenType Lexer::checkKeyword(const std::string &word) {
     return KEYWORD_DEFUN;
   if (word == "ret")
     return KEYWORD_RET;
+  if (word == "become")
+    return KEYWORD_BECOME;
   if (word == "if")
     return KEYWORD_IF;
   if (word == "else")
@@ -106,6 +118,8 @@ TokenType Lexer::checkKeyword(const std::string &word) {
     return KEYWORD_LOOP;
   if (word == "for")
     return KEYWORD_FOR;
+  if (word == "match")
+    return KEYWORD_MATCH;
   if (word == "struct")
     return KEYWORD_STRUCT;
   if (word == "enum")
@@ -120,6 +134,8 @@ TokenType Lexer::checkKeyword(const std::string &word) {
     return KEYWORD_FROM;
   if (word == "impl")
     return KEYWORD_IMPL;
+  if (word == "pub")
+    return KEYWORD_PUB;
   if (word == "true")
     return CONSTANT_TRUE;
   if (word == "false")
@@ -178,6 +194,10 @@ Token Lexer::nextToken() {
         advance();
         return Token(SYMBOL_EQUAL, "==", start);
       }
+      if (peek() == '>') {
+        advance();
+        return Token(SYMBOL_FAT_ARROW, "=>", start);
+      }
       return Token(SYMBOL_ASSIGN, "=", start);
     case '!':
       advance();
@@ -242,7 +262,14 @@ Token Lexer::nextToken() {
       return Token(SYMBOL_COLON, ":", start);
     case '.':
       advance();
+      if (peek() == '.') {
+        advance();
+        return Token(SYMBOL_RANGE, "..", start);
+      }
       return Token(SYMBOL_DOT, ".", start);
+    case '#':
+      advance();
+      return Token(SYMBOL_HASH, "#", start);
     case '>':
       advance();
       if (peek() == '=') {
@@ -9,6 +9,9 @@ class Lexer {
 public:
   Lexer(const std::string &input, const std::string &filename);
   std::vector<Token> tokenize();
+  // The next token, EOF_TOKEN once the input is used up. For parsing a
+  // token at a time instead of tokenizing everything up front.
+  Token next();
 
 private:
   uint pos;
@@ -0,0 +1,68 @@
+#include "Prex.hpp"
+#include "../Compiler/Compiler.hpp"
+#include "../Lexer/Lexer.hpp"
+#include "../Parser/Parser.hpp"
+#include <llvm/Support/raw_ostream.h>
+
+PrexResult prexCompile(const PrexRequest &request) {
+  PrexResult result;
+  // frees the trees with everything else of this compilation
+  Compiler compiler;
+  std::vector<Node *> nodes;
+  for (auto &source : request.sources) {
+    Lexer lexer(source.text, source.name);
+    auto tokens = lexer.tokenize();
+    Parser parser(tokens, source.text, source.name);
+    RootNode *root = parser.parse();
+    compiler.ownedTrees.push_back(root);
+    if (parser.failed()) {
+      result.error = parser.getError();
+      return result;
+    }
+    nodes.insert(nodes.end(), root->nodes.begin(), root->nodes.end());
+  }
+
+  compiler.target.triple = request.triple;
+  compiler.target.cpu = request.cpu;
+  compiler.target.features = request.features;
+  compiler.target.optLevel = request.optLevel;
+  compiler.profile.generate = request.profileGenerate;
+  compiler.profile.use = request.profileUse;
+  compiler.debugInfo = request.debugInfo;
+  compiler.framePointers = request.framePointers;
+  compiler.importJobs = request.importJobs;
+  if (!request.sources.empty())
+    compiler.module->setSourceFileName(request.sources[0].name);
+  RootNode program(nodes);
+  compiler.root = &program;
+  if (request.resolver)
+    compiler.resolver = request.resolver;
+  if (!compiler.compile()) {
+    result.error = compiler.error;
+    return result;
+  }
+  if (request.output != PrexOutputKind::ThinLtoBitcode)
+    compiler.optimize();
+  switch (request.output) {
+  case PrexOutputKind::Object:
+    if (!compiler.emitObjectToBuffer(result.output)) {
+      result.error = compiler.error;
+      return result;
+    }
+    break;
+  case PrexOutputKind::Bitcode:
+    compiler.emitBitcodeToBuffer(result.output);
+    break;
+  case PrexOutputKind::ThinLtoBitcode:
+    compiler.emitThinLtoBitcodeToBuffer(result.output);
+    break;
+  case PrexOutputKind::Ir: {
+    llvm::raw_string_ostream out(result.output);
+    compiler.module->print(out, nullptr);
+    out.flush();
+    break;
+  }
+  }
+  result.ok = true;
+  return result;
+}
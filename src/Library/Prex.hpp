@@ -0,0 +1,53 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+// libprex: the compiler as a library. Every call is self-contained (own
+// LLVMContext, own import graph, no process-wide state), so any number of
+// compilations may run concurrently on different threads. Nothing touches
+// the filesystem unless the resolver does.
+
+struct PrexSource {
+  std::string name; // used in diagnostics
+  std::string text;
+};
+
+enum class PrexOutputKind {
+  Object,         // native object file for the target
+  Bitcode,        // LLVM bitcode
+  ThinLtoBitcode, // bitcode with a module summary, for a ThinLTO link
+  Ir,             // textual LLVM IR
+};
+
+struct PrexRequest {
+  // compiled together into one module, like files on the prex command line
+  std::vector<PrexSource> sources;
+  // Returns the source of an imported file ("util/io.prx" for
+  // `import util.io;`). When empty, imports are read from the filesystem.
+  std::function<bool(const std::string &file, std::string &source)> resolver;
+  PrexOutputKind output = PrexOutputKind::Object;
+  // same meaning as --target, --mcpu and --mattr; empty means the host
+  std::string triple;
+  std::string cpu;
+  std::string features;
+  int optLevel = 0; // 0..3
+  // --profile-generate and --profile-use
+  bool profileGenerate = false;
+  std::string profileUse;
+  // -g and -fno-omit-frame-pointer
+  bool debugInfo = false;
+  bool framePointers = false;
+  // Threads for the imported modules of one compile: 1 compiles them on the
+  // calling thread, which suits callers running compiles in parallel; 0
+  // uses all cores.
+  unsigned importJobs = 1;
+};
+
+struct PrexResult {
+  bool ok = false;
+  std::string error;  // first error when !ok
+  std::string output; // object file, bitcode or IR
+};
+
+PrexResult prexCompile(const PrexRequest &request);
@@ -0,0 +1,16 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// `#[name]` or `#[name(arg, ...)]` written in front of a declaration. The
+// arguments are kept as written, e.g. "always" or "capacity=64".
+class Attribute {
+public:
+  std::string name;
+  std::vector<std::string> args;
+  Attribute(std::string name, std::vector<std::string> args = {}) {
+    this->name = name;
+    this->args = args;
+  }
+  ~Attribute() = default;
+};
@@ -2,6 +2,7 @@
 
 #include "../Node.hpp"
 #include "Arg.hpp"
+#include "Attribute.hpp"
 #include "BodyNode.hpp"
 #include <string>
 #include <vector>
@@ -12,6 +13,17 @@ public:
   std::vector<Arg> args;
   std::string ret_type;
   BodyNode *body;
+  // `pub defun`: callable from other modules. Everything else is private to
+  // its module (see Parser::parse for files without any `pub`).
+  bool isPublic = false;
+  std::vector<Attribute> attributes; // #[inline], #[cold], ...
+  // `defun max<T>(T: a, b) > T`: lowered once per list of types it is
+  // called with, see Compiler::instantiate.
+  std::vector<std::string> typeParams;
+  std::string file;                  // source file, for source locations
+  // source range of the whole definition, to detect which functions changed
+  uint sourceBegin = 0;
+  uint sourceEnd = 0;
   DefunNode(std::string name, std::vector<Arg> args, std::string ret_type,
             BodyNode *body) {
     this->name = name;
@@ -19,5 +31,11 @@ public:
     this->ret_type = ret_type;
     this->body = body;
   }
+  bool hasAttribute(const std::string &attribute) const {
+    for (auto &a : attributes)
+      if (a.name == attribute)
+        return true;
+    return false;
+  }
   ~DefunNode() = default;
 };
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "../Node.hpp"
+#include "Attribute.hpp"
+#include "BodyNode.hpp"
+#include "ExprNode.hpp"
+#include <string>
+#include <vector>
+
+// for (i32 i in start..end step k) { ... }: `i` runs from `start` up to,
+// but not including, `end`. The bounds and the step are evaluated once.
+class ForNode : public Node {
+public:
+  std::string type;
+  std::string name;
+  ExprNode *start;
+  ExprNode *end;
+  ExprNode *step; // nullptr for 1
+  BodyNode *body;
+  std::vector<Attribute> attributes; // #[unroll(4)], #[vectorize(8)], ...
+  ForNode(std::string type, std::string name, ExprNode *start, ExprNode *end,
+          ExprNode *step, BodyNode *body)
+      : type(type), name(name), start(start), end(end), step(step),
+        body(body) {}
+};
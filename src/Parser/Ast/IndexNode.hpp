@@ -0,0 +1,16 @@
+#pragma once
+
+#include "../Expression.hpp"
+#include "ExprNode.hpp"
+#include <string>
+
+// a[i] reads an element of the array or slice `a`; a[i..j] is the slice of
+// its elements from i up to, but not including, j, sharing a's memory.
+class IndexNode : public Expression {
+public:
+  std::string name;
+  ExprNode *index;
+  ExprNode *end = nullptr; // set for a[i..j]
+  IndexNode(std::string name, ExprNode *index) : name(name), index(index) {}
+  ~IndexNode() = default;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../Node.hpp"
+#include "Attribute.hpp"
 #include "BodyNode.hpp"
 #include "ExprNode.hpp"
 #include <vector>
@@ -9,6 +10,7 @@ class LoopNode : public Node {
 public:
   ExprNode *condition;
   BodyNode *body;
+  std::vector<Attribute> attributes; // #[unroll(4)], #[no_vectorize], ...
   LoopNode(ExprNode *condition, BodyNode *body)
       : condition(condition), body(body) {}
 };
\ No newline at end of file
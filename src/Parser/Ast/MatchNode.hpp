@@ -0,0 +1,24 @@
+#pragma once
+
+#include "../Expression.hpp"
+#include "../Node.hpp"
+#include "BodyNode.hpp"
+#include "ExprNode.hpp"
+#include <vector>
+
+class MatchArm {
+public:
+  std::vector<Expression *> patterns; // integer or string literals
+  BodyNode *body;
+};
+
+// match (x) { 1, 2 => { ... } 3 => { ... } _ => { ... } }: runs the arm
+// with a pattern equal to `x`, or the `_` arm (`otherwise`) when there is
+// none. `x` is evaluated once; the first of two equal patterns wins.
+class MatchNode : public Node {
+public:
+  ExprNode *subject;
+  std::vector<MatchArm> arms;
+  BodyNode *otherwise = nullptr;
+  MatchNode(ExprNode *subject) : subject(subject) {}
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "../Expression.hpp"
+#include "ExprNode.hpp"
+#include <string>
+
+// p.x reads the field x of the struct `object`: a variable, an element a[i],
+// another field or the result of a call.
+class MemberNode : public Expression {
+public:
+  ExprNode *object;
+  std::string field;
+  MemberNode(ExprNode *object, std::string field)
+      : object(object), field(field) {}
+  ~MemberNode() = default;
+};
@@ -6,6 +6,8 @@
 class RetNode : public Node {
 public:
   ExprNode *expr;
+  // `become f(x)`: a call that is guaranteed to reuse the caller's frame
+  bool become = false;
   RetNode(ExprNode *expr) : expr(expr) {}
   ~RetNode() = default;
 };
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "../Node.hpp"
+#include "Arg.hpp"
+#include "Attribute.hpp"
+#include <string>
+#include <vector>
+
+// `struct Point { f64 x; f64 y; }`, optionally preceded by the layout
+// attributes #[packed], #[align(N)], #[cacheline] and #[soa].
+class StructNode : public Node {
+public:
+  std::string name;
+  std::vector<Arg> fields; // in declaration order, which is memory order
+  std::vector<Attribute> attributes;
+  StructNode(std::string name, std::vector<Arg> fields)
+      : name(name), fields(fields) {}
+  bool hasAttribute(const std::string &attribute) const {
+    for (auto &a : attributes)
+      if (a.name == attribute)
+        return true;
+    return false;
+  }
+  ~StructNode() = default;
+};
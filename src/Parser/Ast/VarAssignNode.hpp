@@ -8,6 +8,9 @@ class VarAssignNode : public Node {
 public:
   std::string name;
   ExprNode *value;
+  ExprNode *index = nullptr; // name[index] = value
+  // p.x = value and a[i].x = value: the field written, `name` is p or a
+  ExprNode *target = nullptr;
   VarAssignNode(std::string name, ExprNode *value) : name(name), value(value) {}
   ~VarAssignNode() = default;
 };
\ No newline at end of file
@@ -3,4 +3,7 @@
 class Node {
 public:
   virtual ~Node() = default;
-};
\ No newline at end of file
+  // where the statement starts in its file, 1-based; 0 when unknown
+  unsigned line = 0;
+  unsigned col = 0;
+};
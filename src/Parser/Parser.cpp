@@ -14,11 +14,16 @@
 #include "Ast/FunctionCallNode.hpp"
 #include "Ast/IfNode.hpp"
 #include "Ast/ImportNode.hpp"
+#include "Ast/IndexNode.hpp"
+#include "Ast/MemberNode.hpp"
 #include "Ast/RetNode.hpp"
 #include "Ast/RootNode.hpp"
+#include "Ast/StructNode.hpp"
 #include "Ast/UnaryOpNode.hpp"
 #include "Ast/VarAssignNode.hpp"
 #include "Ast/VarNode.hpp"
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -58,39 +63,282 @@ Parser::Parser(const std::vector<Token> &tokens)
 Parser::Parser(const std::vector<Token> &tokens, const std::string &source_code)
     : tokens(tokens), source_code(source_code), filename("") {}
 
-RootNode *Parser::parse() {
+Parser::Parser(Lexer &lexer, const std::string &source_code,
+               const std::string &filename)
+    : Parser([&lexer] { return lexer.next(); }, source_code, filename) {}
+
+Parser::Parser(std::function<Token()> tokenSource,
+               const std::string &source_code, const std::string &filename)
+    : tokenSource(std::move(tokenSource)), source_code(source_code),
+      filename(filename) {}
+
+static bool isPositiveNumber(const std::string &text) {
+  if (text.empty() || text.size() > 9)
+    return false;
+  for (char c : text)
+    if (c < '0' || c > '9')
+      return false;
+  return std::atoi(text.c_str()) > 0;
+}
+
+// i32[4], not i32[]
+static bool isFixedSizeArray(const std::string &type) {
+  return type.size() > 2 && type.back() == ']' && type[type.size() - 2] != '[';
+}
+
+RootNode *Parser::parse() { return parseTopLevel(true); }
+
+RootNode *Parser::parseSignatures() { return parseTopLevel(false); }
+
+RootNode *Parser::parseTopLevel(bool withBodies) {
   std::vector<Node *> nodes;
   while (peek().type != "EOF_TOKEN") {
-    nodes.push_back(parseStatement());
+    dropConsumedTokens();
+    if (Node *node = parseStatement(withBodies))
+      nodes.push_back(node);
   }
+  // files written before `pub` existed export every function
+  bool anyPublic = false;
+  for (auto node : nodes)
+    if (auto def = dynamic_cast<DefunNode *>(node))
+      anyPublic |= def->isPublic;
+  exportAll = !anyPublic;
+  if (exportAll)
+    for (auto node : nodes)
+      if (auto def = dynamic_cast<DefunNode *>(node))
+        def->isPublic = true;
   return new RootNode(nodes);
 }
 
-Node *Parser::parseStatement() {
+Node *Parser::parseNext() {
+  if (failed())
+    return nullptr;
+  dropConsumedTokens();
+  if (peek().type == "EOF_TOKEN")
+    return nullptr;
+  Node *node = parseStatement();
+  if (auto def = dynamic_cast<DefunNode *>(node))
+    def->isPublic |= exportAll;
+  return node;
+}
+
+void Parser::dropConsumedTokens() {
+  if (tokenSource && !failed()) {
+    tokens.erase(tokens.begin(), tokens.begin() + position);
+    position = 0;
+  }
+}
+
+void deleteAst(Node *node) {
+  if (!node)
+    return;
+  if (auto expr = dynamic_cast<ExprNode *>(node)) {
+    deleteAst(expr->value);
+  } else if (auto def = dynamic_cast<DefunNode *>(node)) {
+    deleteAst(def->body);
+  } else if (auto body = dynamic_cast<BodyNode *>(node)) {
+    for (auto child : body->nodes)
+      deleteAst(child);
+  } else if (auto root = dynamic_cast<RootNode *>(node)) {
+    for (auto child : root->nodes)
+      deleteAst(child);
+  } else if (auto var = dynamic_cast<VarNode *>(node)) {
+    deleteAst(static_cast<Node *>(var->value));
+  } else if (auto assign = dynamic_cast<VarAssignNode *>(node)) {
+    deleteAst(static_cast<Node *>(assign->index));
+    deleteAst(static_cast<Node *>(assign->target));
+    deleteAst(static_cast<Node *>(assign->value));
+  } else if (auto ret = dynamic_cast<RetNode *>(node)) {
+    deleteAst(static_cast<Node *>(ret->expr));
+  } else if (auto ifNode = dynamic_cast<IfNode *>(node)) {
+    deleteAst(static_cast<Node *>(ifNode->condition));
+    deleteAst(ifNode->body);
+    deleteAst(ifNode->elseIf);
+    deleteAst(ifNode->elseBody);
+  } else if (auto loop = dynamic_cast<LoopNode *>(node)) {
+    deleteAst(static_cast<Node *>(loop->condition));
+    deleteAst(loop->body);
+  } else if (auto loop = dynamic_cast<ForNode *>(node)) {
+    deleteAst(static_cast<Node *>(loop->start));
+    deleteAst(static_cast<Node *>(loop->end));
+    deleteAst(static_cast<Node *>(loop->step));
+    deleteAst(loop->body);
+  } else if (auto match = dynamic_cast<MatchNode *>(node)) {
+    deleteAst(static_cast<Node *>(match->subject));
+    for (auto &arm : match->arms) {
+      for (auto pattern : arm.patterns)
+        deleteAst(pattern);
+      deleteAst(arm.body);
+    }
+    deleteAst(match->otherwise);
+  }
+  delete node;
+}
+
+void deleteAst(Expression *expr) {
+  if (!expr)
+    return;
+  if (auto node = dynamic_cast<ExprNode *>(expr)) {
+    deleteAst(static_cast<Node *>(node));
+    return;
+  }
+  if (auto binop = dynamic_cast<BinOpNode *>(expr)) {
+    deleteAst(static_cast<Node *>(binop->left));
+    deleteAst(static_cast<Node *>(binop->right));
+  } else if (auto unop = dynamic_cast<UnaryOpNode *>(expr)) {
+    deleteAst(static_cast<Node *>(unop->expr));
+  } else if (auto call = dynamic_cast<FunctionCallNode *>(expr)) {
+    for (auto arg : call->args)
+      deleteAst(static_cast<Node *>(arg));
+  } else if (auto index = dynamic_cast<IndexNode *>(expr)) {
+    deleteAst(static_cast<Node *>(index->index));
+    deleteAst(static_cast<Node *>(index->end));
+  } else if (auto member = dynamic_cast<MemberNode *>(expr)) {
+    deleteAst(static_cast<Node *>(member->object));
+  }
+  delete expr;
+}
+
+void Parser::setLocation(Node *node, const Token &token) {
+  if (!node || source_code.empty())
+    return;
+  if (lineStarts.empty()) {
+    lineStarts.push_back(0);
+    for (uint i = 0; i < source_code.size(); ++i)
+      if (source_code[i] == '\n')
+        lineStarts.push_back(i + 1);
+  }
+  auto next =
+      std::upper_bound(lineStarts.begin(), lineStarts.end(), token.pos);
+  node->line = next - lineStarts.begin();
+  node->col = token.pos - *(next - 1) + 1;
+}
+
+void Parser::fail(const std::string &message) {
+  // only the first error is reported, parsing stops right after it
+  if (error.empty()) {
+    if (!source_code.empty() && !isAtEnd()) {
+      auto [line, col] = getLineCol(source_code, peek().pos);
+      error = "[" + filename + "] " + message + " at <" +
+              std::to_string(line) + ", " + std::to_string(col) + ">";
+    } else {
+      error = "[" + filename + "] " + message;
+    }
+  }
+  // a streaming parser stops reading, what's left of the input is skipped
+  if (tokenSource && (tokens.empty() || tokens.back().type != "EOF_TOKEN"))
+    tokens.push_back(Token(EOF_TOKEN, "", source_code.size()));
+  position = tokens.size();
+}
+
+Node *Parser::parseStatement(bool withBody) {
+  uint begin = peek().pos;
+  std::vector<Attribute> attributes = parseAttributes();
   Token current = peek();
-  if (current.type == "KEYWORD_DEFUN") {
-    return parseDefun();
+  if (current.type == "KEYWORD_DEFUN" || current.type == "KEYWORD_PUB") {
+    bool isPublic = current.type == "KEYWORD_PUB";
+    if (isPublic)
+      consume("KEYWORD_PUB");
+    checkFunctionAttributes(attributes);
+    Token start = peek();
+    DefunNode *def = parseDefun(withBody);
+    setLocation(def, start);
+    def->file = filename;
+    def->isPublic = isPublic;
+    def->attributes = attributes;
+    def->sourceBegin = begin;
+    return def;
+  }
+  if (current.type == "KEYWORD_STRUCT") {
+    checkStructAttributes(attributes);
+    StructNode *node = parseStruct();
+    setLocation(node, current);
+    node->attributes = attributes;
+    return node;
+  }
+  if (!attributes.empty()) {
+    fail("Attributes must be followed by a function or a struct");
+    return nullptr;
   }
   if (current.type == "KEYWORD_IMPORT") {
     return parseImport();
   }
-  std::cerr << "Unknown statement type" << std::endl;
-  std::exit(1);
+  fail("Unknown statement type");
+  return nullptr;
 }
 
-DefunNode *Parser::parseDefun() {
+DefunNode *Parser::parseDefun(bool withBody) {
   std::string ret_type = "void";
+  uint begin = peek().pos;
   consume("KEYWORD_DEFUN");
   std::string name = consume("IDENTIFIER", "Expected function name.").value;
+  std::vector<std::string> typeParams;
+  if (peek().type == "SYMBOL_LESS") {
+    nextToken();
+    while (!failed()) {
+      std::string param =
+          consume("IDENTIFIER", "Expected type parameter name").value;
+      if (std::find(typeParams.begin(), typeParams.end(), param) !=
+          typeParams.end())
+        fail("Duplicate type parameter '" + param + "' of " + name);
+      typeParams.push_back(param);
+      if (peek().type != "SYMBOL_COMMA")
+        break;
+      nextToken();
+    }
+    consume("SYMBOL_GREATER", "Expected '>' after type parameters");
+  }
   consume("SYMBOL_LPAREN", "Expected '(' after function name.");
   std::vector<Arg> args = parseArgsDecl();
   consume("SYMBOL_RPAREN", "Expected ')' after arguments.");
   consume("SYMBOL_GREATER", "Expected '>' after arguments.");
-  ret_type = consume("IDENTIFIER", "Expected return type.").value;
+  ret_type = parseTypeName("Expected return type.");
+  if (isFixedSizeArray(ret_type))
+    fail("A function can't return a fixed-size array, return a slice");
   consume("SYMBOL_LBRACE");
-  BodyNode *body = parseBody();
+  BodyNode *body = nullptr;
+  if (withBody) {
+    body = parseBody();
+  } else {
+    // up to the matching brace
+    for (int depth = 0; depth > 0 || peek().type != "SYMBOL_RBRACE";) {
+      if (peek().type == "EOF_TOKEN")
+        break;
+      std::string type = nextToken().type;
+      depth += type == "SYMBOL_LBRACE";
+      depth -= type == "SYMBOL_RBRACE";
+    }
+  }
+  uint end = peek().pos + 1;
   consume("SYMBOL_RBRACE");
-  return new DefunNode(name, args, ret_type, body);
+  DefunNode *def = new DefunNode(name, args, ret_type, body);
+  def->typeParams = typeParams;
+  def->sourceBegin = begin;
+  def->sourceEnd = end;
+  return def;
+}
+
+StructNode *Parser::parseStruct() {
+  consume("KEYWORD_STRUCT");
+  std::string name = consume("IDENTIFIER", "Expected struct name").value;
+  consume("SYMBOL_LBRACE", "Expected '{' after struct name");
+  std::vector<Arg> fields;
+  while (peek().type != "SYMBOL_RBRACE" && peek().type != "EOF_TOKEN" &&
+         !failed()) {
+    std::string type = parseTypeName("Expected field type");
+    std::string field = consume("IDENTIFIER", "Expected field name").value;
+    consume("SYMBOL_SEMICOLON", "Expected ';' after field");
+    for (auto &other : fields)
+      if (other.name == field)
+        fail("Duplicate field '" + field + "' in struct " + name);
+    if (type == name)
+      fail("Struct " + name + " can't contain itself");
+    fields.emplace_back(field, type);
+  }
+  consume("SYMBOL_RBRACE", "Expected '}' after struct fields");
+  if (fields.empty())
+    fail("Struct " + name + " has no fields");
+  return new StructNode(name, fields);
 }
 
 void Parser::printAst(Node *node, const std::string &indent, bool isLast) {
@@ -103,8 +351,13 @@ void Parser::printAst(Node *node, const std::string &indent, bool isLast) {
       printAst(root->nodes[i], newIndent, i == root->nodes.size() - 1);
     }
   } else if (auto defun = dynamic_cast<DefunNode *>(node)) {
-    std::cout << indent << branch << "Defun: " << defun->name << " -> "
-              << defun->ret_type << std::endl;
+    std::string typeParams;
+    for (auto &param : defun->typeParams)
+      typeParams += (typeParams.empty() ? "<" : ", ") + param;
+    if (!typeParams.empty())
+      typeParams += ">";
+    std::cout << indent << branch << "Defun: " << defun->name << typeParams
+              << " -> " << defun->ret_type << std::endl;
     std::cout << newIndent << "├── Args:" << std::endl;
     for (size_t i = 0; i < defun->args.size(); ++i) {
       std::string argBranch = (i == defun->args.size() - 1) ? "└── " : "├── ";
@@ -124,9 +377,26 @@ void Parser::printAst(Node *node, const std::string &indent, bool isLast) {
       std::cout << newIndent << "└── InitExpr:" << std::endl;
       printExpression(var->value, newIndent + "    ", true);
     }
+  } else if (auto structNode = dynamic_cast<StructNode *>(node)) {
+    std::cout << indent << branch << "Struct: " << structNode->name
+              << std::endl;
+    for (size_t i = 0; i < structNode->fields.size(); ++i) {
+      auto &field = structNode->fields[i];
+      std::cout << newIndent
+                << (i == structNode->fields.size() - 1 ? "└── " : "├── ")
+                << field.type << " " << field.name << std::endl;
+    }
   } else if (auto assign = dynamic_cast<VarAssignNode *>(node)) {
     std::cout << indent << branch << "VarAssign: name: " << assign->name
               << std::endl;
+    if (assign->target) {
+      std::cout << newIndent << "├── Target:" << std::endl;
+      printExpression(assign->target, newIndent + "│   ", true);
+    }
+    if (assign->index) {
+      std::cout << newIndent << "├── Index:" << std::endl;
+      printExpression(assign->index, newIndent + "│   ", true);
+    }
     if (assign->value) {
       std::cout << newIndent << "└── Value:" << std::endl;
       printExpression(assign->value, newIndent + "    ", true);
@@ -194,6 +464,14 @@ void Parser::printExpression(Expression *expr, const std::string &indent,
       printExpression(funCall->args[i], newIndent,
                       i == funCall->args.size() - 1);
     }
+  } else if (auto index = dynamic_cast<IndexNode *>(expr)) {
+    std::cout << indent << branch << "Index: " << index->name << std::endl;
+    printExpression(index->index, newIndent, !index->end);
+    if (index->end)
+      printExpression(index->end, newIndent, true);
+  } else if (auto member = dynamic_cast<MemberNode *>(expr)) {
+    std::cout << indent << branch << "Member: " << member->field << std::endl;
+    printExpression(member->object, newIndent, true);
   } else if (auto exprNode = dynamic_cast<ExprNode *>(expr)) {
     std::cout << indent << branch << "ExprNode:" << std::endl;
     printExpression(exprNode->value, newIndent, true);
@@ -210,11 +488,29 @@ Node *Parser::parseBodyStmt() {
       return new ExprNode(parseFunctionCall());
     } else if (next.type == "IDENTIFIER") {
       return parseVarDecl();
-    } else if (next.type == "SYMBOL_ASSIGN") {
+    } else if (next.type == "SYMBOL_ASSIGN" || next.type == "SYMBOL_DOT") {
       return parseVarAssign();
+    } else if (next.type == "SYMBOL_LBRACKET") {
+      // `i32[4] a;` and `i32[] s;` declare, `a[i] = x;` and `a[i].f = x;`
+      // assign an element
+      Token third = peek3();
+      bool declaration = third.type == "SYMBOL_RBRACKET" ||
+                         (third.type == "CONSTANT_NUMBER" &&
+                          peekAhead(3).type == "SYMBOL_RBRACKET" &&
+                          peekAhead(4).type == "IDENTIFIER");
+      return declaration ? static_cast<Node *>(parseVarDecl())
+                         : parseVarAssign();
     } else {
       return new ExprNode(parseFunctionCall());
     }
+  } else if (current.type == "KEYWORD_BECOME") {
+    consume("KEYWORD_BECOME");
+    auto call = static_cast<ExprNode *>(parseExpression());
+    if (!dynamic_cast<FunctionCallNode *>(call->value))
+      fail("'become' must be followed by a function call");
+    RetNode *ret = new RetNode(call);
+    ret->become = true;
+    return ret;
   } else if (current.type == "KEYWORD_RET") {
     consume("KEYWORD_RET");
     Expression *v = parseExpression();
@@ -223,6 +519,25 @@ Node *Parser::parseBodyStmt() {
     return parseIf();
   } else if (current.type == "KEYWORD_LOOP") {
     return parseLoop();
+  } else if (current.type == "KEYWORD_FOR") {
+    return parseFor();
+  } else if (current.type == "KEYWORD_MATCH") {
+    return parseMatch();
+  } else if (current.type == "SYMBOL_HASH") {
+    std::vector<Attribute> attributes = parseAttributes();
+    checkLoopAttributes(attributes);
+    if (peek().type == "KEYWORD_FOR") {
+      ForNode *loop = parseFor();
+      loop->attributes = attributes;
+      return loop;
+    }
+    if (peek().type == "KEYWORD_LOOP") {
+      LoopNode *loop = parseLoop();
+      loop->attributes = attributes;
+      return loop;
+    }
+    fail("Loop attributes must be followed by 'for' or 'loop'");
+    return nullptr;
   }
   nextToken();
   return nullptr;
@@ -245,8 +560,25 @@ FunctionCallNode *Parser::parseFunctionCall() {
   return new FunctionCallNode(name, params);
 }
 
+std::string Parser::parseTypeName(const std::string &errorMessage) {
+  std::string type = consume("IDENTIFIER", errorMessage).value;
+  if (peek().type != "SYMBOL_LBRACKET")
+    return type;
+  nextToken();
+  if (peek().type == "CONSTANT_NUMBER") {
+    std::string length = nextToken().value;
+    if (!isPositiveNumber(length))
+      fail("Array length must be a positive number");
+    type += "[" + length + "]";
+  } else {
+    type += "[]";
+  }
+  consume("SYMBOL_RBRACKET", "Expected ']' after array length");
+  return type;
+}
+
 VarNode *Parser::parseVarDecl() {
-  std::string type = consume("IDENTIFIER").value;
+  std::string type = parseTypeName();
   std::string name = consume("IDENTIFIER").value;
   if (peek().type == "SYMBOL_SEMICOLON") {
     consume("SYMBOL_SEMICOLON");
@@ -261,10 +593,28 @@ VarNode *Parser::parseVarDecl() {
 
 VarAssignNode *Parser::parseVarAssign() {
   std::string name = consume("IDENTIFIER").value;
+  ExprNode *index = nullptr;
+  if (peek().type == "SYMBOL_LBRACKET") {
+    nextToken();
+    index = static_cast<ExprNode *>(parseExpression());
+    consume("SYMBOL_RBRACKET", "Expected ']' after index");
+  }
+  ExprNode *target = nullptr;
+  if (peek().type == "SYMBOL_DOT") {
+    // the field of the variable or of the element
+    Expression *object = index ? static_cast<Expression *>(
+                                     new IndexNode(name, index))
+                               : new ConstIdentifier(name);
+    target = static_cast<ExprNode *>(parseMembers(new ExprNode(object)));
+    index = nullptr;
+  }
   consume("SYMBOL_ASSIGN", "Expected '=' after variable name");
   ExprNode *expr = static_cast<ExprNode *>(parseExpression());
   consume("SYMBOL_SEMICOLON", "Missing semicolon after assignment");
-  return new VarAssignNode(name, expr);
+  VarAssignNode *assign = new VarAssignNode(name, expr);
+  assign->index = index;
+  assign->target = target;
+  return assign;
 }
 
 int Parser::getPrecedence(const Token &token) {
@@ -317,8 +667,8 @@ Expression *Parser::parsePrimary() {
   } else if (token.type == "SYMBOL_LPAREN") {
     return parseGroupedExpression();
   } else {
-    std::cerr << "Unexpected token in expression" << std::endl;
-    std::exit(1);
+    fail("Unexpected token in expression");
+    return new ExprNode(new ConstInt(0));
   }
 }
 
@@ -335,10 +685,32 @@ Expression *Parser::parseIdOrFunCall() {
         break;
     }
     consume("SYMBOL_RPAREN", "Expected ')' after function call arguments");
-    return new ExprNode(new FunctionCallNode(name, params));
+    return parseMembers(new ExprNode(new FunctionCallNode(name, params)));
+  }
+  if (peek().type == "SYMBOL_LBRACKET") {
+    nextToken();
+    IndexNode *index =
+        new IndexNode(name, static_cast<ExprNode *>(parseExpression()));
+    if (peek().type == "SYMBOL_RANGE") {
+      nextToken();
+      index->end = static_cast<ExprNode *>(parseExpression());
+    }
+    consume("SYMBOL_RBRACKET", "Expected ']' after index");
+    return parseMembers(new ExprNode(index));
   }
 
-  return new ExprNode(new ConstIdentifier(name));
+  return parseMembers(new ExprNode(new ConstIdentifier(name)));
+}
+
+Expression *Parser::parseMembers(Expression *object) {
+  while (peek().type == "SYMBOL_DOT") {
+    nextToken();
+    std::string field =
+        consume("IDENTIFIER", "Expected field name after '.'").value;
+    object = new ExprNode(
+        new MemberNode(static_cast<ExprNode *>(object), field));
+  }
+  return object;
 }
 
 Expression *Parser::parseGroupedExpression() {
@@ -350,24 +722,42 @@ Expression *Parser::parseGroupedExpression() {
 
 BodyNode *Parser::parseBody() {
   std::vector<Node *> nodes;
-  while (peek().type != "SYMBOL_RBRACE") {
-    nodes.push_back(parseBodyStmt());
+  while (peek().type != "SYMBOL_RBRACE" && peek().type != "EOF_TOKEN") {
+    Token start = peek();
+    Node *node = parseBodyStmt();
+    setLocation(node, start);
+    nodes.push_back(node);
   }
   return new BodyNode(nodes);
 }
 
+void Parser::fill(size_t count) {
+  while (tokenSource && tokens.size() < position + count &&
+         (tokens.empty() || tokens.back().type != "EOF_TOKEN"))
+    tokens.push_back(tokenSource());
+}
+
 Token Parser::peek3() {
+  fill(3);
   if (position + 2 >= tokens.size())
     return tokens.back();
   return tokens[position + 2];
 }
 
+Token Parser::peekAhead(size_t offset) {
+  fill(offset + 1);
+  if (position + offset >= tokens.size())
+    return tokens.back();
+  return tokens[position + offset];
+}
+
 std::vector<Arg> Parser::parseArgsDecl() {
   std::vector<Arg> args;
-  while (peek().type != "SYMBOL_RPAREN") {
+  while (peek().type != "SYMBOL_RPAREN" && peek().type != "EOF_TOKEN") {
 
-    std::string type =
-        consume("IDENTIFIER", "Expected type in argument declaration").value;
+    std::string type = parseTypeName("Expected type in argument declaration");
+    if (isFixedSizeArray(type))
+      fail("Pass a slice instead of a fixed-size array");
     consume("SYMBOL_COLON", "Expected ':' after type");
 
     while (true) {
@@ -378,7 +768,9 @@ std::vector<Arg> Parser::parseArgsDecl() {
         Token next = peek2();
 
         if (next.type == "IDENTIFIER") {
-          if (peek3().type == "SYMBOL_COLON") {
+          // `, i32: b` or `, i32[]: b` start the next group
+          if (peek3().type == "SYMBOL_COLON" ||
+              peek3().type == "SYMBOL_LBRACKET") {
             nextToken();
             break;
           } else {
@@ -402,16 +794,9 @@ Token Parser::consume(const std::string &type,
   if (peek().type == type) {
     return nextToken();
   }
-  std::string msg =
-      errorMessage.empty() ? "Expected token of type " + type : errorMessage;
-  if (msg.find("Expected") != std::string::npos && !source_code.empty()) {
-    auto [line, col] = getLineCol(source_code, peek().pos);
-    std::cerr << "[" << filename << "] " << msg << " at <" << line << ", "
-              << col << ">" << std::endl;
-  } else {
-    std::cerr << "[" << filename << "] " << msg << std::endl;
-  }
-  std::exit(1);
+  fail(errorMessage.empty() ? "Expected token of type " + type
+                            : errorMessage);
+  return tokens.back();
 }
 
 Token Parser::peek() {
@@ -421,6 +806,7 @@ Token Parser::peek() {
 }
 
 Token Parser::peek2() {
+  fill(2);
   if (position + 1 >= tokens.size())
     return tokens.back();
   return tokens[position + 1];
@@ -432,7 +818,10 @@ Token Parser::nextToken() {
   return tokens[position - 1];
 }
 
-bool Parser::isAtEnd() { return position >= tokens.size(); }
+bool Parser::isAtEnd() {
+  fill(1);
+  return position >= tokens.size();
+}
 
 IfNode *Parser::parseIf() {
   consume("KEYWORD_IF");
@@ -469,6 +858,200 @@ LoopNode *Parser::parseLoop() {
   return new LoopNode(condition, body);
 }
 
+std::vector<Attribute> Parser::parseAttributes() {
+  std::vector<Attribute> attributes;
+  while (peek().type == "SYMBOL_HASH") {
+    consume("SYMBOL_HASH");
+    consume("SYMBOL_LBRACKET", "Expected '[' after '#'");
+    std::string name = consume("IDENTIFIER", "Expected attribute name").value;
+    std::vector<std::string> args;
+    if (peek().type == "SYMBOL_LPAREN") {
+      consume("SYMBOL_LPAREN");
+      std::string arg;
+      while (peek().type != "SYMBOL_RPAREN" && peek().type != "EOF_TOKEN") {
+        Token token = nextToken();
+        if (token.type == "SYMBOL_COMMA") {
+          args.push_back(arg);
+          arg.clear();
+        } else {
+          arg += token.value;
+        }
+      }
+      if (!arg.empty())
+        args.push_back(arg);
+      consume("SYMBOL_RPAREN", "Expected ')' after attribute arguments");
+    }
+    consume("SYMBOL_RBRACKET", "Expected ']' after attribute");
+    attributes.emplace_back(name, args);
+  }
+  return attributes;
+}
+
+void Parser::checkFunctionAttributes(
+    const std::vector<Attribute> &attributes) {
+  auto has = [&](const std::string &name) {
+    for (auto &attribute : attributes)
+      if (attribute.name == name)
+        return true;
+    return false;
+  };
+  for (auto &attribute : attributes) {
+    const std::string &name = attribute.name;
+    if (name != "inline" && name != "noinline" && name != "cold" &&
+        name != "hot" && name != "pure" && name != "memo") {
+      fail("Unknown function attribute '" + name + "'");
+      return;
+    }
+    if (name == "memo") {
+      // #[memo(capacity=N, thread_local)], both optional
+      for (auto &arg : attribute.args) {
+        bool capacity = arg.compare(0, 9, "capacity=") == 0 &&
+                        isPositiveNumber(arg.substr(9));
+        if (!capacity && arg != "thread_local") {
+          fail("Invalid argument '" + arg + "' for attribute 'memo'");
+          return;
+        }
+      }
+      continue;
+    }
+    // #[inline(always)] is the only one taking an argument
+    bool always = name == "inline" && attribute.args.size() == 1 &&
+                  attribute.args[0] == "always";
+    if (!attribute.args.empty() && !always) {
+      fail("Unexpected arguments for attribute '" + name + "'");
+      return;
+    }
+  }
+  if (has("inline") && has("noinline"))
+    fail("A function can't be both #[inline] and #[noinline]");
+  else if (has("hot") && has("cold"))
+    fail("A function can't be both #[hot] and #[cold]");
+}
+
+void Parser::checkStructAttributes(
+    const std::vector<Attribute> &attributes) {
+  for (auto &attribute : attributes) {
+    const std::string &name = attribute.name;
+    if (name != "packed" && name != "align" && name != "cacheline" &&
+        name != "soa") {
+      fail("Unknown struct attribute '" + name + "'");
+      return;
+    }
+    // #[align(N)] takes a power of two, the others nothing
+    bool validArgs = attribute.args.empty() && name != "align";
+    if (name == "align" && attribute.args.size() == 1 &&
+        isPositiveNumber(attribute.args[0])) {
+      long long align = std::atoll(attribute.args[0].c_str());
+      validArgs = (align & (align - 1)) == 0 && align <= 4096;
+    }
+    if (!validArgs) {
+      fail("Invalid arguments for attribute '" + name + "'");
+      return;
+    }
+  }
+}
+
+void Parser::checkLoopAttributes(const std::vector<Attribute> &attributes) {
+  bool vectorize = false, noVectorize = false;
+  for (auto &attribute : attributes) {
+    const std::string &name = attribute.name;
+    if (name != "unroll" && name != "vectorize" && name != "no_vectorize") {
+      fail("Unknown loop attribute '" + name + "'");
+      return;
+    }
+    vectorize |= name == "vectorize";
+    noVectorize |= name == "no_vectorize";
+    // #[unroll(count)] and #[vectorize(width)], the argument is optional
+    bool validArgs = attribute.args.empty() ||
+                     (name != "no_vectorize" && attribute.args.size() == 1 &&
+                      isPositiveNumber(attribute.args[0]));
+    if (validArgs && name == "vectorize" && !attribute.args.empty()) {
+      int width = std::atoi(attribute.args[0].c_str());
+      validArgs = (width & (width - 1)) == 0;
+    }
+    if (!validArgs) {
+      fail("Invalid arguments for attribute '" + name + "'");
+      return;
+    }
+  }
+  if (vectorize && noVectorize)
+    fail("A loop can't be both #[vectorize] and #[no_vectorize]");
+}
+
+ForNode *Parser::parseFor() {
+  consume("KEYWORD_FOR");
+  consume("SYMBOL_LPAREN", "Expected '(' after 'for'");
+  std::string type = consume("IDENTIFIER", "Expected loop variable type").value;
+  if (type.size() < 2 || (type[0] != 'i' && type[0] != 'u') ||
+      !isPositiveNumber(type.substr(1)))
+    fail("Loop variable must have an integer type");
+  std::string name = consume("IDENTIFIER", "Expected loop variable name").value;
+  if (peek().type != "IDENTIFIER" || peek().value != "in")
+    fail("Expected 'in' after loop variable");
+  nextToken();
+  ExprNode *start = static_cast<ExprNode *>(parseExpression());
+  consume("SYMBOL_RANGE", "Expected '..' in loop range");
+  ExprNode *end = static_cast<ExprNode *>(parseExpression());
+  ExprNode *step = nullptr;
+  if (peek().type == "IDENTIFIER" && peek().value == "step") {
+    nextToken();
+    step = static_cast<ExprNode *>(parseExpression());
+    auto constant = dynamic_cast<ConstInt *>(step->value);
+    if (constant && constant->getValue() <= 0)
+      fail("Loop step must be positive");
+  }
+  consume("SYMBOL_RPAREN", "Expected ')' after loop range");
+  consume("SYMBOL_LBRACE", "Expected '{' after loop range");
+  BodyNode *body = parseBody();
+  consume("SYMBOL_RBRACE", "Expected '}' after loop body");
+  return new ForNode(type, name, start, end, step, body);
+}
+
+MatchNode *Parser::parseMatch() {
+  consume("KEYWORD_MATCH");
+  consume("SYMBOL_LPAREN", "Expected '(' after 'match'");
+  MatchNode *match =
+      new MatchNode(static_cast<ExprNode *>(parseExpression()));
+  consume("SYMBOL_RPAREN", "Expected ')' after match subject");
+  consume("SYMBOL_LBRACE", "Expected '{' after match subject");
+  while (peek().type != "SYMBOL_RBRACE" && peek().type != "EOF_TOKEN") {
+    if (match->otherwise) {
+      fail("The '_' arm must be the last one");
+      break;
+    }
+    MatchArm arm;
+    if (peek().type == "IDENTIFIER" && peek().value == "_") {
+      consume("IDENTIFIER");
+    } else {
+      while (true) {
+        auto pattern = static_cast<ExprNode *>(parsePrimary());
+        auto negative = dynamic_cast<UnaryOpNode *>(pattern->value);
+        bool isLiteral =
+            dynamic_cast<ConstInt *>(pattern->value) ||
+            dynamic_cast<ConstString *>(pattern->value) ||
+            (negative && negative->op == "-" &&
+             dynamic_cast<ConstInt *>(negative->expr->value));
+        if (!isLiteral)
+          fail("Match patterns must be integer or string literals");
+        arm.patterns.push_back(pattern->value);
+        if (peek().type != "SYMBOL_COMMA")
+          break;
+        consume("SYMBOL_COMMA");
+      }
+    }
+    consume("SYMBOL_FAT_ARROW", "Expected '=>' after match pattern");
+    consume("SYMBOL_LBRACE", "Expected '{' after '=>'");
+    arm.body = parseBody();
+    consume("SYMBOL_RBRACE", "Expected '}' after match arm");
+    if (arm.patterns.empty())
+      match->otherwise = arm.body;
+    else
+      match->arms.push_back(arm);
+  }
+  consume("SYMBOL_RBRACE", "Expected '}' after match arms");
+  return match;
+}
+
 Node *Parser::parseImport() {
   consume("KEYWORD_IMPORT");
   std::string modulePath =
@@ -1,18 +1,24 @@
 #pragma once
+#include "../Lexer/Lexer.hpp"
 #include "../Token/Token.hpp"
 #include "../Token/TokenType.hpp"
 #include "Ast/Arg.hpp"
+#include "Ast/Attribute.hpp"
 #include "Ast/BodyNode.hpp"
 #include "Ast/DefunNode.hpp"
 #include "Ast/ExprNode.hpp"
+#include "Ast/ForNode.hpp"
 #include "Ast/FunctionCallNode.hpp"
 #include "Ast/IfNode.hpp"
 #include "Ast/ImportNode.hpp"
 #include "Ast/LoopNode.hpp"
+#include "Ast/MatchNode.hpp"
 #include "Ast/RetNode.hpp"
 #include "Ast/RootNode.hpp"
+#include "Ast/StructNode.hpp"
 #include "Ast/VarAssignNode.hpp"
 #include "Ast/VarNode.hpp"
+#include <functional>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -23,8 +29,31 @@ public:
   Parser(const std::vector<Token> &tokens, const std::string &source_code,
          const std::string &filename);
   Parser(const std::vector<Token> &tokens, const std::string &source_code);
+  // Pulls tokens from `lexer` as they are needed instead of taking them all
+  // up front; with parseNext only the tokens of one top-level statement are
+  // kept at a time.
+  Parser(Lexer &lexer, const std::string &source_code,
+         const std::string &filename);
+  // Same for tokens from anywhere else, e.g. a lexer on another thread;
+  // `tokenSource` returns EOF_TOKEN at the end.
+  Parser(std::function<Token()> tokenSource, const std::string &source_code,
+         const std::string &filename);
 
   RootNode *parse();
+  // The next top-level statement, nullptr at the end of the input or after
+  // an error.
+  Node *parseNext();
+  // The functions without their bodies (body is nullptr) and the imports:
+  // what a module has to declare before it lowers the first function.
+  RootNode *parseSignatures();
+  // Set by parse and parseSignatures when the file has no `pub`; every
+  // function parseNext returns is then public. Copy it over from the parser
+  // that ran the signature pre-pass.
+  bool exportAll = false;
+  // Parse errors don't abort the process: the first one is kept here and the
+  // rest of the input is skipped.
+  bool failed() const { return !error.empty(); }
+  const std::string &getError() const { return error; }
   void printAst(Node *node, const std::string &indent = "", bool isLast = true);
   void printExpression(Expression *expr, const std::string &indent = "",
                        bool isLast = true);
@@ -32,14 +61,23 @@ public:
 private:
   std::vector<Token> tokens;
   int position = 0;
+  // streaming: `tokens` is a window of what this returns
+  std::function<Token()> tokenSource;
+  void fill(size_t count);
   static const std::unordered_map<std::string, int> precedence;
   std::string source_code;
   std::string filename;
+  std::string error;
 
-  Node *parseStatement();
-  DefunNode *parseDefun();
+  Node *parseStatement(bool withBody = true);
+  RootNode *parseTopLevel(bool withBodies);
+  void dropConsumedTokens();
+  DefunNode *parseDefun(bool withBody = true);
+  StructNode *parseStruct();
   Node *parseBodyStmt();
   FunctionCallNode *parseFunctionCall();
+  // A type name, with [N] for a fixed-size array or [] for a slice.
+  std::string parseTypeName(const std::string &errorMessage = "");
   VarNode *parseVarDecl();
   VarAssignNode *parseVarAssign();
   int getPrecedence(const Token &token);
@@ -50,13 +88,32 @@ private:
   BodyNode *parseBody();
   std::vector<Arg> parseArgsDecl();
   Node *parseImport();
+  std::vector<Attribute> parseAttributes();
+  void checkFunctionAttributes(const std::vector<Attribute> &attributes);
+  void checkLoopAttributes(const std::vector<Attribute> &attributes);
+  void checkStructAttributes(const std::vector<Attribute> &attributes);
+  // `.field` accesses following `object`, if any
+  Expression *parseMembers(Expression *object);
 
+  // Start of each line of source_code, built on first use.
+  std::vector<uint> lineStarts;
+  void setLocation(Node *node, const Token &token);
+
+  void fail(const std::string &message);
   Token consume(const std::string &type, const std::string &errorMessage = "");
   Token peek();
   Token peek2();
   Token nextToken();
   bool isAtEnd();
   Token peek3();
+  // the token `offset` places after the current one
+  Token peekAhead(size_t offset);
   IfNode *parseIf();
   LoopNode *parseLoop();
-};
\ No newline at end of file
+  ForNode *parseFor();
+  MatchNode *parseMatch();
+};
+
+// Deletes a tree returned by the parser, children included.
+void deleteAst(Node *node);
+void deleteAst(Expression *expr);
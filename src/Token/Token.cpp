@@ -10,6 +10,8 @@ std::string Token::tokenTypeToString(TokenType type) {
     return "KEYWORD_DEFUN";
   case KEYWORD_RET:
     return "KEYWORD_RET";
+  case KEYWORD_BECOME:
+    return "KEYWORD_BECOME";
   case KEYWORD_IF:
     return "KEYWORD_IF";
   case KEYWORD_ELSE:
@@ -18,6 +20,8 @@ std::string Token::tokenTypeToString(TokenType type) {
     return "KEYWORD_LOOP";
   case KEYWORD_FOR:
     return "KEYWORD_FOR";
+  case KEYWORD_MATCH:
+    return "KEYWORD_MATCH";
   case KEYWORD_STRUCT:
     return "KEYWORD_STRUCT";
   case KEYWORD_ENUM:
@@ -32,6 +36,8 @@ std::string Token::tokenTypeToString(TokenType type) {
     return "KEYWORD_FROM";
   case KEYWORD_IMPL:
     return "KEYWORD_IMPL";
+  case KEYWORD_PUB:
+    return "KEYWORD_PUB";
   case SYMBOL_PLUS:
     return "SYMBOL_PLUS";
   case SYMBOL_MINUS:
@@ -68,6 +74,12 @@ std::string Token::tokenTypeToString(TokenType type) {
     return "SYMBOL_GREATER";
   case SYMBOL_LESS:
     return "SYMBOL_LESS";
+  case SYMBOL_HASH:
+    return "SYMBOL_HASH";
+  case SYMBOL_RANGE:
+    return "SYMBOL_RANGE";
+  case SYMBOL_FAT_ARROW:
+    return "SYMBOL_FAT_ARROW";
   case SYMBOL_PLUS_ASSIGN:
     return "SYMBOL_PLUS_ASSIGN";
   case SYMBOL_MINUS_ASSIGN:
@@ -3,10 +3,12 @@ enum TokenType {
   // keywords
   KEYWORD_DEFUN,
   KEYWORD_RET,
+  KEYWORD_BECOME,
   KEYWORD_IF,
   KEYWORD_ELSE,
   KEYWORD_LOOP,
   KEYWORD_FOR,
+  KEYWORD_MATCH,
   KEYWORD_STRUCT,
   KEYWORD_ENUM,
   KEYWORD_USE,
@@ -14,6 +16,7 @@ enum TokenType {
   KEYWORD_AS,
   KEYWORD_FROM,
   KEYWORD_IMPL,
+  KEYWORD_PUB,
   KEYWORD_TRUE,
   KEYWORD_FALSE,
 
@@ -36,6 +39,9 @@ enum TokenType {
   SYMBOL_DOT,
   SYMBOL_GREATER,
   SYMBOL_LESS,
+  SYMBOL_HASH,
+  SYMBOL_RANGE,     // ..
+  SYMBOL_FAT_ARROW, // =>
 
   // compound assignment operators
   SYMBOL_PLUS_ASSIGN,     // +=
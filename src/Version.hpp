@@ -0,0 +1,3 @@
+#pragma once
+
+#define PREX_VERSION "0.1.0"
@@ -1,56 +1,51 @@
-#include "Compiler/Compiler.hpp"
-#include "Lexer/Lexer.hpp"
-#include "Parser/Parser.hpp"
+#include "Cache/CompilationCache.hpp"
+#include "Daemon/Daemon.hpp"
+#include "Driver/Driver.hpp"
+#include "Driver/Options.hpp"
 #include <cstdio>
-#include <cstdlib>
-#include <fstream>
-#include <iostream>
-#include <string.h>
-#include <string>
-#include <vector>
+#include <memory>
 
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    printf("Usage: %s <file1.prx> [file2.prx ...]\n", argv[0]);
+  Options options;
+  if (!parseOptions(argc, argv, options))
     return 1;
+  std::string socket =
+      options.socket.empty() ? defaultSocketPath() : options.socket;
+  if (options.daemon)
+    return runDaemon(socket);
+  // the daemon compiles function by function, there is no ThinLTO there and
+  // it neither reports remarks nor emits debug info; it keeps whole files
+  if (options.remote && !options.thinLto && !options.remarks.enabled() &&
+      !options.debugInfo && !options.stream) {
+    int ret;
+    if (runRemote(socket, argc, argv, ret))
+      return ret;
+    fprintf(stderr, "prex: no daemon on %s, compiling locally\n",
+            socket.c_str());
   }
-
-  std::vector<std::string> file_contents;
-  std::vector<Token> all_tokens;
-  std::string all_sources;
-
-  for (int i = 1; i < argc; ++i) {
-    std::ifstream file(argv[i]);
-    if (!file.is_open()) {
-      printf("Error: Could not open file %s\n", argv[i]);
-      return 1;
-    }
-    std::string content((std::istreambuf_iterator<char>(file)),
-                        std::istreambuf_iterator<char>());
-    file_contents.push_back(content);
-    all_sources += content + "\n";
-    file.close();
+  std::unique_ptr<CompilationCache> cache;
+  if (options.useCache || options.cacheStats) {
+    cache = std::make_unique<CompilationCache>(
+        options.cacheDir.empty() ? CompilationCache::defaultDirectory()
+                                 : options.cacheDir,
+        options.cacheSizeMB * 1024 * 1024);
+    cache->configuration = cacheConfiguration(options);
   }
-
-  for (int i = 0; i < file_contents.size(); ++i) {
-    Lexer lexer(file_contents[i], argv[i + 1]);
-    std::vector<Token> tokens = lexer.tokenize();
-    all_tokens.insert(all_tokens.end(), tokens.begin(), tokens.end() - 1);
+  int ret = 0;
+  if (!options.sources.empty() || !options.objects.empty()) {
+    // remarks come out of the optimizer, which a cache hit skips
+    CompilationCache *active = options.useCache && !options.remarks.enabled()
+                                   ? cache.get()
+                                   : nullptr;
+    if (options.compileOnly)
+      ret = compileSeparately(options, active);
+    else
+      ret = compileAndLink(options, active);
   }
-  all_tokens.push_back(Token(EOF_TOKEN, "", 0));
-
-  Parser parser(all_tokens, all_sources);
-  RootNode *ast = parser.parse();
-
-  Compiler compiler;
-  compiler.root = ast;
-  compiler.compile();
-  compiler.writeLlvmToFile("output.ll");
-  int ret = system("clang output.ll -o output.elf");
-  if (ret != 0) {
-    printf("Error: Failed to compile LLVM IR to ELF!\n");
-  } else {
-    printf("Generated executable: output.elf\n");
+  if (cache) {
+    cache->finish();
+    if (options.cacheStats)
+      cache->printStats();
   }
-  return 0;
-}
\ No newline at end of file
+  return ret;
+}